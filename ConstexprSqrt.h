@@ -1,3 +1,5 @@
+#pragma once
+
 // Adapted from https://stackoverflow.com/a/34134071
 
 #include <limits>   
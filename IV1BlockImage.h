@@ -4,11 +4,99 @@
 #include "Support/RGB8Image.h"
 
 #include "ConstexprSqrt.h"
+#include "IV1Kernels.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
 
 namespace IV1 {
 
+// Maps a coordinate past the end of a row or column of `size` samples
+//  back inside it, mirroring around the last sample.
+inline size_t MirrorIndex(size_t idx, size_t size) {
+    return idx < size ? idx : (2 * size - 1 - idx < size ? 2 * size - 1 - idx : 0);
+}
+
+// Fills one row of blockW x blockH blocks, Rec.709 weighted, starting at
+//  `blocks`. Row pointers are mirrored once for the whole row, and only the
+//  last block of a row whose width isn't a multiple of blockW mirrors its
+//  columns; every other block reads whole pixel runs straight through.
+//  `rows` holds the blockH pixel rows of the block row, already mirrored.
+template<size_t blockW, size_t blockH>
+void FillBlockRow(const uint8_t* const rows[blockH], size_t imageWidth,
+                  MatrixRow<float, blockW * blockH * 3>* blocks) {
+    constexpr size_t channels = 3;
+    constexpr size_t rowSamples = blockW * channels;
+    const size_t nBlocksX = (imageWidth + blockW - 1) / blockW;
+    const size_t nWholeBlocksX = imageWidth / blockW;
+
+    constexpr float weights[3] = {
+        constSqrt(0.2125f),
+        constSqrt(0.7154f),
+        constSqrt(0.0721f)
+    };
+
+    // YUV scaling is applied as the samples are read.
+    float rowWeights[rowSamples];
+    for (size_t sample = 0; sample != rowSamples; ++sample) {
+        rowWeights[sample] = weights[sample % channels];
+    }
+    for (size_t blockX = 0; blockX != nWholeBlocksX; ++blockX) {
+        float* block = blocks[blockX].data();
+        for (size_t y = 0; y != blockH; ++y) {
+            const uint8_t* samples = rows[y] + blockX * rowSamples;
+            for (size_t sample = 0; sample != rowSamples; ++sample) {
+                block[y * rowSamples + sample] = samples[sample] * rowWeights[sample];
+            }
+        }
+    }
+
+    for (size_t blockX = nWholeBlocksX; blockX != nBlocksX; ++blockX) {
+        auto& block = blocks[blockX];
+        for (size_t y = 0; y != blockH; ++y) {
+            for (size_t x = 0; x != blockW; ++x) {
+                const uint8_t* pixel = rows[y] +
+                    MirrorIndex(blockX * blockW + x, imageWidth) * channels;
+                for (size_t ch = 0; ch != channels; ++ch) {
+                    block[(y * blockW + x) * channels + ch] = pixel[ch] * weights[ch];
+                }
+            }
+        }
+    }
+}
+
+template<size_t blockW, size_t blockH>
+void FillBlockRow(const VQLib::Support::RGB8Image& image, size_t blockY,
+                  MatrixRow<float, blockW * blockH * 3>* blocks) {
+    // If the image's dimensions aren't a multiple of the block
+    //  dimensions, we have to pad the image. I'm choosing a
+    //  mirrored-repeat strategy here, to minimize discontinuities;
+    //  coordinates past the edges are mirrored back as they're read.
+    const uint8_t* rows[blockH];
+    for (size_t y = 0; y != blockH; ++y) {
+        rows[y] = &image.pixels[MirrorIndex(blockY * blockH + y, image.height) *
+            image.width * 3];
+    }
+    FillBlockRow<blockW, blockH>(rows, image.width, blocks);
+}
+
+// Scatters an RGB8 image into blocks of blockW x blockH pixels, Rec.709
+//  weighted, reusing whatever storage `data` already has.
+template<size_t blockW, size_t blockH>
+void FillBlocks(const VQLib::Support::RGB8Image& image,
+                FlexMatrix<float, blockW * blockH * 3>& data) {
+    const size_t nBlocksX = (image.width + blockW - 1) / blockW;
+    const size_t nBlocksY = (image.height + blockH - 1) / blockH;
+
+    data.resize(nBlocksX * nBlocksY);
+    for (size_t blockY = 0; blockY != nBlocksY; ++blockY) {
+        FillBlockRow<blockW, blockH>(image, blockY, &data[blockY * nBlocksX]);
+    }
+}
+
 template<size_t blockW, size_t blockH>
 struct BlockImage {
     const size_t nBlocksX, nBlocksY;
@@ -16,79 +104,12 @@ struct BlockImage {
     static constexpr size_t channels = 3;
     FlexMatrix<float, blockW * blockH * channels> data;
 
-    BlockImage(VQLib::Support::RGB8Image image)
+    BlockImage(const VQLib::Support::RGB8Image& image)
     : nBlocksX((image.width + blockW - 1) / blockW)
     , nBlocksY((image.height + blockH - 1) / blockH)
     , actualW(image.width)
     , actualH(image.height) {
-
-        // If the image's dimensions aren't a multiple of the block
-        //  dimensions, we have to pad the image. I'm choosing a
-        //  mirrored-repeat strategy here, to minimize discontinuities.
-        if (actualW % blockW != 0 || actualH % blockH != 0) {
-            VQLib::Support::RGB8Image newImage;
-            newImage.width = nBlocksX * blockW;
-            newImage.height = image.height;
-            newImage.pixels.resize(newImage.width * newImage.height * channels);
-
-            const auto columnLeftover = newImage.width - image.width;
-            const auto rowLeftover = newImage.height - image.height;
-
-            const auto rowStride = image.width * channels;
-            const auto newRowStride = newImage.width * channels;
-
-            for (auto row = 0; row != image.height; ++row) {
-                std::copy_n(&image.pixels[row * rowStride], 
-                    rowStride, &newImage.pixels[row * newRowStride]);
-                for (auto column = 0; column != columnLeftover; ++column) {
-                    newImage.pixels[row * newRowStride + rowStride + channels * column + 0] = 
-                        image.pixels[(row + 1) * rowStride - (channels * (1 + column)) + 0];
-                    newImage.pixels[row * newRowStride + rowStride + channels * column + 1] = 
-                        image.pixels[(row + 1) * rowStride - (channels * (1 + column)) + 1];
-                    newImage.pixels[row * newRowStride + rowStride + channels * column + 2] = 
-                        image.pixels[(row + 1) * rowStride - (channels * (1 + column)) + 2];
-                }
-            }
-
-            for (auto row = 0; row != rowLeftover; ++row) {
-                std::copy_n(&newImage.pixels[(image.width - row - 1) * rowStride],
-                    rowStride, &newImage.pixels[(image.width + row) * rowStride]);
-            }
-
-            image = newImage;
-        }
-
-        data.resize(nBlocksX * nBlocksY);
-
-        for (size_t blockY = 0; blockY != nBlocksY; ++blockY) {
-            for (size_t blockX = 0; blockX != nBlocksX; ++blockX) {
-                auto& block = data[blockY * nBlocksX + blockX];
-
-                // All the code below will be vectorized, because
-                //  the loop limits are constexpr.
-                for (size_t y = 0; y != blockH; ++y) {
-                    for (size_t x = 0; x != blockW; ++x) {
-                        for (size_t ch = 0; ch != channels; ++ch) {
-                            block[(y * blockW + x) * 3 + ch] = image.pixels[
-                                ((blockY * blockH + y) * image.width +
-                                (blockX * blockW) + x) * 3 + ch];
-                        }
-                    }
-                }
-            }
-        }
-
-        // Finally, YUV scaling.
-        constexpr float weightR = constSqrt(0.2125f);
-        constexpr float weightG = constSqrt(0.7154f);
-        constexpr float weightB = constSqrt(0.0721f);
-        for (auto& sample : data) {
-            for (size_t triad = 0; triad < sample.size() / 3; ++triad) {
-                sample[3 * triad + 0] *= weightR;
-                sample[3 * triad + 1] *= weightG;
-                sample[3 * triad + 2] *= weightB;
-            }
-        }
+        FillBlocks<blockW, blockH>(image, data);
     }
 
     template<typename Index>
@@ -111,6 +132,13 @@ struct BlockImage {
         image.pixels.resize(image.width * image.height * 3);
 
         for (size_t blockY = 0; blockY != nBlocksY; ++blockY) {
+            if constexpr (blockW == 4 && blockH == 4) {
+                if (nBlocksX != 0) {
+                    ActiveKernels().blocksToRGB8(data[blockY * nBlocksX].data(), nBlocksX,
+                        &image.pixels[blockY * blockH * image.width * 3], image.width * 3);
+                }
+                continue;
+            }
             for (size_t blockX = 0; blockX != nBlocksX; ++blockX) {
                 auto& block = data[blockY * nBlocksX + blockX];
 
@@ -154,11 +182,18 @@ struct BlockImage {
 };
 
 template <typename T, size_t width>
-FlexMatrix<T, 3>  BlockRGBMean(const FlexMatrix<T, width>& data) {
+void BlockRGBMeanInto(const FlexMatrix<T, width>& data, FlexMatrix<T, 3>& mean) {
     static_assert(width % 3 == 0, "Element width must be a multiple of 3!");
 
     const auto dataSize = data.size();
-    FlexMatrix<T, 3> mean(dataSize);
+    mean.resize(dataSize);
+
+    if constexpr (std::is_same_v<T, float> && width == 48) {
+        if (dataSize != 0) {
+            ActiveKernels().rgbMeans(data[0].data(), dataSize, mean[0].data());
+        }
+        return;
+    }
 
     for(size_t idx = 0; idx != dataSize; ++idx) {
         T accRed(0);
@@ -187,20 +222,186 @@ FlexMatrix<T, 3>  BlockRGBMean(const FlexMatrix<T, width>& data) {
         mean[idx][1] = accGreen;
         mean[idx][2] = accBlue;
     }
+}
 
+template <typename T, size_t width>
+FlexMatrix<T, 3>  BlockRGBMean(const FlexMatrix<T, width>& data) {
+    FlexMatrix<T, 3> mean;
+    BlockRGBMeanInto<T, width>(data, mean);
     return mean;
 }
 
+// Means of one row of `nBlocks` blocks, into `means`.
+template<size_t width>
+void BlockRowMeans(const MatrixRow<float, width>* row, size_t nBlocks, MatrixRow<float, 3>* means) {
+    if constexpr (width == 48) {
+        ActiveKernels().rgbMeans(row->data(), nBlocks, means->data());
+    }
+    else {
+        for (size_t blockX = 0; blockX != nBlocks; ++blockX) {
+            float acc[3] = {0.0f, 0.0f, 0.0f};
+            for (size_t elem = 0; elem != width; ++elem) {
+                acc[elem % 3] += row[blockX][elem];
+            }
+            for (size_t ch = 0; ch != 3; ++ch) {
+                means[blockX][ch] = acc[ch] * (3.0f / width);
+            }
+        }
+    }
+}
+
+// FillBlocks and BlockRGBMeanInto in one sweep over the image: each row of
+//  blocks gets its means while it's still in cache, and the source pixels
+//  are read exactly once. The pixels are read in place, `stride` bytes
+//  apart from one row to the next.
+template<size_t blockW, size_t blockH>
+void FillBlocksAndMeans(const uint8_t* pixels, size_t width, size_t height, size_t stride,
+                        FlexMatrix<float, blockW * blockH * 3>& blocks,
+                        FlexMatrix<float, 3>& means) {
+    const size_t nBlocksX = (width + blockW - 1) / blockW;
+    const size_t nBlocksY = (height + blockH - 1) / blockH;
+
+    blocks.resize(nBlocksX * nBlocksY);
+    means.resize(nBlocksX * nBlocksY);
+    if (nBlocksX == 0) {
+        return;
+    }
+
+    for (size_t blockY = 0; blockY != nBlocksY; ++blockY) {
+        const uint8_t* rows[blockH];
+        for (size_t y = 0; y != blockH; ++y) {
+            rows[y] = pixels + MirrorIndex(blockY * blockH + y, height) * stride;
+        }
+
+        auto* row = &blocks[blockY * nBlocksX];
+        FillBlockRow<blockW, blockH>(rows, width, row);
+        BlockRowMeans(row, nBlocksX, &means[blockY * nBlocksX]);
+    }
+}
+
+template<size_t blockW, size_t blockH>
+void FillBlocksAndMeans(const VQLib::Support::RGB8Image& image,
+                        FlexMatrix<float, blockW * blockH * 3>& blocks,
+                        FlexMatrix<float, 3>& means) {
+    FillBlocksAndMeans<blockW, blockH>(image.pixels.data(), image.width, image.height,
+        image.width * 3, blocks, means);
+}
+
+// FillBlocksAndMeans for pixels that arrive a row at a time, top to
+//  bottom: `readRow(row)` must store the next `width` RGB8 pixels at `row`
+//  and return false if there are none. Only 2 * blockH rows are kept, as
+//  the mirrored padding below the last row reaches back into the block row
+//  above it. Returns false if `readRow` did.
+template<size_t blockW, size_t blockH, typename ReadRow>
+bool FillBlocksAndMeansFromRows(size_t width, size_t height, ReadRow&& readRow,
+                                FlexMatrix<float, blockW * blockH * 3>& blocks,
+                                FlexMatrix<float, 3>& means) {
+    constexpr size_t ringRows = 2 * blockH;
+    const size_t nBlocksX = (width + blockW - 1) / blockW;
+    const size_t nBlocksY = (height + blockH - 1) / blockH;
+
+    blocks.resize(nBlocksX * nBlocksY);
+    means.resize(nBlocksX * nBlocksY);
+    if (nBlocksX == 0) {
+        return true;
+    }
+
+    std::vector<uint8_t> ring(ringRows * width * 3);
+    for (size_t blockY = 0; blockY != nBlocksY; ++blockY) {
+        const size_t endY = std::min(height, (blockY + 1) * blockH);
+        for (size_t y = blockY * blockH; y != endY; ++y) {
+            if (!readRow(&ring[(y % ringRows) * width * 3])) {
+                return false;
+            }
+        }
+
+        const uint8_t* rows[blockH];
+        for (size_t y = 0; y != blockH; ++y) {
+            rows[y] = &ring[(MirrorIndex(blockY * blockH + y, height) % ringRows) * width * 3];
+        }
+
+        auto* row = &blocks[blockY * nBlocksX];
+        FillBlockRow<blockW, blockH>(rows, width, row);
+        BlockRowMeans(row, nBlocksX, &means[blockY * nBlocksX]);
+    }
+    return true;
+}
+
+// The means of FillBlocksAndMeans without keeping the blocks; only one
+//  row of them at a time goes through `rowBuffer`.
+template<size_t blockW, size_t blockH>
+void FillBlockMeans(const VQLib::Support::RGB8Image& image, FlexMatrix<float, 3>& means,
+                    FlexMatrix<float, blockW * blockH * 3>& rowBuffer) {
+    static_assert(blockW * blockH == 16, "The mean kernel takes 4x4 blocks");
+    const size_t nBlocksX = (image.width + blockW - 1) / blockW;
+    const size_t nBlocksY = (image.height + blockH - 1) / blockH;
+
+    means.resize(nBlocksX * nBlocksY);
+    rowBuffer.resize(nBlocksX);
+    if (nBlocksX == 0) {
+        return;
+    }
+
+    for (size_t blockY = 0; blockY != nBlocksY; ++blockY) {
+        FillBlockRow<blockW, blockH>(image, blockY, rowBuffer.data());
+        ActiveKernels().rgbMeans(rowBuffer[0].data(), nBlocksX, means[blockY * nBlocksX].data());
+    }
+}
+
+// Residual blocks (weighted block minus `blockMeans`, usually the palette
+//  color of each block) straight from the image, in 16-bit fixed point
+//  with `fracBits` fractional bits. Takes 96 bytes per 4x4 block instead of
+//  the 192 of a float block.
+template<size_t blockW, size_t blockH>
+void FillResidualBlocksI16(const VQLib::Support::RGB8Image& image,
+                           const FlexMatrix<float, 3>& blockMeans, int fracBits,
+                           FlexMatrix<int16_t, blockW * blockH * 3>& residuals,
+                           FlexMatrix<float, blockW * blockH * 3>& rowBuffer) {
+    static_assert(blockW * blockH == 16, "The subtraction kernel takes 4x4 blocks");
+    constexpr size_t width = blockW * blockH * 3;
+    const size_t nBlocksX = (image.width + blockW - 1) / blockW;
+    const size_t nBlocksY = (image.height + blockH - 1) / blockH;
+    assert(blockMeans.size() == nBlocksX * nBlocksY);
+
+    residuals.resize(nBlocksX * nBlocksY);
+    rowBuffer.resize(nBlocksX);
+    if (nBlocksX == 0) {
+        return;
+    }
+
+    const float scale = float(1 << fracBits);
+    for (size_t blockY = 0; blockY != nBlocksY; ++blockY) {
+        FillBlockRow<blockW, blockH>(image, blockY, rowBuffer.data());
+        ActiveKernels().subtractMeans(rowBuffer[0].data(), blockMeans[blockY * nBlocksX].data(),
+            nBlocksX, rowBuffer[0].data());
+        for (size_t blockX = 0; blockX != nBlocksX; ++blockX) {
+            const auto& block = rowBuffer[blockX];
+            auto& out = residuals[blockY * nBlocksX + blockX];
+            for (size_t elem = 0; elem != width; ++elem) {
+                out[elem] = int16_t(std::lround(block[elem] * scale));
+            }
+        }
+    }
+}
+
 template <typename T, size_t width>
-FlexMatrix<T, width>  BlockRGBSubtractMean(
+void BlockRGBSubtractMeanInto(
     const FlexMatrix<T, width>& data, 
-    const FlexMatrix<T, 3>& mean) {
+    const FlexMatrix<T, 3>& mean,
+    FlexMatrix<T, width>& output) {
 
     static_assert(width % 3 == 0, "Element width must be a multiple of 3!");
     assert(data.size() == mean.size());
 
     const auto dataSize = data.size();
-    FlexMatrix<T, width> output(dataSize);
+    output.resize(dataSize);
+
+    if constexpr (std::is_same_v<T, float> && width == 48) {
+        if (dataSize != 0) {
+            ActiveKernels().subtractMeans(data[0].data(), mean[0].data(), dataSize, output[0].data());
+        }
+        return;
+    }
 
     for (size_t idx = 0; idx != dataSize; ++idx) {
         const T red = mean[idx][0];
@@ -212,7 +413,15 @@ FlexMatrix<T, width>  BlockRGBSubtractMean(
             output[idx][pixel * 3 + 2] = data[idx][pixel * 3 + 2] - blue;
         }
     }
+}
+
+template <typename T, size_t width>
+FlexMatrix<T, width>  BlockRGBSubtractMean(
+    const FlexMatrix<T, width>& data, 
+    const FlexMatrix<T, 3>& mean) {
 
+    FlexMatrix<T, width> output;
+    BlockRGBSubtractMeanInto<T, width>(data, mean, output);
     return output;
 }
 
@@ -0,0 +1,131 @@
+#pragma once
+
+#include "Support/PNGLoader.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace IV1 {
+
+// Minimal argument splitter shared by the command-line tools.
+//  Anything starting with "--" is an option; options listed in
+//  `switches` stand alone, every other option consumes the next
+//  argument as its value. Everything else (including a lone "-",
+//  meaning stdin/stdout) is a positional argument.
+struct CommandLine {
+    std::vector<const char*> positional;
+    std::map<std::string, std::string> options;
+
+    CommandLine(int argc, char** args,
+                std::initializer_list<const char*> switches = {}) {
+        for (int arg = 1; arg < argc; ++arg) {
+            if (strncmp(args[arg], "--", 2) != 0) {
+                positional.push_back(args[arg]);
+                continue;
+            }
+
+            const bool isSwitch = std::any_of(switches.begin(), switches.end(),
+                [&](const char* name) { return strcmp(name, args[arg]) == 0; });
+            if (isSwitch || arg + 1 == argc) {
+                options[args[arg]] = "";
+            }
+            else {
+                options[args[arg]] = args[arg + 1];
+                ++arg;
+            }
+        }
+    }
+
+    bool has(const char* name) const {
+        return options.count(name) != 0;
+    }
+
+    const char* get(const char* name, const char* fallback) const {
+        const auto option = options.find(name);
+        return option == options.end() ? fallback : option->second.c_str();
+    }
+
+    size_t getSize(const char* name, size_t fallback) const {
+        const auto option = options.find(name);
+        return option == options.end() ? fallback
+            : size_t(strtoull(option->second.c_str(), nullptr, 10));
+    }
+
+    double getDouble(const char* name, double fallback) const {
+        const auto option = options.find(name);
+        return option == options.end() ? fallback : strtod(option->second.c_str(), nullptr);
+    }
+};
+
+// PNG output options shared by the tools that write images:
+//  --png-level N|fast|store, a zlib level, where fast and store also turn
+//  filtering off (levels 1 and 0); and --png-filter
+//  default|none|sub|up|average|paeth|all. Returns false if either is
+//  unrecognized.
+inline bool PNGWriteOptionsFromCommandLine(const CommandLine& cmdLine,
+                                           VQLib::Support::PNGWriteOptions& options) {
+    using VQLib::Support::PNGFilter;
+    const std::string level = cmdLine.get("--png-level", "");
+    if (level == "fast" || level == "store") {
+        options.compressionLevel = level == "fast" ? 1 : 0;
+        options.filter = PNGFilter::None;
+    }
+    else if (!level.empty()) {
+        if (level.size() != 1 || level[0] < '0' || level[0] > '9') {
+            return false;
+        }
+        options.compressionLevel = level[0] - '0';
+    }
+
+    if (cmdLine.has("--png-filter")) {
+        static const std::pair<const char*, PNGFilter> filters[] = {
+            {"default", PNGFilter::Default}, {"none", PNGFilter::None},
+            {"sub", PNGFilter::Sub}, {"up", PNGFilter::Up},
+            {"average", PNGFilter::Average}, {"paeth", PNGFilter::Paeth},
+            {"all", PNGFilter::All},
+        };
+        const auto filter = std::find_if(std::begin(filters), std::end(filters),
+            [&](const auto& entry) { return strcmp(entry.first, cmdLine.get("--png-filter", "")) == 0; });
+        if (filter == std::end(filters)) {
+            return false;
+        }
+        options.filter = filter->second;
+    }
+    return true;
+}
+
+// The images (PNG, PPM or PAM) in a directory, sorted by name, or the
+//  paths listed one per line in a text file.
+inline std::vector<std::filesystem::path> ListInputImages(const char* listOrDir) {
+    std::vector<std::filesystem::path> inputs;
+    if (std::filesystem::is_directory(listOrDir)) {
+        for (const auto& entry : std::filesystem::directory_iterator(listOrDir)) {
+            const auto extension = entry.path().extension();
+            if (entry.is_regular_file() && (extension == ".png" || extension == ".ppm" ||
+                                            extension == ".pnm" || extension == ".pam")) {
+                inputs.push_back(entry.path());
+            }
+        }
+        std::sort(inputs.begin(), inputs.end());
+    }
+    else {
+        std::ifstream list(listOrDir);
+        for (std::string line; std::getline(list, line); ) {
+            if (!line.empty()) {
+                inputs.emplace_back(line);
+            }
+        }
+    }
+    return inputs;
+}
+
+} // namespace IV1
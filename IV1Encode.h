@@ -0,0 +1,616 @@
+#pragma once
+
+#include "Support/ImageIO.h"
+#include "Support/PNGLoader.h"
+#include "Support/RGB8Image.h"
+
+#include "IV1BlockImage.h"
+#include "IV1CommandLine.h"
+#include "IV1File.h"
+#include "IV1Palette.h"
+#include "IV1Stats.h"
+#include "IV1ThreadPool.h"
+#include "IV1Tiled.h"
+#include "IV1VQ.h"
+#include "libiv1.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+namespace IV1 {
+
+// Everything that goes into an .iv1 file. Images encoded against a
+//  dictionary pack are saved with a reference to it (`packId`) in place
+//  of the dictionaries. With `codedIndices`, the index planes are saved
+//  entropy coded (see IV1Entropy.h); the encoders leave it alone.
+struct EncodedImage {
+    FlexMatrix<float, 3> dictPalette;
+    std::vector<uint16_t> idxPalette;
+    FlexMatrix<float, 48> dictDiff;
+    std::vector<uint16_t> idxDiff;
+    size_t nBlocksX = 0, nBlocksY = 0;
+    size_t actualW = 0, actualH = 0;
+    bool usesPack = false;
+    uint32_t packId = 0;
+    bool codedIndices = false;
+
+    // Writes the stream to `path` ("-" for stdout). Returns its size, which
+    //  saves coded streams a second coding pass in streamSize(), or 0 if
+    //  it couldn't be written.
+    size_t save(const char* path) const {
+        std::vector<uint8_t> bytes;
+        serialize(bytes);
+        return SaveIV1Bytes(path, bytes) ? bytes.size() : 0;
+    }
+
+    // Appends the stream save() would write to `bytes`.
+    void serialize(std::vector<uint8_t>& bytes) const {
+        if (codedIndices && usesPack) {
+            SerializeIV1CodedWithPack(bytes, packId, idxPalette, idxDiff,
+                nBlocksX, nBlocksY, actualW, actualH);
+        }
+        else if (codedIndices) {
+            SerializeIV1Coded(bytes, dictPalette, idxPalette, dictDiff, idxDiff,
+                nBlocksX, nBlocksY, actualW, actualH);
+        }
+        else if (usesPack) {
+            SerializeIV1WithPack(bytes, packId, idxPalette, idxDiff,
+                nBlocksX, nBlocksY, actualW, actualH);
+        }
+        else {
+            SerializeIV1(bytes, dictPalette, idxPalette, dictDiff, idxDiff,
+                nBlocksX, nBlocksY, actualW, actualH);
+        }
+    }
+
+    // Writes the same stream to `out`, which must hold streamSize() bytes.
+    void serialize(uint8_t* out) const {
+        if (codedIndices) {
+            std::vector<uint8_t> bytes;
+            serialize(bytes);
+            memcpy(out, bytes.data(), bytes.size());
+        }
+        else if (usesPack) {
+            WriteIV1WithPack(out, packId, idxPalette, idxDiff,
+                nBlocksX, nBlocksY, actualW, actualH);
+        }
+        else {
+            WriteIV1(out, dictPalette, idxPalette, dictDiff, idxDiff,
+                nBlocksX, nBlocksY, actualW, actualH);
+        }
+    }
+
+    // Coded index planes have to be coded to know their size; callers that
+    //  save or serialize the stream anyway should take it from there.
+    size_t streamSize() const {
+        if (codedIndices) {
+            std::vector<uint8_t> bytes;
+            serialize(bytes);
+            return bytes.size();
+        }
+        const IV1ExtendedHeader extended = {IV1FlagExternalDictionaries, packId};
+        return IV1StreamSize(nBlocksX, nBlocksY, usesPack ? &extended : nullptr);
+    }
+};
+
+// A dictionary pack expanded to float, as the decoder will see it. Built
+//  once and shared by every image encoded against the pack.
+struct SharedDictionaries {
+    uint32_t packId;
+    FlexMatrix<float, 3> dictPalette;
+    FlexMatrix<float, 48> dictDiff;
+
+    explicit SharedDictionaries(const IV1DictionaryPack& pack)
+    : packId(pack.id) {
+        ExpandDict0(pack.dict0, dictPalette);
+        ExpandDict1(pack.dict1, dictDiff);
+    }
+};
+
+// Intermediate buffers of EncodeImage. Keeping one around between images
+//  (one per thread, if several images are encoded at once) avoids
+//  reallocating them for every image.
+struct EncodeScratch {
+    FlexMatrix<float, 48> blocks;
+    FlexMatrix<float, 3> blockMeans;
+    FlexMatrix<float, 3> paletteMeans;
+    FlexMatrix<float, 48> trainingBlocks;
+    VQScratch<float> vq;
+    PaletteScratch palette;
+
+    // Compact training keeps the residuals here instead of in `blocks`,
+    //  which then only ever holds one row of blocks.
+    FlexMatrix<int16_t, 48> compactBlocks;
+    FlexMatrix<int16_t, 48> compactTrainingBlocks;
+    FlexMatrix<int16_t, 48> compactDict;
+    VQScratch<int16_t> compactVQ;
+};
+
+// Fractional bits of the 16-bit residuals of compact training. Weighted
+//  residuals stay within +-217, so 3 bits keep them, and the squared
+//  distances between them, inside what VQDistance<int16_t> can hold.
+constexpr int compactFracBits = 3;
+
+// How hard the encoder tries. Both trainings share the time budget:
+//  whatever the palette leaves is what the residual dictionary gets, and
+//  either one still makes at least one assignment pass when it runs out.
+struct EncodeOptions {
+    size_t maxIterations = 1000;
+    double minRelativeImprovement = 0.0;
+    double timeBudgetSeconds = 0.0;     // 0 for no limit
+    // The residual dictionary is trained on at most this many blocks,
+    //  spread evenly over the image, and every block is then assigned to
+    //  it in one last pass. Past a couple of megapixels this keeps the
+    //  training time flat. 0 trains on every block.
+    size_t residualTrainingBlocks = 131072;
+    // Train the residual dictionary on 16-bit fixed-point blocks, half
+    //  the size of float ones, with integer distances. The weighted
+    //  blocks are never stored whole, so the encoder needs about a third
+    //  of the memory, at a small cost in precision.
+    bool compactTraining = false;
+    // Build the palette with HistogramPalette, from a histogram of the
+    //  block means, instead of k-means over every one of them.
+    bool histogramPalette = false;
+    // How both trainings pick their starting dictionaries (see VQSeeding)
+    //  when not given seeds below. HistogramPalette always starts from its
+    //  median cut.
+    VQSeeding seeding = VQSeeding::Spread;
+    // Start both trainings from these dictionaries, typically those of
+    //  the previous frame of a sequence or of a near-duplicate, instead of
+    //  from samples of the image. Either can be left null.
+    const FlexMatrix<float, 3>* seedPalette = nullptr;
+    const FlexMatrix<float, 48>* seedDiff = nullptr;
+    // Entropy code the index planes of the stream (IV1FlagCodedIndices).
+    //  Only changes how the stream is stored: typically a third to half
+    //  smaller, for a decoder that runs at roughly 250-350 MB/s of
+    //  indices per core. Callers that save an EncodedImage set its codedIndices.
+    bool codedIndices = false;
+};
+
+// Named speed presets. "default" stops training as IV1enc originally did,
+//  once no sample changes codeword or after 1000 iterations, but trains
+//  the residual dictionary on 131072 blocks, so its output differs from
+//  the original encoder's on images over about 2 megapixels (--train-blocks
+//  0 gives it back). "fast" trades a little quality for a large speedup by
+//  also stopping at a 0.1% improvement, after 50 iterations at most, on
+//  32768 blocks; "max" has no iteration cap and trains the residual
+//  dictionary on every block. Every preset starts from the defaults of
+//  EncodeOptions, which are "default". Returns false for unknown names.
+inline bool EncodePreset(const char* name, EncodeOptions& options) {
+    EncodeOptions preset;
+    if (strcmp(name, "fast") == 0) {
+        preset.maxIterations = 50;
+        preset.minRelativeImprovement = 1e-3;
+        preset.residualTrainingBlocks = 32768;
+        preset.histogramPalette = true;
+        preset.seeding = VQSeeding::PrincipalAxis;
+    }
+    else if (strcmp(name, "max") == 0) {
+        preset.maxIterations = SIZE_MAX;
+        preset.residualTrainingBlocks = 0;
+    }
+    else if (strcmp(name, "default") != 0) {
+        return false;
+    }
+    options = preset;
+    return true;
+}
+
+// Applies --preset, then --max-iterations, --converge, --time-budget,
+//  --train-blocks, --compact, --histogram-palette, --seeding and
+//  --coded-indices on top of it. Returns false on an unknown preset or
+//  seeding strategy.
+inline bool EncodeOptionsFromCommandLine(const CommandLine& cmdLine, EncodeOptions& options) {
+    if (!EncodePreset(cmdLine.get("--preset", "default"), options)) {
+        return false;
+    }
+    if (cmdLine.has("--seeding") && !VQSeedingFromName(cmdLine.get("--seeding", ""), options.seeding)) {
+        return false;
+    }
+    options.maxIterations = cmdLine.getSize("--max-iterations", options.maxIterations);
+    options.minRelativeImprovement = cmdLine.getDouble("--converge", options.minRelativeImprovement);
+    options.timeBudgetSeconds = cmdLine.getDouble("--time-budget", options.timeBudgetSeconds);
+    options.residualTrainingBlocks = cmdLine.getSize("--train-blocks", options.residualTrainingBlocks);
+    options.compactTraining = options.compactTraining || cmdLine.has("--compact");
+    options.histogramPalette = options.histogramPalette || cmdLine.has("--histogram-palette");
+    options.codedIndices = options.codedIndices || cmdLine.has("--coded-indices");
+    return true;
+}
+
+// The libiv1 options (see libiv1.h) standing for `options`, for tiles of
+//  `tileSize` (0 for a single stream) on `threads` threads (0 for every
+//  core). Seeds have no counterpart there and are left out.
+inline iv1_encode_options LibraryEncodeOptions(const EncodeOptions& options,
+                                               size_t tileSize = 0, size_t threads = 0) {
+    iv1_encode_options libraryOptions;
+    libraryOptions.max_iterations = options.maxIterations;
+    libraryOptions.min_relative_improvement = options.minRelativeImprovement;
+    libraryOptions.time_budget_seconds = options.timeBudgetSeconds;
+    libraryOptions.residual_training_blocks = options.residualTrainingBlocks;
+    libraryOptions.compact_training = options.compactTraining;
+    libraryOptions.histogram_palette = options.histogramPalette;
+    libraryOptions.seeding = iv1_seeding(options.seeding);
+    libraryOptions.coded_indices = options.codedIndices;
+    libraryOptions.tile_size = tileSize;
+    libraryOptions.threads = threads;
+    return libraryOptions;
+}
+
+// Trains the residual dictionary over `blocks`: on all of them, or on a
+//  StratifiedSubset of `nTraining` followed by one assignment pass.
+//  Training starts from `seed`, if given.
+template <typename T>
+void TrainResidualDictionary(const FlexMatrix<T, 48>& blocks, FlexMatrix<T, 48>& subset,
+                             size_t nTraining, const VQTrainOptions& trainOptions,
+                             ThreadPool& pool, VQScratch<T>& vqScratch, Stats& timings,
+                             FlexMatrix<T, 48>& dict, std::vector<uint16_t>& indices,
+                             VQStats& stats, const FlexMatrix<T, 48>* seed = nullptr) {
+    if (nTraining == 0 || blocks.size() <= nTraining) {
+        timings.time("vq_residual", [&] {
+            std::tie(dict, indices) = VQGenerateDictParallel<T, 48, uint16_t>(
+                blocks, 256, trainOptions, pool, &vqScratch, &stats, seed);
+        });
+    }
+    else {
+        timings.time("vq_residual", [&] {
+            StratifiedSubset(blocks, nTraining, subset);
+            dict = VQGenerateDictParallel<T, 48, uint16_t>(
+                subset, 256, trainOptions, pool, &vqScratch, &stats, seed).first;
+        });
+        timings.time("residual_assign", [&] {
+            stats.distortion = VQAssignParallel<T, 48, uint16_t>(blocks, dict, indices, pool);
+        });
+    }
+}
+
+// The VQ limits of `options`, with the time budget counted from now.
+inline VQTrainOptions MakeTrainOptions(const EncodeOptions& options) {
+    VQTrainOptions trainOptions;
+    trainOptions.maxIterations = options.maxIterations;
+    trainOptions.minRelativeImprovement = options.minRelativeImprovement;
+    trainOptions.seeding = options.seeding;
+    if (options.timeBudgetSeconds > 0.0) {
+        trainOptions.deadline = std::chrono::steady_clock::now() +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(options.timeBudgetSeconds));
+    }
+    return trainOptions;
+}
+
+inline void SetEncodedSize(EncodedImage& encoded, size_t width, size_t height) {
+    encoded.nBlocksX = (width + 3) / 4;
+    encoded.nBlocksY = (height + 3) / 4;
+    encoded.actualW = width;
+    encoded.actualH = height;
+}
+
+// Everything EncodeImage does after blocking. `scratch` must hold the
+//  blocks and their means (only the means with compact training, which
+//  blocks `image` again a row at a time) and `encoded` the image size.
+inline void EncodeBlockedImage(const VQLib::Support::RGB8Image* image,
+                               EncodedImage& encoded, EncodeScratch& scratch,
+                               ThreadPool& pool, const EncodeOptions& options,
+                               const VQTrainOptions& trainOptions, Stats& timings) {
+    constexpr size_t blockW = 4;
+    constexpr size_t blockH = 4;
+    encoded.usesPack = false;
+
+    VQStats paletteStats, residualStats;
+    timings.time("vq_palette", [&] {
+        if (options.histogramPalette) {
+            std::tie(encoded.dictPalette, encoded.idxPalette) = HistogramPalette<uint16_t>(
+                scratch.blockMeans, 256, trainOptions, &scratch.palette, &paletteStats,
+                options.seedPalette);
+        }
+        else {
+            std::tie(encoded.dictPalette, encoded.idxPalette) =
+                VQGenerateDictParallel<float, 3, uint16_t>(
+                    scratch.blockMeans, 256, trainOptions, pool, &scratch.vq, &paletteStats,
+                    options.seedPalette);
+        }
+    });
+
+    // Without compact training, the blocks are turned into residuals in
+    //  place; with it, they're blocked again from the image, a row at a
+    //  time, and stored as 16-bit residuals.
+    timings.time("residuals", [&] {
+        auto& paletteMeans = scratch.paletteMeans;
+        paletteMeans.resize(encoded.idxPalette.size());
+        for (size_t idx = 0; idx != paletteMeans.size(); ++idx) {
+            paletteMeans[idx] = encoded.dictPalette[encoded.idxPalette[idx]];
+        }
+        if (options.compactTraining) {
+            FillResidualBlocksI16<blockW, blockH>(*image, paletteMeans, compactFracBits,
+                scratch.compactBlocks, scratch.blocks);
+        }
+        else {
+            BlockRGBSubtractMeanInto<float, 3 * blockW * blockH>(
+                scratch.blocks, paletteMeans, scratch.blocks);
+        }
+    });
+
+    if (options.compactTraining) {
+        // The seed goes through the same fixed-point scaling as the blocks.
+        FlexMatrix<int16_t, 48> compactSeed;
+        if (options.seedDiff) {
+            constexpr float scale = 1 << compactFracBits;
+            compactSeed.resize(options.seedDiff->size());
+            for (size_t entry = 0; entry != compactSeed.size(); ++entry) {
+                for (size_t elem = 0; elem != 48; ++elem) {
+                    compactSeed[entry][elem] = int16_t(std::lround((*options.seedDiff)[entry][elem] * scale));
+                }
+            }
+        }
+        TrainResidualDictionary(scratch.compactBlocks, scratch.compactTrainingBlocks,
+            options.residualTrainingBlocks, trainOptions, pool, scratch.compactVQ, timings,
+            scratch.compactDict, encoded.idxDiff, residualStats,
+            options.seedDiff ? &compactSeed : nullptr);
+
+        constexpr float invScale = 1.0f / (1 << compactFracBits);
+        encoded.dictDiff.resize(scratch.compactDict.size());
+        for (size_t entry = 0; entry != scratch.compactDict.size(); ++entry) {
+            for (size_t elem = 0; elem != 48; ++elem) {
+                encoded.dictDiff[entry][elem] = scratch.compactDict[entry][elem] * invScale;
+            }
+        }
+        residualStats.distortion *= invScale * invScale;
+    }
+    else {
+        TrainResidualDictionary(scratch.blocks, scratch.trainingBlocks,
+            options.residualTrainingBlocks, trainOptions, pool, scratch.vq, timings,
+            encoded.dictDiff, encoded.idxDiff, residualStats, options.seedDiff);
+    }
+
+    timings.set("palette_iterations", double(paletteStats.iterations));
+    timings.set("palette_distortion", paletteStats.distortion);
+    timings.set("residual_iterations", double(residualStats.iterations));
+    timings.set("residual_distortion", residualStats.distortion);
+}
+
+// The full IV1 encoder: blocking, the palette VQ over the block means,
+//  and the residual VQ over the blocks minus their palette color. If
+//  `stats` is given, it gets the time of each stage plus the iterations
+//  and final distortion of both trainings.
+inline void EncodeImage(const VQLib::Support::RGB8Image& image,
+                        EncodedImage& encoded, EncodeScratch& scratch,
+                        ThreadPool& pool, const EncodeOptions& options = {},
+                        Stats* stats = nullptr) {
+    constexpr size_t blockW = 4;
+    constexpr size_t blockH = 4;
+
+    Stats localStats;
+    auto& timings = stats ? *stats : localStats;
+    const auto trainOptions = MakeTrainOptions(options);
+
+    SetEncodedSize(encoded, image.width, image.height);
+    timings.time("blocking", [&] {
+        if (options.compactTraining) {
+            FillBlockMeans<blockW, blockH>(image, scratch.blockMeans, scratch.blocks);
+        }
+        else {
+            FillBlocksAndMeans<blockW, blockH>(image, scratch.blocks, scratch.blockMeans);
+        }
+    });
+
+    EncodeBlockedImage(&image, encoded, scratch, pool, options, trainOptions, timings);
+}
+
+// Everything EncodeImageWithPack does after blocking; `scratch` must hold
+//  the blocks and their means, and `encoded` the image size.
+inline void EncodeBlockedImageWithPack(EncodedImage& encoded, EncodeScratch& scratch,
+                                       ThreadPool& pool, const SharedDictionaries& shared,
+                                       Stats& timings) {
+    constexpr size_t blockW = 4;
+    constexpr size_t blockH = 4;
+
+    encoded.usesPack = true;
+    encoded.packId = shared.packId;
+    encoded.dictPalette = shared.dictPalette;
+    encoded.dictDiff = shared.dictDiff;
+
+    double paletteDistortion, residualDistortion;
+    timings.time("vq_palette", [&] {
+        paletteDistortion = VQAssignParallel<float, 3, uint16_t>(
+            scratch.blockMeans, shared.dictPalette, encoded.idxPalette, pool);
+    });
+
+    timings.time("residuals", [&] {
+        auto& paletteMeans = scratch.paletteMeans;
+        paletteMeans.resize(encoded.idxPalette.size());
+        for (size_t idx = 0; idx != paletteMeans.size(); ++idx) {
+            paletteMeans[idx] = shared.dictPalette[encoded.idxPalette[idx]];
+        }
+        BlockRGBSubtractMeanInto<float, 3 * blockW * blockH>(
+            scratch.blocks, paletteMeans, scratch.blocks);
+    });
+
+    timings.time("vq_residual", [&] {
+        residualDistortion = VQAssignParallel<float, 48, uint16_t>(
+            scratch.blocks, shared.dictDiff, encoded.idxDiff, pool);
+    });
+
+    timings.set("palette_iterations", 0.0);
+    timings.set("palette_distortion", paletteDistortion);
+    timings.set("residual_iterations", 0.0);
+    timings.set("residual_distortion", residualDistortion);
+}
+
+// Encodes against pretrained dictionaries: no training, just blocking and
+//  one assignment pass per dictionary. The stages are named as in
+//  EncodeImage, and the iteration counts reported are 0.
+inline void EncodeImageWithPack(const VQLib::Support::RGB8Image& image,
+                                EncodedImage& encoded, EncodeScratch& scratch,
+                                ThreadPool& pool, const SharedDictionaries& shared,
+                                Stats* stats = nullptr) {
+    constexpr size_t blockW = 4;
+    constexpr size_t blockH = 4;
+
+    Stats localStats;
+    auto& timings = stats ? *stats : localStats;
+
+    SetEncodedSize(encoded, image.width, image.height);
+    timings.time("blocking", [&] {
+        FillBlocksAndMeans<blockW, blockH>(image, scratch.blocks, scratch.blockMeans);
+    });
+
+    EncodeBlockedImageWithPack(encoded, scratch, pool, shared, timings);
+}
+
+// Encodes the rest of the PNG `reader` has open the way EncodeImage (or,
+//  with `shared`, EncodeImageWithPack) would, without ever holding the
+//  whole image: rows are decoded one at a time and cut into blocks as soon
+//  as a block row is complete, in a stage named "read_and_block". Compact
+//  training blocks the image a second time, so it can't be used here
+//  without `shared`. Returns false if the PNG turns out to be truncated.
+inline bool EncodePNGRows(VQLib::Support::PNGRowReader& reader, EncodedImage& encoded,
+                          EncodeScratch& scratch, ThreadPool& pool,
+                          const EncodeOptions& options = {},
+                          const SharedDictionaries* shared = nullptr, Stats* stats = nullptr) {
+    constexpr size_t blockW = 4;
+    constexpr size_t blockH = 4;
+    assert(shared || !options.compactTraining);
+
+    Stats localStats;
+    auto& timings = stats ? *stats : localStats;
+    const auto trainOptions = MakeTrainOptions(options);
+
+    SetEncodedSize(encoded, reader.width(), reader.height());
+    bool complete;
+    timings.time("read_and_block", [&] {
+        complete = FillBlocksAndMeansFromRows<blockW, blockH>(reader.width(), reader.height(),
+            [&](uint8_t* row) { return reader.readRow(row); }, scratch.blocks, scratch.blockMeans);
+    });
+    if (!complete) {
+        return false;
+    }
+
+    if (shared) {
+        EncodeBlockedImageWithPack(encoded, scratch, pool, *shared, timings);
+    }
+    else {
+        EncodeBlockedImage(nullptr, encoded, scratch, pool, options, trainOptions, timings);
+    }
+    return true;
+}
+
+// Encodes the image file at `path`: PNGs go through EncodePNGRows, and
+//  anything it can't take (PPM and PAM, stdin, interlaced PNGs, compact
+//  training) is loaded whole with LoadImage first, in a "read_png" stage.
+//  Returns false if the file can't be read.
+inline bool EncodeImageFile(const char* path, EncodedImage& encoded, EncodeScratch& scratch,
+                            ThreadPool& pool, const EncodeOptions& options = {},
+                            const SharedDictionaries* shared = nullptr, Stats* stats = nullptr) {
+    Stats localStats;
+    auto& timings = stats ? *stats : localStats;
+
+    VQLib::Support::PNGRowReader reader(path);
+    if (reader.valid() && (shared || !options.compactTraining)) {
+        return EncodePNGRows(reader, encoded, scratch, pool, options, shared, &timings);
+    }
+
+    VQLib::Support::RGB8Image image;
+    timings.time("read_png", [&] { image = VQLib::Support::LoadImage(path); });
+    if (image.width == 0 || image.height == 0) {
+        return false;
+    }
+    if (shared) {
+        EncodeImageWithPack(image, encoded, scratch, pool, *shared, &timings);
+    }
+    else {
+        EncodeImage(image, encoded, scratch, pool, options, &timings);
+    }
+    return true;
+}
+
+// Encodes the `width` x `height` RGB8 image at `pixels`, whose rows are
+//  `stride` bytes apart, as a tiled container (see IV1Tiled.h) into
+//  `bytes`. Tiles are handed out to `nWorkers` threads, each with its own
+//  scratch buffers, and blocked straight from `pixels`, so the memory for
+//  encoding grows with the tile size and the worker count, not the image
+//  size. Only compact training copies a tile out first, as it blocks its
+//  image twice. A time budget in `options` applies to each tile
+//  separately; with `shared`, every tile is encoded against it.
+inline void EncodeTiledImage(const uint8_t* pixels, size_t width, size_t height, size_t stride,
+                             size_t tileSize, size_t nWorkers, const EncodeOptions& options,
+                             const SharedDictionaries* shared, std::vector<uint8_t>& bytes,
+                             Stats* stats = nullptr) {
+    constexpr size_t blockW = 4;
+    constexpr size_t blockH = 4;
+
+    Stats localStats;
+    auto& timings = stats ? *stats : localStats;
+    const auto trainOptions = MakeTrainOptions(options);
+
+    const auto header = MakeIV1TiledHeader(width, height, tileSize);
+    std::vector<std::vector<uint8_t>> tiles(size_t(header.nTilesX) * header.nTilesY);
+
+    timings.time("encode_tiles", [&] {
+        std::atomic<size_t> nextTile{0};
+        auto worker = [&] {
+            ThreadPool pool(1);
+            EncodeScratch scratch;
+            EncodedImage encoded;
+            encoded.codedIndices = options.codedIndices;
+            VQLib::Support::RGB8Image tileImage;
+
+            for (size_t idx = nextTile++; idx < tiles.size(); idx = nextTile++) {
+                const auto rect = GetTileRect(header, idx % header.nTilesX, idx / header.nTilesX);
+                const uint8_t* tilePixels = pixels + rect.y * stride + rect.x * 3;
+
+                if (options.compactTraining && !shared) {
+                    tileImage.width = rect.width;
+                    tileImage.height = rect.height;
+                    tileImage.pixels.resize(rect.width * rect.height * 3);
+                    for (size_t row = 0; row != rect.height; ++row) {
+                        memcpy(&tileImage.pixels[row * rect.width * 3],
+                            tilePixels + row * stride, rect.width * 3);
+                    }
+                    EncodeImage(tileImage, encoded, scratch, pool, options);
+                }
+                else {
+                    Stats tileStats;
+                    SetEncodedSize(encoded, rect.width, rect.height);
+                    FillBlocksAndMeans<blockW, blockH>(tilePixels, rect.width, rect.height,
+                        stride, scratch.blocks, scratch.blockMeans);
+                    if (shared) {
+                        EncodeBlockedImageWithPack(encoded, scratch, pool, *shared, tileStats);
+                    }
+                    else {
+                        EncodeBlockedImage(nullptr, encoded, scratch, pool, options,
+                            trainOptions, tileStats);
+                    }
+                }
+                encoded.serialize(tiles[idx]);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (size_t idx = 1; idx < std::min(std::max<size_t>(nWorkers, 1), tiles.size()); ++idx) {
+            workers.emplace_back(worker);
+        }
+        worker();
+        for (auto& thread : workers) {
+            thread.join();
+        }
+    });
+
+    timings.time("serialize", [&] { SerializeIV1Tiled(header, tiles, bytes); });
+    timings.set("tiles", double(tiles.size()));
+}
+
+inline void EncodeTiledImage(const VQLib::Support::RGB8Image& image, size_t tileSize,
+                             size_t nWorkers, const EncodeOptions& options,
+                             const SharedDictionaries* shared, std::vector<uint8_t>& bytes,
+                             Stats* stats = nullptr) {
+    EncodeTiledImage(image.pixels.data(), image.width, image.height, image.width * 3, tileSize,
+        nWorkers, options, shared, bytes, stats);
+}
+
+} // namespace IV1
@@ -0,0 +1,538 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace IV1 {
+
+// Entropy coding of the index planes of streams with IV1FlagCodedIndices.
+//  A coded plane is a mode byte, then:
+//   - IndexCoding::Stored: the plane as is, when coding doesn't pay off;
+//   - IndexCoding::Order0: a frequency table, then the bands (see below);
+//   - IndexCoding::Neighbors: two frequency tables, then the bands. Each
+//     index is ranked against its left and upper neighbors (0 if it
+//     repeats the left one, 1 if it repeats the upper one; see RankIndex)
+//     and the rank coded with the first table where both neighbors agree
+//     and with the second elsewhere.
+//  The encoder tries every mode and keeps the smallest.
+//
+// The rows of a plane are cut into IndexBands bands, each coded on its
+//  own as if it were a plane by itself (its first row has no upper
+//  neighbors); the sizes of the bands come first, as 32-bit integers,
+//  then the bands. The decoder works through all of them at once, one
+//  index of each in turn, which gives it that many independent dependency
+//  chains even though every index in a band waits on the one to its left.
+//
+// Each band is rANS with a 32-bit state, 12-bit frequencies and 16-bit
+//  renormalization, so the state takes in at most one (little-endian)
+//  word per index and the decoder has no loop or unpredictable branch
+//  for it. The encoder runs backwards and writes the final state first.
+//  Decoding an index is a table lookup, a multiply and an add.
+//
+// That comes to roughly 250-350 MB/s of indices on one core, below the
+//  several hundred MB/s first asked for; that shortfall is accepted.
+//  More bands measured no faster (8 and 16 against 4), as the work per
+//  index rather than the chains is what bounds it.
+enum class IndexCoding : uint8_t { Stored = 0, Order0 = 1, Neighbors = 2 };
+
+constexpr uint32_t RANSScaleBits = 12;
+constexpr uint32_t RANSScale = 1u << RANSScaleBits;
+constexpr uint32_t RANSLow = 1u << 16;
+constexpr size_t IndexBands = 4;
+
+// First row of `band` out of `nBlocksY`; the last band ends at nBlocksY.
+constexpr size_t IndexBandBegin(size_t band, size_t nBlocksY) {
+    return band * nBlocksY / IndexBands;
+}
+
+// Most bytes a coded plane of `numBlocks` indices can take: stored, plus
+//  the mode byte.
+constexpr size_t MaxCodedIndexPlaneSize(size_t numBlocks) {
+    return 1 + numBlocks;
+}
+
+// A static distribution over byte values, with frequencies summing to
+//  RANSScale. On disk: a 256-bit map of the values that occur, then each
+//  of their frequencies minus one, in one byte below 128 and otherwise
+//  in two, big-endian with the top bit set.
+struct RANSFrequencies {
+    uint16_t freq[256] = {};
+    uint16_t start[256] = {};
+
+    // Scales `counts` to RANSScale, keeping every value that occurs at a
+    //  frequency of at least 1. `counts` must not be all zeros.
+    void normalize(const uint32_t* counts) {
+        uint64_t total = 0;
+        for (size_t value = 0; value != 256; ++value) {
+            total += counts[value];
+        }
+
+        int32_t sum = 0;
+        size_t largest = 0;
+        for (size_t value = 0; value != 256; ++value) {
+            freq[value] = counts[value] == 0 ? 0 : uint16_t(std::max<uint64_t>(
+                1, uint64_t(counts[value]) * RANSScale / total));
+            sum += freq[value];
+            if (counts[value] > counts[largest]) {
+                largest = value;
+            }
+        }
+
+        // Rounding down leaves a few slots over, which go to the most
+        //  frequent value; the values bumped up to 1 can overshoot, which
+        //  is taken back from whichever values can best spare it.
+        if (sum < int32_t(RANSScale)) {
+            freq[largest] += uint16_t(RANSScale - sum);
+        }
+        while (sum > int32_t(RANSScale)) {
+            const auto most = std::max_element(freq, freq + 256);
+            --*most;
+            --sum;
+        }
+        computeStarts();
+    }
+
+    void write(std::vector<uint8_t>& out) const {
+        uint8_t present[32] = {};
+        for (size_t value = 0; value != 256; ++value) {
+            if (freq[value] != 0) {
+                present[value / 8] |= uint8_t(1u << (value % 8));
+            }
+        }
+        out.insert(out.end(), present, present + sizeof(present));
+        for (size_t value = 0; value != 256; ++value) {
+            if (freq[value] == 0) {
+                continue;
+            }
+            const uint32_t stored = freq[value] - 1u;
+            if (stored >= 128) {
+                out.push_back(uint8_t(0x80 | stored >> 8));
+            }
+            out.push_back(uint8_t(stored));
+        }
+    }
+
+    // Reads a table written by write() from the `size` bytes at `bytes`.
+    //  Returns the number of bytes it took, or 0 if they don't hold a
+    //  valid table.
+    size_t read(const uint8_t* bytes, size_t size) {
+        if (size < 32) {
+            return 0;
+        }
+        size_t pos = 32;
+        uint32_t sum = 0;
+        for (size_t value = 0; value != 256; ++value) {
+            freq[value] = 0;
+            if (!(bytes[value / 8] >> (value % 8) & 1)) {
+                continue;
+            }
+            if (pos == size) {
+                return 0;
+            }
+            uint32_t stored = bytes[pos++];
+            if (stored & 0x80) {
+                if (pos == size) {
+                    return 0;
+                }
+                stored = (stored & 0x7f) << 8 | bytes[pos++];
+            }
+            freq[value] = uint16_t(std::min(stored + 1, RANSScale));
+            sum += freq[value];
+        }
+        if (sum != RANSScale) {
+            return 0;
+        }
+        computeStarts();
+        return pos;
+    }
+
+private:
+    void computeStarts() {
+        uint16_t cumulative = 0;
+        for (size_t value = 0; value != 256; ++value) {
+            start[value] = cumulative;
+            cumulative = uint16_t(cumulative + freq[value]);
+        }
+    }
+};
+
+// The decoder's side of a RANSFrequencies: one entry per slot, packing
+//  the value (8 bits), its frequency minus one (12 bits) and the slot's
+//  offset from the value's first slot (12 bits).
+struct RANSDecodeTable {
+    std::vector<uint32_t> slots;
+
+    explicit RANSDecodeTable(const RANSFrequencies& frequencies)
+    : slots(RANSScale) {
+        for (uint32_t value = 0; value != 256; ++value) {
+            const uint32_t start = frequencies.start[value];
+            const uint32_t freq = frequencies.freq[value];
+            for (uint32_t slot = 0; slot != freq; ++slot) {
+                slots[start + slot] = value | (freq - 1) << 8 | slot << 20;
+            }
+        }
+    }
+
+    // Takes the value `entry` stands for off `state` (the caller already
+    //  has it, as uint8_t(entry)), refilling the state from `bytes`, which
+    //  stop at `end`. Returns false if a word was needed and none was left.
+    //  Without `checked`, the caller has made sure that one is.
+    template <bool checked>
+    static bool decode(uint32_t entry, uint32_t& state, const uint8_t*& bytes,
+                       const uint8_t* end) {
+        state = ((entry >> 8 & (RANSScale - 1)) + 1) * (state >> RANSScaleBits) + (entry >> 20);
+        const uint32_t refill = state < RANSLow;
+        if (checked && end - bytes < 2) {
+            return !refill;
+        }
+        // Compilers like to turn a select here back into a branch, which
+        //  mispredicts about as often as it's taken.
+        const uint32_t word = uint32_t(bytes[0]) | uint32_t(bytes[1]) << 8;
+        state = state << (refill * 16) | (word & (0u - refill));
+        bytes += refill * 2;
+        return true;
+    }
+
+    uint32_t entry(uint32_t state) const {
+        return slots[state & (RANSScale - 1)];
+    }
+};
+
+// Left and upper neighbors of the index at (x, y), each standing in for
+//  the other along the top and left edges of the plane (or band).
+inline void IndexNeighbors(const uint8_t* plane, size_t nBlocksX, size_t x, size_t y,
+                           uint8_t& left, uint8_t& up) {
+    const uint8_t* row = plane + y * nBlocksX;
+    if (y == 0) {
+        left = up = x == 0 ? 0 : row[x - 1];
+    }
+    else {
+        up = row[x - nBlocksX];
+        left = x == 0 ? up : row[x - 1];
+    }
+}
+
+// The rank of `value` next to its neighbors: `value ^ left`, so repeating
+//  the left neighbor ranks 0 and nearby palette entries rank low, with 1
+//  then trading places with wherever the upper neighbor landed, so that
+//  repeating it ranks 1. Where both neighbors agree there's nothing to
+//  trade, and `swap` comes out as 1 too. Trading places is its own
+//  inverse, which makes UnrankIndex the same two steps backwards.
+inline uint32_t RankSwap(uint8_t left, uint8_t up) {
+    return uint32_t(left ^ up) + (left == up);
+}
+
+inline uint8_t RankIndex(uint8_t value, uint8_t left, uint8_t up) {
+    const uint32_t swap = RankSwap(left, up);
+    const uint32_t rank = uint32_t(value ^ left);
+    return uint8_t(rank == swap ? 1 : rank == 1 ? swap : rank);
+}
+
+inline uint8_t UnrankIndex(uint8_t rank, uint8_t left, uint8_t up) {
+    const uint32_t swap = RankSwap(left, up);
+    const uint32_t value = rank == swap ? 1 : rank == 1 ? swap : rank;
+    return uint8_t(value ^ left);
+}
+
+// Appends the bands of `symbols`, nBlocksX * nBlocksY of them, to `out`;
+//  symbol i is coded with tables[contexts[i]], or tables[0] without
+//  `contexts`.
+inline void AppendRANSBands(const uint8_t* symbols, const uint8_t* contexts,
+                            size_t nBlocksX, size_t nBlocksY,
+                            const RANSFrequencies* tables, std::vector<uint8_t>& out) {
+    const size_t sizes = out.size();
+    out.resize(sizes + IndexBands * sizeof(uint32_t));
+
+    // Each symbol renormalizes out at most one word, then the state takes
+    //  four bytes.
+    std::vector<uint8_t> buffer;
+    for (size_t band = 0; band != IndexBands; ++band) {
+        const size_t begin = IndexBandBegin(band, nBlocksY) * nBlocksX;
+        const size_t end = IndexBandBegin(band + 1, nBlocksY) * nBlocksX;
+        buffer.resize(2 * (end - begin) + sizeof(uint32_t));
+        uint8_t* const bufferEnd = buffer.data() + buffer.size();
+        uint8_t* bytes = bufferEnd;
+
+        uint32_t state = RANSLow;
+        for (size_t idx = end; idx-- != begin; ) {
+            const auto& table = tables[contexts ? contexts[idx] : 0];
+            const uint32_t freq = table.freq[symbols[idx]];
+            if (state >= (uint64_t(RANSLow >> RANSScaleBits) << 16) * freq) {
+                bytes -= 2;
+                bytes[0] = uint8_t(state);
+                bytes[1] = uint8_t(state >> 8);
+                state >>= 16;
+            }
+            state = (state / freq << RANSScaleBits) + state % freq + table.start[symbols[idx]];
+        }
+        bytes -= sizeof(state);
+        memcpy(bytes, &state, sizeof(state));
+
+        const uint32_t size = uint32_t(bufferEnd - bytes);
+        memcpy(&out[sizes + band * sizeof(uint32_t)], &size, sizeof(size));
+        out.insert(out.end(), bytes, bufferEnd);
+    }
+}
+
+// Appends `plane`, nBlocksX * nBlocksY indices in row-major order, to
+//  `out` in whichever of the modes above comes out smallest.
+inline void AppendCodedIndexPlane(const uint8_t* plane, size_t nBlocksX, size_t nBlocksY,
+                                  std::vector<uint8_t>& out) {
+    const size_t count = nBlocksX * nBlocksY;
+    const size_t begin = out.size();
+    out.push_back(uint8_t(IndexCoding::Stored));
+    out.insert(out.end(), plane, plane + count);
+    if (count == 0) {
+        return;
+    }
+
+    std::vector<uint8_t> coded;
+    auto keepIfSmaller = [&] {
+        if (coded.size() < out.size() - begin) {
+            out.resize(begin);
+            out.insert(out.end(), coded.begin(), coded.end());
+        }
+        coded.clear();
+    };
+
+    uint32_t counts[2][256] = {};
+    for (size_t idx = 0; idx != count; ++idx) {
+        ++counts[0][plane[idx]];
+    }
+    RANSFrequencies tables[2];
+    tables[0].normalize(counts[0]);
+    coded.push_back(uint8_t(IndexCoding::Order0));
+    tables[0].write(coded);
+    AppendRANSBands(plane, nullptr, nBlocksX, nBlocksY, tables, coded);
+    keepIfSmaller();
+
+    std::vector<uint8_t> ranks(count), contexts(count);
+    std::fill(counts[0], counts[0] + 256, 0);
+    for (size_t band = 0; band != IndexBands; ++band) {
+        const size_t bandBegin = IndexBandBegin(band, nBlocksY);
+        const uint8_t* const bandPlane = plane + bandBegin * nBlocksX;
+        for (size_t y = 0; y != IndexBandBegin(band + 1, nBlocksY) - bandBegin; ++y) {
+            for (size_t x = 0; x != nBlocksX; ++x) {
+                const size_t idx = (bandBegin + y) * nBlocksX + x;
+                uint8_t left, up;
+                IndexNeighbors(bandPlane, nBlocksX, x, y, left, up);
+                ranks[idx] = RankIndex(plane[idx], left, up);
+                contexts[idx] = left != up;
+                ++counts[contexts[idx]][ranks[idx]];
+            }
+        }
+    }
+    // A context that never comes up still needs a valid table.
+    for (auto& contextCounts : counts) {
+        if (std::all_of(contextCounts, contextCounts + 256, [](uint32_t n) { return n == 0; })) {
+            contextCounts[0] = 1;
+        }
+    }
+    tables[0].normalize(counts[0]);
+    tables[1].normalize(counts[1]);
+    coded.push_back(uint8_t(IndexCoding::Neighbors));
+    tables[0].write(coded);
+    tables[1].write(coded);
+    AppendRANSBands(ranks.data(), contexts.data(), nBlocksX, nBlocksY, tables, coded);
+    keepIfSmaller();
+}
+
+// One band's rANS state, and the bytes left of it.
+struct RANSLane {
+    uint32_t state;
+    const uint8_t* bytes;
+    const uint8_t* end;
+};
+
+// Decodes a row of each of `nLanes` bands in step, one index of every
+//  band in turn; rows[lane] is where the row goes and upRows[lane] the
+//  row above it, or null for the first row of a band. symbol(checked,
+//  lane, left, up) decodes the next index of a lane given its neighbors,
+//  leaving it in `left`, and returns false if the lane ran out of bytes;
+//  `checked` is a std::bool_constant, false when the lane is known to
+//  hold enough bytes for the whole row.
+//
+// Every byte stored to a row could alias anything as far as a compiler
+//  knows, so whatever the loop reads is first copied into locals whose
+//  address never escapes.
+template <size_t nLanes, bool checked, bool firstRow, typename SymbolFn>
+inline bool DecodeBandRowsWith(RANSLane* lane, uint8_t* const* row, const uint8_t* const* upRow,
+                               uint8_t* left, size_t nBlocksX, SymbolFn& symbol) {
+    bool complete = true;
+    for (size_t x = 0; x != nBlocksX; ++x) {
+        for (size_t idx = 0; idx != nLanes; ++idx) {
+            const uint8_t up = firstRow ? left[idx] : upRow[idx][x];
+            complete &= symbol(std::bool_constant<checked>(), lane[idx], left[idx], up);
+            row[idx][x] = left[idx];
+        }
+    }
+    return complete;
+}
+
+template <size_t nLanes, typename SymbolFn>
+inline bool DecodeBandRows(RANSLane* const* lanes, uint8_t* const* rows,
+                           const uint8_t* const* upRows, size_t nBlocksX, SymbolFn symbol) {
+    RANSLane lane[nLanes];
+    uint8_t* row[nLanes];
+    const uint8_t* upRow[nLanes];
+    uint8_t left[nLanes];
+    // Each index takes in at most one word, so unless a lane is nearly
+    //  out of bytes (the last rows of a band, or damaged ones) the row
+    //  can skip checking for each.
+    bool checked = false;
+    for (size_t idx = 0; idx != nLanes; ++idx) {
+        lane[idx] = *lanes[idx];
+        row[idx] = rows[idx];
+        upRow[idx] = upRows[idx];
+        left[idx] = upRow[idx] ? upRow[idx][0] : 0;
+        checked |= size_t(lane[idx].end - lane[idx].bytes) < 2 * nBlocksX;
+    }
+
+    // All bands start a row together, so they're all on their first one
+    //  or none is.
+    bool complete;
+    if (upRow[0]) {
+        complete = checked
+            ? DecodeBandRowsWith<nLanes, true, false>(lane, row, upRow, left, nBlocksX, symbol)
+            : DecodeBandRowsWith<nLanes, false, false>(lane, row, upRow, left, nBlocksX, symbol);
+    }
+    else {
+        complete = checked
+            ? DecodeBandRowsWith<nLanes, true, true>(lane, row, upRow, left, nBlocksX, symbol)
+            : DecodeBandRowsWith<nLanes, false, true>(lane, row, upRow, left, nBlocksX, symbol);
+    }
+
+    for (size_t idx = 0; idx != nLanes; ++idx) {
+        *lanes[idx] = lane[idx];
+    }
+    return complete;
+}
+
+// Decodes the `size` bytes of a coded plane at `bytes` into `plane`,
+//  which holds nBlocksX * nBlocksY indices. Returns nullptr on success, or
+//  what's wrong with the bytes.
+inline const char* DecodeIndexPlane(const uint8_t* bytes, size_t size,
+                                    size_t nBlocksX, size_t nBlocksY, uint8_t* plane) {
+    static const char* const corrupt = "corrupt coded index plane";
+    const size_t count = nBlocksX * nBlocksY;
+    if (size == 0) {
+        return corrupt;
+    }
+    const auto mode = IndexCoding(bytes[0]);
+    const uint8_t* const end = bytes + size;
+    ++bytes;
+
+    if (mode == IndexCoding::Stored) {
+        if (size_t(end - bytes) != count) {
+            return corrupt;
+        }
+        std::copy(bytes, end, plane);
+        return nullptr;
+    }
+    if (mode != IndexCoding::Order0 && mode != IndexCoding::Neighbors) {
+        return "coded index plane uses an unknown mode";
+    }
+
+    const size_t nTables = mode == IndexCoding::Order0 ? 1 : 2;
+    RANSFrequencies frequencies[2];
+    for (size_t table = 0; table != nTables; ++table) {
+        const size_t tableSize = frequencies[table].read(bytes, size_t(end - bytes));
+        if (tableSize == 0) {
+            return corrupt;
+        }
+        bytes += tableSize;
+    }
+
+    if (size_t(end - bytes) < IndexBands * sizeof(uint32_t)) {
+        return corrupt;
+    }
+    RANSLane lanes[IndexBands];
+    const uint8_t* bandBytes = bytes + IndexBands * sizeof(uint32_t);
+    for (auto& lane : lanes) {
+        uint32_t bandSize;
+        memcpy(&bandSize, bytes, sizeof(bandSize));
+        bytes += sizeof(bandSize);
+        if (bandSize < sizeof(lane.state) || bandSize > size_t(end - bandBytes)) {
+            return corrupt;
+        }
+        memcpy(&lane.state, bandBytes, sizeof(lane.state));
+        lane.bytes = bandBytes + sizeof(lane.state);
+        lane.end = bandBytes + bandSize;
+        bandBytes = lane.end;
+    }
+    if (bandBytes != end) {
+        return corrupt;
+    }
+
+    const RANSDecodeTable tables[2] = {RANSDecodeTable(frequencies[0]),
+                                       nTables == 2 ? RANSDecodeTable(frequencies[1])
+                                                    : RANSDecodeTable(frequencies[0])};
+    auto order0 = [slots = tables[0].slots.data()](auto checked, RANSLane& lane, uint8_t& left,
+                                                   uint8_t) {
+        const uint32_t entry = slots[lane.state & (RANSScale - 1)];
+        left = uint8_t(entry);
+        return RANSDecodeTable::decode<decltype(checked)::value>(entry, lane.state, lane.bytes,
+                                                                 lane.end);
+    };
+    // Both lookups only depend on the state, which keeps the neighbors
+    //  out of the way until the end of each index.
+    auto neighbors = [sameSlots = tables[0].slots.data(), distinctSlots = tables[1].slots.data()]
+                     (auto checked, RANSLane& lane, uint8_t& left, uint8_t up) {
+        const uint32_t same = sameSlots[lane.state & (RANSScale - 1)];
+        const uint32_t distinct = distinctSlots[lane.state & (RANSScale - 1)];
+        const uint32_t entry = left != up ? distinct : same;
+        left = UnrankIndex(uint8_t(entry), left, up);
+        return RANSDecodeTable::decode<decltype(checked)::value>(entry, lane.state, lane.bytes,
+                                                                 lane.end);
+    };
+
+    // Bands are at most one row apart in height: all of them go in step
+    //  down to the height of the shortest, then the taller ones finish
+    //  their last row on their own.
+    const size_t shortest = nBlocksY / IndexBands;
+    bool complete = true;
+    RANSLane* laneOf[IndexBands];
+    uint8_t* rows[IndexBands];
+    const uint8_t* upRows[IndexBands];
+    for (size_t y = 0; y != shortest; ++y) {
+        for (size_t band = 0; band != IndexBands; ++band) {
+            laneOf[band] = &lanes[band];
+            rows[band] = plane + (IndexBandBegin(band, nBlocksY) + y) * nBlocksX;
+            upRows[band] = y == 0 ? nullptr : rows[band] - nBlocksX;
+        }
+        if (mode == IndexCoding::Order0) {
+            complete &= DecodeBandRows<IndexBands>(laneOf, rows, upRows, nBlocksX, order0);
+        }
+        else {
+            complete &= DecodeBandRows<IndexBands>(laneOf, rows, upRows, nBlocksX, neighbors);
+        }
+    }
+    for (size_t band = 0; band != IndexBands; ++band) {
+        const size_t bandBegin = IndexBandBegin(band, nBlocksY);
+        if (IndexBandBegin(band + 1, nBlocksY) - bandBegin == shortest) {
+            continue;
+        }
+        laneOf[0] = &lanes[band];
+        rows[0] = plane + (bandBegin + shortest) * nBlocksX;
+        upRows[0] = shortest == 0 ? nullptr : rows[0] - nBlocksX;
+        if (mode == IndexCoding::Order0) {
+            complete &= DecodeBandRows<1>(laneOf, rows, upRows, nBlocksX, order0);
+        }
+        else {
+            complete &= DecodeBandRows<1>(laneOf, rows, upRows, nBlocksX, neighbors);
+        }
+    }
+
+    // The encoder starts every state at RANSLow and uses up every byte,
+    //  so anything else means the bytes were damaged.
+    if (!complete || std::any_of(lanes, lanes + IndexBands, [](const RANSLane& lane) {
+            return lane.state != RANSLow || lane.bytes != lane.end; })) {
+        return corrupt;
+    }
+    return nullptr;
+}
+
+} // namespace IV1
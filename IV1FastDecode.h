@@ -0,0 +1,373 @@
+#pragma once
+
+#include "IV1File.h"
+#include "IV1ThreadPool.h"
+#include "Support/RGB8Image.h"
+
+#include "ConstexprSqrt.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define IV1_FAST_DECODE_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IV1_FAST_DECODE_SSE2 1
+#endif
+
+namespace IV1 {
+
+// Integer-only decoder that goes straight from the 8-bit planes of an
+//  IV1 stream to RGB8 pixels, without widening anything to float.
+//
+// Both dictionaries are de-weighted (undoing the Rec.709 scaling done at
+//  encode time) once, into 16-bit fixed point with `fracBits` fractional
+//  bits. Every output sample is then a single saturating add of a palette
+//  entry and a residual entry, followed by a shift and a pack to 8 bits;
+//  no multiplications happen per pixel.
+//
+// Rounding happens on each table entry instead of on the final sum, so a
+//  sample can land one step away from the float pipeline in
+//  IV1BlockImage.h in rare cases.
+struct FastDecodeTables {
+    static constexpr size_t blockW = 4;
+    static constexpr size_t blockH = 4;
+    static constexpr size_t channels = 3;
+    static constexpr size_t rowSamples = blockW * channels;
+    static constexpr size_t paddedRow = 16;
+    static constexpr int fracBits = 4;
+
+    // Palette color repeated over a tile row, rounding bias included.
+    alignas(32) int16_t mean[256][paddedRow];
+    // Residual tile rows.
+    alignas(32) int16_t residual[256][blockH][paddedRow];
+
+    FastDecodeTables(const uint8_t* dict0, const uint8_t* dict1) {
+        constexpr float scale = float(1 << fracBits);
+        constexpr float invWeights[3] = {
+            scale / constSqrt(0.2125f),
+            scale / constSqrt(0.7154f),
+            scale / constSqrt(0.0721f)
+        };
+
+        memset(mean, 0, sizeof(mean));
+        memset(residual, 0, sizeof(residual));
+
+        for (size_t entry = 0; entry != 256; ++entry) {
+            for (size_t sample = 0; sample != rowSamples; ++sample) {
+                const auto ch = sample % channels;
+                mean[entry][sample] = int16_t(std::lround(
+                    dict0[entry * channels + ch] * invWeights[ch])
+                    + (1 << (fracBits - 1)));
+            }
+
+            for (size_t y = 0; y != blockH; ++y) {
+                for (size_t sample = 0; sample != rowSamples; ++sample) {
+                    const auto ch = sample % channels;
+                    const float value = 2.0f *
+                        (dict1[entry * 48 + y * rowSamples + sample] - 127.5f);
+                    residual[entry][y][sample] = int16_t(std::lround(value * invWeights[ch]));
+                }
+            }
+        }
+    }
+
+    // Writes one tile row (4 pixels) to `out`. Only the first `nPixels`
+    //  pixels are stored, for tiles that straddle the right image edge.
+    void decodeTileRow(uint8_t index0, uint8_t index1, size_t y,
+                       uint8_t* out, size_t nPixels) const {
+        const int16_t* meanRow = mean[index0];
+        const int16_t* residualRow = residual[index1][y];
+        uint8_t row[paddedRow];
+
+#if defined(IV1_FAST_DECODE_AVX2)
+        const auto sum = _mm256_adds_epi16(
+            _mm256_load_si256(reinterpret_cast<const __m256i*>(meanRow)),
+            _mm256_load_si256(reinterpret_cast<const __m256i*>(residualRow)));
+        const auto shifted = _mm256_srai_epi16(sum, fracBits);
+        const auto packed = _mm256_permute4x64_epi64(
+            _mm256_packus_epi16(shifted, shifted), 0xD8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row), _mm256_castsi256_si128(packed));
+#elif defined(IV1_FAST_DECODE_SSE2)
+        const auto sumLo = _mm_adds_epi16(
+            _mm_load_si128(reinterpret_cast<const __m128i*>(meanRow)),
+            _mm_load_si128(reinterpret_cast<const __m128i*>(residualRow)));
+        const auto sumHi = _mm_adds_epi16(
+            _mm_load_si128(reinterpret_cast<const __m128i*>(meanRow + 8)),
+            _mm_load_si128(reinterpret_cast<const __m128i*>(residualRow + 8)));
+        const auto packed = _mm_packus_epi16(
+            _mm_srai_epi16(sumLo, fracBits), _mm_srai_epi16(sumHi, fracBits));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row), packed);
+#else
+        for (size_t sample = 0; sample != rowSamples; ++sample) {
+            const int sum = (meanRow[sample] + residualRow[sample]) >> fracBits;
+            row[sample] = uint8_t(sum < 0 ? 0 : sum > 255 ? 255 : sum);
+        }
+#endif
+
+        if (nPixels == blockW) {
+            memcpy(out, row, rowSamples);
+        }
+        else {
+            memcpy(out, row, nPixels * channels);
+        }
+    }
+
+    // Decodes one row of tiles, given its two rows of indices, into `nRows`
+    //  (at most 4) pixel rows starting at `out`. Columns beyond `actualW`
+    //  are skipped.
+    void decodeBlockRow(const uint8_t* indices0, const uint8_t* indices1,
+                        size_t nBlocksX, size_t actualW, size_t nRows,
+                        uint8_t* out, size_t stride) const {
+        for (size_t y = 0; y != nRows; ++y, out += stride) {
+            for (size_t blockX = 0; blockX != nBlocksX; ++blockX) {
+                const size_t imageX = blockX * blockW;
+                if (imageX >= actualW) {
+                    break;
+                }
+                decodeTileRow(indices0[blockX], indices1[blockX], y,
+                    out + imageX * channels, std::min(blockW, actualW - imageX));
+            }
+        }
+    }
+
+    // Decodes block rows [blockRowBegin, blockRowEnd) of `planes`. Pixel
+    //  row `y` of the image lands at `pixels + (y - 4 * blockRowBegin) * stride`,
+    //  and rows or columns beyond the actual image size are skipped.
+    void decodeBlockRows(const IV1Planes& planes,
+                         size_t blockRowBegin, size_t blockRowEnd,
+                         uint8_t* pixels, size_t stride) const {
+        const size_t nBlocksX = planes.header.nBlocksX;
+        const size_t actualW = planes.header.actualW;
+        const size_t actualH = planes.header.actualH;
+
+        for (size_t blockY = blockRowBegin; blockY != blockRowEnd; ++blockY) {
+            const size_t imageY = blockY * blockH;
+            if (imageY >= actualH) {
+                break;
+            }
+            decodeBlockRow(planes.indices0 + blockY * nBlocksX,
+                planes.indices1 + blockY * nBlocksX, nBlocksX, actualW,
+                std::min(blockH, actualH - imageY),
+                pixels + (imageY - blockRowBegin * blockH) * stride, stride);
+        }
+    }
+
+    // Decodes the `width` x `height` rectangle at (x, y) of the image into
+    //  `pixels`, touching only the index rows that intersect it. Tiles cut
+    //  by the rectangle are decoded whole and trimmed, which also keeps the
+    //  mirrored padding past the right and bottom edges out of the output.
+    //  Returns false if the rectangle isn't inside the image.
+    bool decodeRegion(const IV1Planes& planes, size_t x, size_t y,
+                      size_t width, size_t height,
+                      uint8_t* pixels, size_t stride) const {
+        const size_t actualW = planes.header.actualW;
+        const size_t actualH = planes.header.actualH;
+        if (x > actualW || y > actualH || width > actualW - x || height > actualH - y) {
+            return false;
+        }
+
+        const size_t nBlocksX = planes.header.nBlocksX;
+        const size_t firstBlockX = x / blockW;
+        const size_t endBlockX = (x + width + blockW - 1) / blockW;
+
+        for (size_t row = 0; row != height; ++row) {
+            const size_t imageY = y + row;
+            const size_t offset = (imageY / blockH) * nBlocksX;
+            const uint8_t* indices0 = planes.indices0 + offset;
+            const uint8_t* indices1 = planes.indices1 + offset;
+            uint8_t* out = pixels + row * stride;
+
+            for (size_t blockX = firstBlockX; blockX != endBlockX; ++blockX) {
+                uint8_t tileRow[rowSamples];
+                decodeTileRow(indices0[blockX], indices1[blockX], imageY % blockH,
+                    tileRow, blockW);
+
+                const size_t begin = std::max(x, blockX * blockW);
+                const size_t end = std::min(x + width, (blockX + 1) * blockW);
+                memcpy(out + (begin - x) * channels,
+                    tileRow + (begin - blockX * blockW) * channels,
+                    (end - begin) * channels);
+            }
+        }
+
+        return true;
+    }
+};
+
+// Integer decoder for reduced sizes, in the same fixed point as
+//  FastDecodeTables. At 1/4 scale each tile becomes one pixel, its palette
+//  color, so dict1 and indices1 are never touched. At 1/2 scale each tile
+//  becomes 2x2 pixels: the palette color plus the residual entry averaged
+//  over 2x2 pixel groups, which is precomputed once per entry.
+struct ScaledDecodeTables {
+    static constexpr size_t blockW = FastDecodeTables::blockW;
+    static constexpr size_t blockH = FastDecodeTables::blockH;
+    static constexpr size_t channels = FastDecodeTables::channels;
+    static constexpr int fracBits = FastDecodeTables::fracBits;
+
+    size_t scale;       // 2 or 4
+    // Palette color, rounding bias included.
+    int16_t mean[256][channels];
+    // Residual entries at 1/2 scale; unused at 1/4.
+    int16_t residual[256][blockH / 2][blockW / 2][channels];
+
+    // `dict1` may be null at 1/4 scale.
+    ScaledDecodeTables(size_t scale, const uint8_t* dict0, const uint8_t* dict1)
+    : scale(scale) {
+        constexpr float fixedScale = float(1 << fracBits);
+        constexpr float invWeights[3] = {
+            fixedScale / constSqrt(0.2125f),
+            fixedScale / constSqrt(0.7154f),
+            fixedScale / constSqrt(0.0721f)
+        };
+
+        memset(residual, 0, sizeof(residual));
+        for (size_t entry = 0; entry != 256; ++entry) {
+            for (size_t ch = 0; ch != channels; ++ch) {
+                mean[entry][ch] = int16_t(std::lround(dict0[entry * channels + ch] * invWeights[ch])
+                    + (1 << (fracBits - 1)));
+            }
+            if (scale != 2) {
+                continue;
+            }
+
+            const uint8_t* block = dict1 + entry * 48;
+            for (size_t y = 0; y != blockH / 2; ++y) {
+                for (size_t x = 0; x != blockW / 2; ++x) {
+                    for (size_t ch = 0; ch != channels; ++ch) {
+                        float sum = 0.0f;
+                        for (size_t dy = 0; dy != 2; ++dy) {
+                            for (size_t dx = 0; dx != 2; ++dx) {
+                                const size_t pixel = (2 * y + dy) * blockW + 2 * x + dx;
+                                sum += 2.0f * (block[pixel * channels + ch] - 127.5f);
+                            }
+                        }
+                        residual[entry][y][x][ch] = int16_t(std::lround(sum * 0.25f * invWeights[ch]));
+                    }
+                }
+            }
+        }
+    }
+
+    size_t scaledWidth(const IV1FileHeader& header) const {
+        return (header.actualW + scale - 1) / scale;
+    }
+    size_t scaledHeight(const IV1FileHeader& header) const {
+        return (header.actualH + scale - 1) / scale;
+    }
+
+    // Decodes the whole image at 1/`scale` its size into `pixels`.
+    void decode(const IV1Planes& planes, uint8_t* pixels, size_t stride) const {
+        const size_t nBlocksX = planes.header.nBlocksX;
+        const size_t width = scaledWidth(planes.header);
+        const size_t height = scaledHeight(planes.header);
+        const size_t perBlock = blockW / scale;
+
+        for (size_t y = 0; y != height; ++y) {
+            const size_t blockY = y / perBlock;
+            const uint8_t* indices0 = planes.indices0 + blockY * nBlocksX;
+            const uint8_t* indices1 = scale == 2 ? planes.indices1 + blockY * nBlocksX : nullptr;
+            uint8_t* out = pixels + y * stride;
+
+            for (size_t x = 0; x != width; ++x, out += channels) {
+                const size_t blockX = x / perBlock;
+                const int16_t* color = mean[indices0[blockX]];
+                const int16_t* detail = indices1
+                    ? residual[indices1[blockX]][y % perBlock][x % perBlock] : nullptr;
+                for (size_t ch = 0; ch != channels; ++ch) {
+                    const int sum = (color[ch] + (detail ? detail[ch] : 0)) >> fracBits;
+                    out[ch] = uint8_t(sum < 0 ? 0 : sum > 255 ? 255 : sum);
+                }
+            }
+        }
+    }
+};
+
+// Decodes the image at 1/2 or 1/4 its size (rounding up). At 1/4, `planes`
+//  only needs dict0 and indices0.
+inline VQLib::Support::RGB8Image DecodeScaledRGB8Image(const IV1Planes& planes, size_t scale) {
+    const ScaledDecodeTables tables(scale, planes.dict0, scale == 2 ? planes.dict1 : nullptr);
+
+    VQLib::Support::RGB8Image image;
+    image.width = tables.scaledWidth(planes.header);
+    image.height = tables.scaledHeight(planes.header);
+    image.pixels.resize(image.width * image.height * 3);
+    tables.decode(planes, image.pixels.data(), image.width * 3);
+    return image;
+}
+
+// Decodes a whole image into a caller-provided buffer of at least
+//  `stride * actualH` bytes.
+inline void DecodeRGB8(const IV1Planes& planes, uint8_t* pixels, size_t stride) {
+    const FastDecodeTables tables(planes.dict0, planes.dict1);
+    tables.decodeBlockRows(planes, 0, planes.header.nBlocksY, pixels, stride);
+}
+
+// As above, with bands of block rows spread over `pool`. Every band
+//  writes its own rows of `pixels` and only reads the shared tables, so
+//  nothing is synchronized beyond the pool's final join, and the result
+//  is the same whatever the number of threads.
+inline void DecodeRGB8(const IV1Planes& planes, uint8_t* pixels, size_t stride,
+                       ThreadPool& pool) {
+    const FastDecodeTables tables(planes.dict0, planes.dict1);
+    const size_t nBlocksY = planes.header.nBlocksY;
+
+    // A few bands per thread evens out the load, but each band should be
+    //  long enough that handing it out costs nothing next to decoding it.
+    constexpr size_t minBandRows = 8;
+    constexpr size_t bandsPerThread = 4;
+    const size_t bandRows = std::max(minBandRows,
+        (nBlocksY + pool.size() * bandsPerThread - 1) / (pool.size() * bandsPerThread));
+    const size_t nBands = (nBlocksY + bandRows - 1) / bandRows;
+    if (pool.size() == 1 || nBands <= 1) {
+        tables.decodeBlockRows(planes, 0, nBlocksY, pixels, stride);
+        return;
+    }
+
+    pool.parallelFor(nBands, [&](size_t band) {
+        const size_t begin = band * bandRows;
+        const size_t end = std::min(nBlocksY, begin + bandRows);
+        tables.decodeBlockRows(planes, begin, end,
+            pixels + begin * FastDecodeTables::blockH * stride, stride);
+    });
+}
+
+inline VQLib::Support::RGB8Image DecodeRGB8Image(const IV1Planes& planes) {
+    VQLib::Support::RGB8Image image;
+    image.width = planes.header.actualW;
+    image.height = planes.header.actualH;
+    image.pixels.resize(image.width * image.height * 3);
+    DecodeRGB8(planes, image.pixels.data(), image.width * 3);
+    return image;
+}
+
+inline VQLib::Support::RGB8Image DecodeRGB8Image(const IV1Planes& planes, ThreadPool& pool) {
+    VQLib::Support::RGB8Image image;
+    image.width = planes.header.actualW;
+    image.height = planes.header.actualH;
+    image.pixels.resize(image.width * image.height * 3);
+    DecodeRGB8(planes, image.pixels.data(), image.width * 3, pool);
+    return image;
+}
+
+// Decodes the `width` x `height` rectangle at (x, y); returns an empty
+//  image if the rectangle isn't inside the image.
+inline VQLib::Support::RGB8Image DecodeRegionRGB8Image(const IV1Planes& planes,
+    size_t x, size_t y, size_t width, size_t height) {
+
+    VQLib::Support::RGB8Image image = {width, height, {}};
+    image.pixels.resize(width * height * 3);
+
+    const FastDecodeTables tables(planes.dict0, planes.dict1);
+    if (!tables.decodeRegion(planes, x, y, width, height, image.pixels.data(), width * 3)) {
+        return {0, 0, {}};
+    }
+    return image;
+}
+
+} // namespace IV1
@@ -1,71 +1,130 @@
 #pragma once
 
 #include "IV1BlockImage.h"
+#include "IV1Entropy.h"
 
 #include <algorithm>
+#include <cstdio>
 #include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
 
+// Read straight from a stream's bytes with memcpy, so it has to stay
+//  trivially copyable: the magic is a default, not a const.
 struct IV1FileHeader {
-    const uint8_t magic[4] = {'I', 'V', 'Y', '1'};
+    uint8_t magic[4] = {'I', 'V', 'Y', '1'};
     uint16_t nBlocksX, nBlocksY;
     uint32_t actualW, actualH;
 };
 
-void save(const char* path,
-          const FlexMatrix<float, 3>& dict0,
-          const std::vector<uint16_t>& indices0,
-          const FlexMatrix<float, 48>& dict1,
-          const std::vector<uint16_t>& indices1,
-          size_t nBlocksX, size_t nBlocksY,
-          size_t imageW, size_t imageH) {
-
-    FILE* file = strncmp("-", path, 1) == 0 ? stdout : fopen(path, "wb");
-    IV1FileHeader header;
-
-    header.nBlocksX = nBlocksX;
-    header.nBlocksY = nBlocksY;
-    header.actualW = imageW;
-    header.actualH = imageH;
-
-    fwrite(&header, 1, sizeof(header), file);
-
-    // Reduce dict0 to uint8, then save
+// Reduce dict0 to uint8, the way it's stored.
+inline void QuantizeDict0(const FlexMatrix<float, 3>& dict0, uint8_t* out) {
     for (const auto& block : dict0) {
-        MatrixRow<uint8_t, 3> block8bit;
         for (auto elem = 0; elem != 3; ++elem) {
-            block8bit[elem] = std::clamp(std::round(block[elem]), 0.0f, 255.0f);
+            *out++ = std::clamp(std::round(block[elem]), 0.0f, 255.0f);
         }
-        fwrite(block8bit.data(), 3, 1, file);
     }
+}
 
-    { // Reduce indices0 to uint8, then save
-        std::vector<uint8_t> indices8bit(indices0.size());
-        std::transform(indices0.begin(), indices0.end(), indices8bit.begin(),
-            [](uint16_t in) { return (uint8_t) in; });
-        
-        fwrite(indices8bit.data(), indices8bit.size(), 1, file);
+// Reduce dict1 to uint8, the way it's stored.
+inline void QuantizeDict1(const FlexMatrix<float, 48>& dict1, uint8_t* out) {
+    for (const auto& block : dict1) {
+        for (auto elem = 0; elem != 48; ++elem) {
+            *out++ = std::clamp(std::round((block[elem] + 255.0f)/2.0f), 0.0f, 255.0f);
+        }
     }
+}
 
-    // Reduce dict1 to uint8, then save
-    for (const auto& block : dict1) {
-        MatrixRow<uint8_t, 48> block8bit;
+// Expand stored dictionaries back to float, as the decoder sees them.
+inline void ExpandDict0(const uint8_t* dict0, FlexMatrix<float, 3>& out) {
+    out.resize(256);
+    for (size_t idx = 0; idx != 256; ++idx) {
+        for (auto elem = 0; elem != 3; ++elem) {
+            out[idx][elem] = dict0[idx * 3 + elem];
+        }
+    }
+}
+
+inline void ExpandDict1(const uint8_t* dict1, FlexMatrix<float, 48>& out) {
+    out.resize(256);
+    for (size_t idx = 0; idx != 256; ++idx) {
         for (auto elem = 0; elem != 48; ++elem) {
-            block8bit[elem] = std::clamp(std::round((block[elem] + 255.0f)/2.0f), 0.0f, 255.0f);
+            out[idx][elem] = 2.0f * (dict1[idx * 48 + elem] - 127.5f);
         }
-        fwrite(block8bit.data(), 48, 1, file);
     }
+}
 
-    { // Reduce indices1 to uint8, then save
-        std::vector<uint8_t> indices8bit(indices1.size());
-        std::transform(indices1.begin(), indices1.end(), indices8bit.begin(),
-            [](uint16_t in) { return (uint8_t) in; });
-        
-        fwrite(indices8bit.data(), indices8bit.size(), 1, file);
+// Writes a complete IV1 stream, IV1StreamSize(nBlocksX, nBlocksY) bytes,
+//  to `out`.
+inline void WriteIV1(uint8_t* out,
+                     const FlexMatrix<float, 3>& dict0,
+                     const std::vector<uint16_t>& indices0,
+                     const FlexMatrix<float, 48>& dict1,
+                     const std::vector<uint16_t>& indices1,
+                     size_t nBlocksX, size_t nBlocksY,
+                     size_t imageW, size_t imageH) {
+    IV1FileHeader header;
+
+    header.nBlocksX = nBlocksX;
+    header.nBlocksY = nBlocksY;
+    header.actualW = imageW;
+    header.actualH = imageH;
+
+    memcpy(out, &header, sizeof(header));
+    out += sizeof(header);
+
+    // Dictionaries are reduced to uint8, indices truncated to uint8.
+    QuantizeDict0(dict0, out);
+    out += dict0.size() * 3;
+    out = std::transform(indices0.begin(), indices0.end(), out,
+        [](uint16_t in) { return (uint8_t) in; });
+    QuantizeDict1(dict1, out);
+    out += dict1.size() * 48;
+    std::transform(indices1.begin(), indices1.end(), out,
+        [](uint16_t in) { return (uint8_t) in; });
+}
+
+// Appends a complete IV1 stream to `bytes`.
+inline void SerializeIV1(std::vector<uint8_t>& bytes,
+                         const FlexMatrix<float, 3>& dict0,
+                         const std::vector<uint16_t>& indices0,
+                         const FlexMatrix<float, 48>& dict1,
+                         const std::vector<uint16_t>& indices1,
+                         size_t nBlocksX, size_t nBlocksY,
+                         size_t imageW, size_t imageH) {
+    const size_t offset = bytes.size();
+    bytes.resize(offset + sizeof(IV1FileHeader) + dict0.size() * 3 + indices0.size() +
+        dict1.size() * 48 + indices1.size());
+    WriteIV1(&bytes[offset], dict0, indices0, dict1, indices1, nBlocksX, nBlocksY, imageW, imageH);
+}
+
+// Writes out a stream already serialized into `bytes`.
+inline bool SaveIV1Bytes(const char* path, const std::vector<uint8_t>& bytes) {
+    FILE* file = strncmp("-", path, 1) == 0 ? stdout : fopen(path, "wb");
+    if (!file) {
+        return false;
     }
+    const bool written = fwrite(bytes.data(), bytes.size(), 1, file) == 1;
+    return fclose(file) == 0 && written;
+}
 
-    fclose(file);
+// Writes a SerializeIV1 stream to `path` ("-" for stdout). Returns false
+//  if it couldn't be written.
+inline bool save(const char* path,
+                 const FlexMatrix<float, 3>& dict0,
+                 const std::vector<uint16_t>& indices0,
+                 const FlexMatrix<float, 48>& dict1,
+                 const std::vector<uint16_t>& indices1,
+                 size_t nBlocksX, size_t nBlocksY,
+                 size_t imageW, size_t imageH) {
+    std::vector<uint8_t> bytes;
+    SerializeIV1(bytes, dict0, indices0, dict1, indices1, nBlocksX, nBlocksY, imageW, imageH);
+    return SaveIV1Bytes(path, bytes);
 }
 
+struct IV1Planes;
+
 struct IV1File {
     IV1FileHeader header;
     FlexMatrix<float, 3> dict0;
@@ -119,4 +178,404 @@ struct IV1File {
 
         fclose(file);
     }
-};
\ No newline at end of file
+
+    // Expands already-parsed planes, whether their dictionaries came from
+    //  the stream or from a pack.
+    explicit IV1File(const IV1Planes& planes);
+};
+
+// Streams whose magic reads 'IVYX' instead of 'IVY1' continue the header
+//  with these fields. What follows depends on the flags.
+struct IV1ExtendedHeader {
+    uint32_t flags;
+    uint32_t packId;    // with IV1FlagExternalDictionaries
+};
+
+constexpr uint8_t IV1ExtendedMagic[4] = {'I', 'V', 'Y', 'X'};
+
+// dict0 and dict1 aren't in the stream; they come from the dictionary
+//  pack whose ID is `packId`.
+constexpr uint32_t IV1FlagExternalDictionaries = 1u << 0;
+// The index planes are entropy coded (see IV1Entropy.h). Both
+//  dictionaries, unless they're in a pack, come first, then the sizes of
+//  the two coded planes as 32-bit integers, then the planes.
+constexpr uint32_t IV1FlagCodedIndices = 1u << 1;
+constexpr uint32_t IV1KnownFlags = IV1FlagExternalDictionaries | IV1FlagCodedIndices;
+
+inline bool IsExtendedIV1(const IV1FileHeader& header) {
+    return memcmp(header.magic, IV1ExtendedMagic, sizeof(IV1ExtendedMagic)) == 0;
+}
+
+// Writes a stream that references the dictionary pack `packId` instead
+//  of embedding its dictionaries, the headers and the two index planes,
+//  to `out`.
+inline void WriteIV1WithPack(uint8_t* out, uint32_t packId,
+                             const std::vector<uint16_t>& indices0,
+                             const std::vector<uint16_t>& indices1,
+                             size_t nBlocksX, size_t nBlocksY,
+                             size_t imageW, size_t imageH) {
+    IV1FileHeader header;
+
+    header.nBlocksX = nBlocksX;
+    header.nBlocksY = nBlocksY;
+    header.actualW = imageW;
+    header.actualH = imageH;
+    const IV1ExtendedHeader extended = {IV1FlagExternalDictionaries, packId};
+
+    memcpy(out, &header, sizeof(header));
+    memcpy(out, IV1ExtendedMagic, sizeof(IV1ExtendedMagic));
+    out += sizeof(header);
+    memcpy(out, &extended, sizeof(extended));
+    out += sizeof(extended);
+
+    out = std::transform(indices0.begin(), indices0.end(), out,
+        [](uint16_t in) { return (uint8_t) in; });
+    std::transform(indices1.begin(), indices1.end(), out,
+        [](uint16_t in) { return (uint8_t) in; });
+}
+
+// Appends a WriteIV1WithPack stream to `bytes`.
+inline void SerializeIV1WithPack(std::vector<uint8_t>& bytes, uint32_t packId,
+                                 const std::vector<uint16_t>& indices0,
+                                 const std::vector<uint16_t>& indices1,
+                                 size_t nBlocksX, size_t nBlocksY,
+                                 size_t imageW, size_t imageH) {
+    const size_t offset = bytes.size();
+    bytes.resize(offset + sizeof(IV1FileHeader) + sizeof(IV1ExtendedHeader) +
+        indices0.size() + indices1.size());
+    WriteIV1WithPack(&bytes[offset], packId, indices0, indices1,
+        nBlocksX, nBlocksY, imageW, imageH);
+}
+
+// Appends the coded-plane sizes and both coded planes of an
+//  IV1FlagCodedIndices stream to `bytes`.
+inline void AppendCodedIndexPlanes(std::vector<uint8_t>& bytes,
+                                   const std::vector<uint16_t>& indices0,
+                                   const std::vector<uint16_t>& indices1,
+                                   size_t nBlocksX, size_t nBlocksY) {
+    const size_t sizes = bytes.size();
+    bytes.resize(sizes + 2 * sizeof(uint32_t));
+
+    // Indices are truncated to uint8, then coded.
+    std::vector<uint8_t> plane(indices0.size());
+    const std::vector<uint16_t>* indices[2] = {&indices0, &indices1};
+    for (size_t idx = 0; idx != 2; ++idx) {
+        std::transform(indices[idx]->begin(), indices[idx]->end(), plane.begin(),
+            [](uint16_t in) { return (uint8_t) in; });
+        const size_t begin = bytes.size();
+        IV1::AppendCodedIndexPlane(plane.data(), nBlocksX, nBlocksY, bytes);
+        const uint32_t size = uint32_t(bytes.size() - begin);
+        memcpy(&bytes[sizes + idx * sizeof(uint32_t)], &size, sizeof(size));
+    }
+}
+
+// Appends the headers of an IV1FlagCodedIndices stream with `flags` to
+//  `bytes`, leaving room for the dictionaries unless they're in a pack.
+//  Returns the offset of that room.
+inline size_t AppendIV1CodedHeaders(std::vector<uint8_t>& bytes, uint32_t flags, uint32_t packId,
+                                    size_t nBlocksX, size_t nBlocksY,
+                                    size_t imageW, size_t imageH) {
+    IV1FileHeader header;
+
+    header.nBlocksX = nBlocksX;
+    header.nBlocksY = nBlocksY;
+    header.actualW = imageW;
+    header.actualH = imageH;
+    const IV1ExtendedHeader extended = {IV1FlagCodedIndices | flags, packId};
+
+    const size_t offset = bytes.size();
+    const size_t dictSize = (flags & IV1FlagExternalDictionaries) ? 0 : 256 * 3 + 256 * 48;
+    bytes.resize(offset + sizeof(header) + sizeof(extended) + dictSize);
+    memcpy(&bytes[offset], &header, sizeof(header));
+    memcpy(&bytes[offset], IV1ExtendedMagic, sizeof(IV1ExtendedMagic));
+    memcpy(&bytes[offset + sizeof(header)], &extended, sizeof(extended));
+    return offset + sizeof(header) + sizeof(extended);
+}
+
+// Appends a stream like SerializeIV1's, with entropy-coded index planes,
+//  to `bytes`.
+inline void SerializeIV1Coded(std::vector<uint8_t>& bytes,
+                              const FlexMatrix<float, 3>& dict0,
+                              const std::vector<uint16_t>& indices0,
+                              const FlexMatrix<float, 48>& dict1,
+                              const std::vector<uint16_t>& indices1,
+                              size_t nBlocksX, size_t nBlocksY,
+                              size_t imageW, size_t imageH) {
+    const size_t dicts = AppendIV1CodedHeaders(bytes, 0, 0, nBlocksX, nBlocksY, imageW, imageH);
+    QuantizeDict0(dict0, &bytes[dicts]);
+    QuantizeDict1(dict1, &bytes[dicts + 256 * 3]);
+    AppendCodedIndexPlanes(bytes, indices0, indices1, nBlocksX, nBlocksY);
+}
+
+// Appends a stream like SerializeIV1WithPack's, with entropy-coded index
+//  planes, to `bytes`.
+inline void SerializeIV1CodedWithPack(std::vector<uint8_t>& bytes, uint32_t packId,
+                                      const std::vector<uint16_t>& indices0,
+                                      const std::vector<uint16_t>& indices1,
+                                      size_t nBlocksX, size_t nBlocksY,
+                                      size_t imageW, size_t imageH) {
+    AppendIV1CodedHeaders(bytes, IV1FlagExternalDictionaries, packId,
+        nBlocksX, nBlocksY, imageW, imageH);
+    AppendCodedIndexPlanes(bytes, indices0, indices1, nBlocksX, nBlocksY);
+}
+
+// A dictionary pair trained offline over many images, in the same 8-bit
+//  form as the dictionaries inside a stream. On disk: 'IVYP', the ID, then
+//  dict0 and dict1.
+struct IV1DictionaryPack {
+    uint32_t id = 0;
+    uint8_t dict0[256 * 3];
+    uint8_t dict1[256 * 48];
+};
+
+constexpr uint8_t IV1PackMagic[4] = {'I', 'V', 'Y', 'P'};
+
+// FNV-1a over both dictionaries, so a stream can't be paired with the
+//  wrong pack by accident.
+inline uint32_t IV1PackId(const uint8_t* dict0, const uint8_t* dict1) {
+    uint32_t hash = 2166136261u;
+    for (const auto& [bytes, size] : {std::make_pair(dict0, size_t(256 * 3)),
+                                      std::make_pair(dict1, size_t(256 * 48))}) {
+        for (size_t idx = 0; idx != size; ++idx) {
+            hash = (hash ^ bytes[idx]) * 16777619u;
+        }
+    }
+    return hash;
+}
+
+inline bool SaveIV1Pack(const char* path, const IV1DictionaryPack& pack) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    const bool written = fwrite(IV1PackMagic, sizeof(IV1PackMagic), 1, file) == 1 &&
+        fwrite(&pack.id, sizeof(pack.id), 1, file) == 1 &&
+        fwrite(pack.dict0, sizeof(pack.dict0), 1, file) == 1 &&
+        fwrite(pack.dict1, sizeof(pack.dict1), 1, file) == 1;
+    return fclose(file) == 0 && written;
+}
+
+// Size of a pack file: magic, ID and both dictionaries.
+constexpr size_t IV1PackSize = sizeof(IV1PackMagic) + sizeof(uint32_t) + 256 * 3 + 256 * 48;
+
+// Reads a pack out of the `size` bytes of a pack file at `bytes`. Returns
+//  nullptr on success, or what's wrong with them.
+inline const char* ParseIV1Pack(const uint8_t* bytes, size_t size, IV1DictionaryPack& pack) {
+    if (size < IV1PackSize) {
+        return "truncated dictionary pack";
+    }
+    if (memcmp(bytes, IV1PackMagic, sizeof(IV1PackMagic)) != 0) {
+        return "not an IV1 dictionary pack (bad magic)";
+    }
+    bytes += sizeof(IV1PackMagic);
+    memcpy(&pack.id, bytes, sizeof(pack.id));
+    memcpy(pack.dict0, bytes + sizeof(pack.id), sizeof(pack.dict0));
+    memcpy(pack.dict1, bytes + sizeof(pack.id) + sizeof(pack.dict0), sizeof(pack.dict1));
+    if (pack.id != IV1PackId(pack.dict0, pack.dict1)) {
+        return "dictionary pack is corrupt (ID mismatch)";
+    }
+    return nullptr;
+}
+
+// Returns nullptr on success, or what's wrong with the file.
+inline const char* LoadIV1Pack(const char* path, IV1DictionaryPack& pack) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return "could not open dictionary pack";
+    }
+    uint8_t bytes[IV1PackSize];
+    const size_t size = fread(bytes, 1, sizeof(bytes), file);
+    fclose(file);
+    return ParseIV1Pack(bytes, size, pack);
+}
+
+// Pointers to the 8-bit planes of an IV1 stream, exactly as they are laid
+//  out on disk; nothing is widened or copied. The one exception is coded
+//  index planes, which are decoded into `decodedIndices` (one plane after
+//  the other) for the index pointers to point into.
+struct IV1Planes {
+    IV1FileHeader header;
+    uint32_t flags;             // IV1ExtendedHeader flags, 0 for 'IVY1' streams
+    const uint8_t* dict0;       // 256 entries of 3 bytes
+    const uint8_t* indices0;    // nBlocksX * nBlocksY bytes
+    const uint8_t* dict1;       // 256 entries of 48 bytes
+    const uint8_t* indices1;    // nBlocksX * nBlocksY bytes
+    std::shared_ptr<std::vector<uint8_t>> decodedIndices;
+};
+
+inline IV1File::IV1File(const IV1Planes& planes)
+: header(planes.header) {
+    const size_t numBlocks = size_t(header.nBlocksX) * header.nBlocksY;
+    ExpandDict0(planes.dict0, dict0);
+    ExpandDict1(planes.dict1, dict1);
+    indices0.assign(planes.indices0, planes.indices0 + numBlocks);
+    indices1.assign(planes.indices1, planes.indices1 + numBlocks);
+}
+
+// Byte offsets of everything in a stream, from its headers. `extended` is
+//  null for 'IVY1' streams. The dictionary offsets are 0 when they live in
+//  a pack. With IV1FlagCodedIndices, the index plane offsets are 0 and
+//  `codedSizes` is where the sizes of the coded planes are; the planes
+//  follow them, and `size` only counts up to there.
+struct IV1Layout {
+    uint64_t headerSize;
+    uint64_t dict0, indices0, dict1, indices1;
+    uint64_t codedSizes;
+    uint64_t size;
+};
+
+inline IV1Layout GetIV1Layout(size_t nBlocksX, size_t nBlocksY,
+                              const IV1ExtendedHeader* extended = nullptr) {
+    const uint64_t numBlocks = uint64_t(nBlocksX) * nBlocksY;
+    IV1Layout layout = {};
+    layout.headerSize = sizeof(IV1FileHeader) + (extended ? sizeof(IV1ExtendedHeader) : 0);
+    if (extended && (extended->flags & IV1FlagCodedIndices)) {
+        const bool external = (extended->flags & IV1FlagExternalDictionaries) != 0;
+        layout.dict0 = external ? 0 : layout.headerSize;
+        layout.dict1 = external ? 0 : layout.headerSize + 256 * 3;
+        layout.codedSizes = layout.headerSize + (external ? 0 : 256 * 3 + 256 * 48);
+        layout.size = layout.codedSizes + 2 * sizeof(uint32_t);
+        return layout;
+    }
+    if (extended && (extended->flags & IV1FlagExternalDictionaries)) {
+        layout.indices0 = layout.headerSize;
+        layout.indices1 = layout.indices0 + numBlocks;
+    }
+    else {
+        layout.dict0 = layout.headerSize;
+        layout.indices0 = layout.dict0 + 256 * 3;
+        layout.dict1 = layout.indices0 + numBlocks;
+        layout.indices1 = layout.dict1 + 256 * 48;
+    }
+    layout.size = layout.indices1 + numBlocks;
+    return layout;
+}
+
+// Size of the stream; for coded index planes, the most it can take.
+inline size_t IV1StreamSize(size_t nBlocksX, size_t nBlocksY,
+                            const IV1ExtendedHeader* extended = nullptr) {
+    const auto layout = GetIV1Layout(nBlocksX, nBlocksY, extended);
+    if (extended && (extended->flags & IV1FlagCodedIndices)) {
+        return size_t(layout.size) +
+            2 * IV1::MaxCodedIndexPlaneSize(size_t(nBlocksX) * nBlocksY);
+    }
+    return size_t(layout.size);
+}
+
+// Checks the magic, that the block counts match the image size, and that
+//  `size` bytes are exactly what the header calls for (for coded index
+//  planes, that they're within what the header allows; ParseIV1Stream
+//  checks the rest). `extended` must be given for 'IVYX' streams. Returns
+//  nullptr if the stream is well-formed, or a description of the first
+//  problem found.
+inline const char* ValidateIV1Header(const IV1FileHeader& header, size_t size,
+                                     const IV1ExtendedHeader* extended = nullptr) {
+    if (extended ? !IsExtendedIV1(header) :
+        memcmp(header.magic, IV1FileHeader().magic, sizeof(header.magic)) != 0) {
+        return "not an IV1 stream (bad magic)";
+    }
+    if (extended && (extended->flags & ~IV1KnownFlags) != 0) {
+        return "stream uses features this decoder doesn't know";
+    }
+    if (header.nBlocksX != (uint64_t(header.actualW) + 3) / 4 ||
+        header.nBlocksY != (uint64_t(header.actualH) + 3) / 4) {
+        return "block counts don't match the image dimensions";
+    }
+    const size_t expected = IV1StreamSize(header.nBlocksX, header.nBlocksY, extended);
+    const bool coded = extended && (extended->flags & IV1FlagCodedIndices);
+    if (size < (coded ? GetIV1Layout(header.nBlocksX, header.nBlocksY, extended).size : expected)) {
+        return "truncated stream";
+    }
+    if (size > expected) {
+        return "trailing data after the stream";
+    }
+    return nullptr;
+}
+
+// Fills `planes` with pointers into `bytes`, and into `pack` for streams
+//  that reference one; coded index planes are decoded. With `paletteOnly`,
+//  for callers that never look at the residuals, a coded indices1 is
+//  skipped instead and left null. Returns nullptr on success, or what's
+//  wrong with the stream (leaving the pointers unset).
+inline const char* ParseIV1Stream(const uint8_t* bytes, size_t size, IV1Planes& planes,
+                                  const IV1DictionaryPack* pack = nullptr,
+                                  bool paletteOnly = false) {
+    if (size < sizeof(IV1FileHeader)) {
+        return "truncated stream";
+    }
+    memcpy(&planes.header, bytes, sizeof(IV1FileHeader));
+
+    IV1ExtendedHeader extended = {0, 0};
+    const bool isExtended = IsExtendedIV1(planes.header);
+    if (isExtended) {
+        if (size < sizeof(IV1FileHeader) + sizeof(IV1ExtendedHeader)) {
+            return "truncated stream";
+        }
+        memcpy(&extended, bytes + sizeof(IV1FileHeader), sizeof(extended));
+    }
+    const auto* extendedHeader = isExtended ? &extended : nullptr;
+    if (const char* error = ValidateIV1Header(planes.header, size, extendedHeader)) {
+        return error;
+    }
+
+    const auto layout = GetIV1Layout(planes.header.nBlocksX, planes.header.nBlocksY, extendedHeader);
+    planes.flags = extended.flags;
+    if (extended.flags & IV1FlagExternalDictionaries) {
+        if (!pack) {
+            return "stream needs a dictionary pack";
+        }
+        if (pack->id != extended.packId) {
+            return "stream was encoded with a different dictionary pack";
+        }
+        planes.dict0 = pack->dict0;
+        planes.dict1 = pack->dict1;
+    }
+    else {
+        planes.dict0 = bytes + layout.dict0;
+        planes.dict1 = bytes + layout.dict1;
+    }
+    if (!(extended.flags & IV1FlagCodedIndices)) {
+        planes.indices0 = bytes + layout.indices0;
+        planes.indices1 = bytes + layout.indices1;
+        planes.decodedIndices.reset();
+        return nullptr;
+    }
+
+    uint32_t codedSizes[2];
+    memcpy(codedSizes, bytes + layout.codedSizes, sizeof(codedSizes));
+    if (layout.size + uint64_t(codedSizes[0]) + codedSizes[1] != size) {
+        return "coded index plane sizes don't match the stream";
+    }
+    const size_t numBlocks = size_t(planes.header.nBlocksX) * planes.header.nBlocksY;
+    const size_t nPlanes = paletteOnly ? 1 : 2;
+    auto decoded = std::make_shared<std::vector<uint8_t>>(nPlanes * numBlocks);
+    const uint8_t* coded = bytes + layout.size;
+    for (size_t plane = 0; plane != nPlanes; ++plane) {
+        if (const char* error = IV1::DecodeIndexPlane(coded, codedSizes[plane],
+                planes.header.nBlocksX, planes.header.nBlocksY, decoded->data() + plane * numBlocks)) {
+            return error;
+        }
+        coded += codedSizes[plane];
+    }
+    planes.indices0 = decoded->data();
+    planes.indices1 = paletteOnly ? nullptr : decoded->data() + numBlocks;
+    planes.decodedIndices = std::move(decoded);
+    return nullptr;
+}
+
+// Slurps a whole IV1 file (or stdin, for "-") into memory.
+inline std::vector<uint8_t> ReadIV1Bytes(const char* path) {
+    std::vector<uint8_t> bytes;
+    auto file = strncmp("-", path, 1) == 0 ? stdin : fopen(path, "rb");
+    if (!file) {
+        return bytes;
+    }
+
+    uint8_t buffer[65536];
+    for (size_t nRead; (nRead = fread(buffer, 1, sizeof(buffer), file)) != 0; ) {
+        bytes.insert(bytes.end(), buffer, buffer + nRead);
+    }
+
+    fclose(file);
+    return bytes;
+}
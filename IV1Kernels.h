@@ -0,0 +1,530 @@
+#pragma once
+
+#include "ConstexprSqrt.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define IV1_KERNELS_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang only emit instructions the function is built for, so each
+//  kernel names its instruction set; MSVC emits any intrinsic anywhere.
+#if defined(IV1_KERNELS_X86) && (defined(__GNUC__) || defined(__clang__))
+#define IV1_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define IV1_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+#else
+#define IV1_TARGET_AVX2
+#define IV1_TARGET_AVX512
+#endif
+
+namespace IV1 {
+
+// Instruction sets the hot loops of the encoder and the float decoder
+//  come in. The build targets the baseline of the platform (SSE2 on
+//  x86-64); wider kernels are compiled alongside and picked at startup
+//  from what the CPU reports, unless SetISA overrides the choice.
+enum class ISA { Scalar, SSE2, AVX2, AVX512 };
+
+inline const char* ISAName(ISA isa) {
+    switch (isa) {
+    case ISA::SSE2: return "sse2";
+    case ISA::AVX2: return "avx2";
+    case ISA::AVX512: return "avx512";
+    default: return "scalar";
+    }
+}
+
+// The widest instruction set both the CPU and the OS (for the wider
+//  register state) support.
+inline ISA DetectISA() {
+#if defined(IV1_KERNELS_X86)
+#if defined(_MSC_VER) && !defined(__clang__)
+    int regs[4];
+    __cpuid(regs, 0);
+    const int maxLeaf = regs[0];
+    __cpuid(regs, 1);
+    const bool hasSSE2 = (regs[3] >> 26) & 1;
+    const bool hasFMA = (regs[2] >> 12) & 1;
+    const bool hasOSXSave = (regs[2] >> 27) & 1;
+    bool hasAVX2 = false, hasAVX512 = false;
+    if (maxLeaf >= 7 && hasOSXSave) {
+        const unsigned long long xcr0 = _xgetbv(0);
+        __cpuidex(regs, 7, 0);
+        hasAVX2 = hasFMA && ((regs[1] >> 5) & 1) && (xcr0 & 0x6) == 0x6;
+        hasAVX512 = hasAVX2 && ((regs[1] >> 16) & 1) && (xcr0 & 0xE6) == 0xE6;
+    }
+    return hasAVX512 ? ISA::AVX512 : hasAVX2 ? ISA::AVX2 : hasSSE2 ? ISA::SSE2 : ISA::Scalar;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return ISA::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return ISA::AVX2;
+    }
+    return __builtin_cpu_supports("sse2") ? ISA::SSE2 : ISA::Scalar;
+#endif
+#else
+    return ISA::Scalar;
+#endif
+}
+
+// Kernels over 4x4 RGB blocks of 48 floats, the only block shape IV1 uses.
+//  Arrays of blocks are contiguous, 48 floats apart.
+struct Kernels {
+    ISA isa;
+    // out[entry] = squared distance from `sample` to dict[entry].
+    void (*squaredDistances)(const float* sample, const float* dict, size_t count, float* out);
+    // The same for the 16-bit fixed-point blocks of compact training.
+    void (*squaredDistancesI16)(const int16_t* sample, const int16_t* dict, size_t count, int32_t* out);
+    // Mean color of each block, 3 floats per block.
+    void (*rgbMeans)(const float* blocks, size_t count, float* means);
+    // Each block minus its mean color; `out` may be `blocks`.
+    void (*subtractMeans)(const float* blocks, const float* means, size_t count, float* out);
+    // De-weights, rounds and clamps a row of blocks into 4 rows of RGB8
+    //  pixels, `stride` bytes apart.
+    void (*blocksToRGB8)(const float* blocks, size_t count, uint8_t* out, size_t stride);
+};
+
+namespace KernelImpl {
+
+constexpr size_t width = 48;
+
+constexpr float invWeights[3] = {
+    1.0f / constSqrt(0.2125f),
+    1.0f / constSqrt(0.7154f),
+    1.0f / constSqrt(0.0721f)
+};
+
+inline void SquaredDistancesScalar(const float* sample, const float* dict, size_t count, float* out) {
+    for (size_t entry = 0; entry != count; ++entry, dict += width) {
+        float acc = 0.0f;
+        for (size_t elem = 0; elem != width; ++elem) {
+            const float diff = sample[elem] - dict[elem];
+            acc += diff * diff;
+        }
+        out[entry] = acc;
+    }
+}
+
+inline void SquaredDistancesI16Scalar(const int16_t* sample, const int16_t* dict,
+                                     size_t count, int32_t* out) {
+    for (size_t entry = 0; entry != count; ++entry, dict += width) {
+        int32_t acc = 0;
+        for (size_t elem = 0; elem != width; ++elem) {
+            const int32_t diff = int32_t(sample[elem]) - dict[elem];
+            acc += diff * diff;
+        }
+        out[entry] = acc;
+    }
+}
+
+inline void RGBMeansScalar(const float* blocks, size_t count, float* means) {
+    for (size_t idx = 0; idx != count; ++idx, blocks += width, means += 3) {
+        float acc[3] = {0.0f, 0.0f, 0.0f};
+        for (size_t elem = 0; elem != width; ++elem) {
+            acc[elem % 3] += blocks[elem];
+        }
+        for (size_t ch = 0; ch != 3; ++ch) {
+            means[ch] = acc[ch] * (3.0f / width);
+        }
+    }
+}
+
+inline void SubtractMeansScalar(const float* blocks, const float* means, size_t count, float* out) {
+    for (size_t idx = 0; idx != count; ++idx, blocks += width, means += 3, out += width) {
+        const float mean[3] = {means[0], means[1], means[2]};
+        for (size_t elem = 0; elem != width; ++elem) {
+            out[elem] = blocks[elem] - mean[elem % 3];
+        }
+    }
+}
+
+inline void BlocksToRGB8Scalar(const float* blocks, size_t count, uint8_t* out, size_t stride) {
+    for (size_t idx = 0; idx != count; ++idx, blocks += width) {
+        for (size_t y = 0; y != 4; ++y) {
+            uint8_t* row = out + y * stride + idx * 12;
+            for (size_t sample = 0; sample != 12; ++sample) {
+                row[sample] = uint8_t(std::round(std::clamp(
+                    blocks[y * 12 + sample] * invWeights[sample % 3], 0.f, 255.f)));
+            }
+        }
+    }
+}
+
+#if defined(IV1_KERNELS_X86)
+
+inline float HorizontalSum(__m128 v) {
+    const __m128 pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+}
+
+// Reduces 12 floats, 4 RGB pixels, to one RGB sum.
+inline void SumPixels(__m128 a, __m128 b, __m128 c, float* means) {
+    alignas(16) float lanes[12];
+    _mm_store_ps(lanes, a);
+    _mm_store_ps(lanes + 4, b);
+    _mm_store_ps(lanes + 8, c);
+    for (size_t ch = 0; ch != 3; ++ch) {
+        means[ch] = ((lanes[ch] + lanes[ch + 3]) + (lanes[ch + 6] + lanes[ch + 9])) * (3.0f / width);
+    }
+}
+
+// Rounds (half away from zero, like std::round on the clamped value) and
+//  packs 12 floats already clamped to [0, 255] into 12 bytes.
+inline void Store12(__m128 a, __m128 b, __m128 c, uint8_t* out) {
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128i lo = _mm_packs_epi32(
+        _mm_cvttps_epi32(_mm_add_ps(a, half)), _mm_cvttps_epi32(_mm_add_ps(b, half)));
+    const __m128i hi = _mm_packs_epi32(_mm_cvttps_epi32(_mm_add_ps(c, half)), _mm_setzero_si128());
+    alignas(16) uint8_t bytes[16];
+    _mm_store_si128(reinterpret_cast<__m128i*>(bytes), _mm_packus_epi16(lo, hi));
+    memcpy(out, bytes, 12);
+}
+
+inline void SquaredDistancesSSE2(const float* sample, const float* dict, size_t count, float* out) {
+    __m128 s[12];
+    for (size_t lane = 0; lane != 12; ++lane) {
+        s[lane] = _mm_loadu_ps(sample + 4 * lane);
+    }
+    // Four codewords at a time, so one transpose replaces four
+    //  horizontal sums.
+    size_t entry = 0;
+    for (; entry + 4 <= count; entry += 4, dict += 4 * width) {
+        __m128 acc[4];
+        for (size_t k = 0; k != 4; ++k) {
+            acc[k] = _mm_setzero_ps();
+            for (size_t lane = 0; lane != 12; ++lane) {
+                const __m128 d = _mm_sub_ps(s[lane], _mm_loadu_ps(dict + k * width + 4 * lane));
+                acc[k] = _mm_add_ps(acc[k], _mm_mul_ps(d, d));
+            }
+        }
+        _MM_TRANSPOSE4_PS(acc[0], acc[1], acc[2], acc[3]);
+        _mm_storeu_ps(out + entry,
+            _mm_add_ps(_mm_add_ps(acc[0], acc[1]), _mm_add_ps(acc[2], acc[3])));
+    }
+    for (; entry != count; ++entry, dict += width) {
+        __m128 acc = _mm_setzero_ps();
+        for (size_t lane = 0; lane != 12; ++lane) {
+            const __m128 d = _mm_sub_ps(s[lane], _mm_loadu_ps(dict + 4 * lane));
+            acc = _mm_add_ps(acc, _mm_mul_ps(d, d));
+        }
+        out[entry] = HorizontalSum(acc);
+    }
+}
+
+// pmaddwd squares the 16-bit differences and adds them in pairs, so 48
+//  samples take 6 multiply-adds per codeword.
+inline void SquaredDistancesI16SSE2(const int16_t* sample, const int16_t* dict,
+                                   size_t count, int32_t* out) {
+    __m128i s[6];
+    for (size_t lane = 0; lane != 6; ++lane) {
+        s[lane] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sample + 8 * lane));
+    }
+    for (size_t entry = 0; entry != count; ++entry, dict += width) {
+        __m128i acc = _mm_setzero_si128();
+        for (size_t lane = 0; lane != 6; ++lane) {
+            const __m128i d = _mm_sub_epi16(s[lane],
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(dict + 8 * lane)));
+            acc = _mm_add_epi32(acc, _mm_madd_epi16(d, d));
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+        out[entry] = _mm_cvtsi128_si32(acc);
+    }
+}
+
+inline void RGBMeansSSE2(const float* blocks, size_t count, float* means) {
+    for (size_t idx = 0; idx != count; ++idx, blocks += width, means += 3) {
+        // 12 floats are 4 whole pixels, so lanes 12 floats apart hold the
+        //  same channel.
+        __m128 acc[3];
+        for (size_t lane = 0; lane != 3; ++lane) {
+            acc[lane] = _mm_add_ps(
+                _mm_add_ps(_mm_loadu_ps(blocks + 4 * lane), _mm_loadu_ps(blocks + 12 + 4 * lane)),
+                _mm_add_ps(_mm_loadu_ps(blocks + 24 + 4 * lane), _mm_loadu_ps(blocks + 36 + 4 * lane)));
+        }
+        SumPixels(acc[0], acc[1], acc[2], means);
+    }
+}
+
+inline void SubtractMeansSSE2(const float* blocks, const float* means, size_t count, float* out) {
+    for (size_t idx = 0; idx != count; ++idx, blocks += width, means += 3, out += width) {
+        const float r = means[0], g = means[1], b = means[2];
+        const __m128 pattern[3] = {
+            _mm_setr_ps(r, g, b, r), _mm_setr_ps(g, b, r, g), _mm_setr_ps(b, r, g, b)
+        };
+        for (size_t lane = 0; lane != 12; ++lane) {
+            _mm_storeu_ps(out + 4 * lane,
+                _mm_sub_ps(_mm_loadu_ps(blocks + 4 * lane), pattern[lane % 3]));
+        }
+    }
+}
+
+inline void BlocksToRGB8SSE2(const float* blocks, size_t count, uint8_t* out, size_t stride) {
+    const __m128 weights[3] = {
+        _mm_setr_ps(invWeights[0], invWeights[1], invWeights[2], invWeights[0]),
+        _mm_setr_ps(invWeights[1], invWeights[2], invWeights[0], invWeights[1]),
+        _mm_setr_ps(invWeights[2], invWeights[0], invWeights[1], invWeights[2])
+    };
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 maxValue = _mm_set1_ps(255.0f);
+    for (size_t idx = 0; idx != count; ++idx, blocks += width) {
+        for (size_t y = 0; y != 4; ++y) {
+            __m128 v[3];
+            for (size_t lane = 0; lane != 3; ++lane) {
+                v[lane] = _mm_min_ps(_mm_max_ps(_mm_mul_ps(
+                    _mm_loadu_ps(blocks + y * 12 + 4 * lane), weights[lane]), zero), maxValue);
+            }
+            Store12(v[0], v[1], v[2], out + y * stride + idx * 12);
+        }
+    }
+}
+
+// Horizontal sums of four vectors at once.
+IV1_TARGET_AVX2
+inline __m128 HorizontalSum4(__m256 a, __m256 b, __m256 c, __m256 d) {
+    const __m256 sums = _mm256_hadd_ps(_mm256_hadd_ps(a, b), _mm256_hadd_ps(c, d));
+    return _mm_add_ps(_mm256_castps256_ps128(sums), _mm256_extractf128_ps(sums, 1));
+}
+
+IV1_TARGET_AVX2
+inline void SquaredDistancesAVX2(const float* sample, const float* dict, size_t count, float* out) {
+    __m256 s[6];
+    for (size_t lane = 0; lane != 6; ++lane) {
+        s[lane] = _mm256_loadu_ps(sample + 8 * lane);
+    }
+    size_t entry = 0;
+    for (; entry + 4 <= count; entry += 4, dict += 4 * width) {
+        __m256 acc[4];
+        for (size_t k = 0; k != 4; ++k) {
+            acc[k] = _mm256_setzero_ps();
+            for (size_t lane = 0; lane != 6; ++lane) {
+                const __m256 d = _mm256_sub_ps(s[lane], _mm256_loadu_ps(dict + k * width + 8 * lane));
+                acc[k] = _mm256_fmadd_ps(d, d, acc[k]);
+            }
+        }
+        _mm_storeu_ps(out + entry, HorizontalSum4(acc[0], acc[1], acc[2], acc[3]));
+    }
+    for (; entry != count; ++entry, dict += width) {
+        __m256 acc = _mm256_setzero_ps();
+        for (size_t lane = 0; lane != 6; ++lane) {
+            const __m256 d = _mm256_sub_ps(s[lane], _mm256_loadu_ps(dict + 8 * lane));
+            acc = _mm256_fmadd_ps(d, d, acc);
+        }
+        out[entry] = HorizontalSum(_mm_add_ps(
+            _mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1)));
+    }
+}
+
+IV1_TARGET_AVX2
+inline void SquaredDistancesI16AVX2(const int16_t* sample, const int16_t* dict,
+                                   size_t count, int32_t* out) {
+    __m256i s[3];
+    for (size_t lane = 0; lane != 3; ++lane) {
+        s[lane] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(sample + 16 * lane));
+    }
+    size_t entry = 0;
+    for (; entry + 4 <= count; entry += 4, dict += 4 * width) {
+        __m256i acc[4];
+        for (size_t k = 0; k != 4; ++k) {
+            acc[k] = _mm256_setzero_si256();
+            for (size_t lane = 0; lane != 3; ++lane) {
+                const __m256i d = _mm256_sub_epi16(s[lane], _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(dict + k * width + 16 * lane)));
+                acc[k] = _mm256_add_epi32(acc[k], _mm256_madd_epi16(d, d));
+            }
+        }
+        const __m256i sums = _mm256_hadd_epi32(
+            _mm256_hadd_epi32(acc[0], acc[1]), _mm256_hadd_epi32(acc[2], acc[3]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + entry), _mm_add_epi32(
+            _mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1)));
+    }
+    for (; entry != count; ++entry, dict += width) {
+        __m256i acc = _mm256_setzero_si256();
+        for (size_t lane = 0; lane != 3; ++lane) {
+            const __m256i d = _mm256_sub_epi16(s[lane],
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dict + 16 * lane)));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(d, d));
+        }
+        __m128i half = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+        out[entry] = _mm_cvtsi128_si32(half);
+    }
+}
+
+IV1_TARGET_AVX2
+inline void RGBMeansAVX2(const float* blocks, size_t count, float* means) {
+    for (size_t idx = 0; idx != count; ++idx, blocks += width, means += 3) {
+        // Halves of the block (24 floats, 8 whole pixels) line up by channel,
+        //  and so do the 128-bit quarters of what's left.
+        __m256 half[3];
+        for (size_t lane = 0; lane != 3; ++lane) {
+            half[lane] = _mm256_add_ps(
+                _mm256_loadu_ps(blocks + 8 * lane), _mm256_loadu_ps(blocks + 24 + 8 * lane));
+        }
+        SumPixels(
+            _mm_add_ps(_mm256_castps256_ps128(half[0]), _mm256_extractf128_ps(half[1], 1)),
+            _mm_add_ps(_mm256_extractf128_ps(half[0], 1), _mm256_castps256_ps128(half[2])),
+            _mm_add_ps(_mm256_castps256_ps128(half[1]), _mm256_extractf128_ps(half[2], 1)),
+            means);
+    }
+}
+
+IV1_TARGET_AVX2
+inline void SubtractMeansAVX2(const float* blocks, const float* means, size_t count, float* out) {
+    for (size_t idx = 0; idx != count; ++idx, blocks += width, means += 3, out += width) {
+        const float r = means[0], g = means[1], b = means[2];
+        const __m256 pattern[3] = {
+            _mm256_setr_ps(r, g, b, r, g, b, r, g),
+            _mm256_setr_ps(b, r, g, b, r, g, b, r),
+            _mm256_setr_ps(g, b, r, g, b, r, g, b)
+        };
+        for (size_t lane = 0; lane != 6; ++lane) {
+            _mm256_storeu_ps(out + 8 * lane,
+                _mm256_sub_ps(_mm256_loadu_ps(blocks + 8 * lane), pattern[lane % 3]));
+        }
+    }
+}
+
+IV1_TARGET_AVX2
+inline void BlocksToRGB8AVX2(const float* blocks, size_t count, uint8_t* out, size_t stride) {
+    // Two tile rows (24 floats) at a time; the weights repeat every 24.
+    const __m256 weights[3] = {
+        _mm256_setr_ps(invWeights[0], invWeights[1], invWeights[2], invWeights[0],
+                       invWeights[1], invWeights[2], invWeights[0], invWeights[1]),
+        _mm256_setr_ps(invWeights[2], invWeights[0], invWeights[1], invWeights[2],
+                       invWeights[0], invWeights[1], invWeights[2], invWeights[0]),
+        _mm256_setr_ps(invWeights[1], invWeights[2], invWeights[0], invWeights[1],
+                       invWeights[2], invWeights[0], invWeights[1], invWeights[2])
+    };
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 maxValue = _mm256_set1_ps(255.0f);
+    for (size_t idx = 0; idx != count; ++idx, blocks += width) {
+        for (size_t y = 0; y != 4; y += 2) {
+            __m256 v[3];
+            for (size_t lane = 0; lane != 3; ++lane) {
+                v[lane] = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(
+                    _mm256_loadu_ps(blocks + y * 12 + 8 * lane), weights[lane]), zero), maxValue);
+            }
+            Store12(_mm256_castps256_ps128(v[0]), _mm256_extractf128_ps(v[0], 1),
+                _mm256_castps256_ps128(v[1]), out + y * stride + idx * 12);
+            Store12(_mm256_extractf128_ps(v[1], 1), _mm256_castps256_ps128(v[2]),
+                _mm256_extractf128_ps(v[2], 1), out + (y + 1) * stride + idx * 12);
+        }
+    }
+}
+
+IV1_TARGET_AVX512
+inline void SquaredDistancesAVX512(const float* sample, const float* dict, size_t count, float* out) {
+    const __m512 s0 = _mm512_loadu_ps(sample);
+    const __m512 s1 = _mm512_loadu_ps(sample + 16);
+    const __m512 s2 = _mm512_loadu_ps(sample + 32);
+    size_t entry = 0;
+    for (; entry + 4 <= count; entry += 4, dict += 4 * width) {
+        // Squares of 4 codewords, folded to 8 lanes each for HorizontalSum4.
+        __m256 acc[4];
+        for (size_t k = 0; k != 4; ++k) {
+            const float* codeword = dict + k * width;
+            const __m512 d0 = _mm512_sub_ps(s0, _mm512_loadu_ps(codeword));
+            const __m512 d1 = _mm512_sub_ps(s1, _mm512_loadu_ps(codeword + 16));
+            const __m512 d2 = _mm512_sub_ps(s2, _mm512_loadu_ps(codeword + 32));
+            const __m512 sum = _mm512_fmadd_ps(d2, d2, _mm512_fmadd_ps(d1, d1, _mm512_mul_ps(d0, d0)));
+            acc[k] = _mm256_add_ps(_mm512_castps512_ps256(sum),
+                _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(sum), 1)));
+        }
+        _mm_storeu_ps(out + entry, HorizontalSum4(acc[0], acc[1], acc[2], acc[3]));
+    }
+    for (; entry != count; ++entry, dict += width) {
+        const __m512 d0 = _mm512_sub_ps(s0, _mm512_loadu_ps(dict));
+        const __m512 d1 = _mm512_sub_ps(s1, _mm512_loadu_ps(dict + 16));
+        const __m512 d2 = _mm512_sub_ps(s2, _mm512_loadu_ps(dict + 32));
+        out[entry] = _mm512_reduce_add_ps(
+            _mm512_fmadd_ps(d2, d2, _mm512_fmadd_ps(d1, d1, _mm512_mul_ps(d0, d0))));
+    }
+}
+
+IV1_TARGET_AVX512
+inline void SubtractMeansAVX512(const float* blocks, const float* means, size_t count, float* out) {
+    for (size_t idx = 0; idx != count; ++idx, blocks += width, means += 3, out += width) {
+        const float r = means[0], g = means[1], b = means[2];
+        const __m512 p0 = _mm512_setr_ps(r, g, b, r, g, b, r, g, b, r, g, b, r, g, b, r);
+        const __m512 p1 = _mm512_setr_ps(g, b, r, g, b, r, g, b, r, g, b, r, g, b, r, g);
+        const __m512 p2 = _mm512_setr_ps(b, r, g, b, r, g, b, r, g, b, r, g, b, r, g, b);
+        _mm512_storeu_ps(out, _mm512_sub_ps(_mm512_loadu_ps(blocks), p0));
+        _mm512_storeu_ps(out + 16, _mm512_sub_ps(_mm512_loadu_ps(blocks + 16), p1));
+        _mm512_storeu_ps(out + 32, _mm512_sub_ps(_mm512_loadu_ps(blocks + 32), p2));
+    }
+}
+
+#endif
+
+} // namespace KernelImpl
+
+// The kernel table for `isa`. Means and RGB8 conversion end in 128-bit
+//  reductions and stores either way, so AVX-512 shares AVX2's for those.
+//  So does the 16-bit distance: 48 samples don't fill 512-bit registers
+//  evenly, and 512-bit pmaddwd needs AVX-512BW on top of AVX-512F.
+inline const Kernels& KernelsFor(ISA isa) {
+    using namespace KernelImpl;
+    static const Kernels scalar = {ISA::Scalar,
+        SquaredDistancesScalar, SquaredDistancesI16Scalar, RGBMeansScalar, SubtractMeansScalar, BlocksToRGB8Scalar};
+#if defined(IV1_KERNELS_X86)
+    static const Kernels sse2 = {ISA::SSE2,
+        SquaredDistancesSSE2, SquaredDistancesI16SSE2, RGBMeansSSE2, SubtractMeansSSE2, BlocksToRGB8SSE2};
+    static const Kernels avx2 = {ISA::AVX2,
+        SquaredDistancesAVX2, SquaredDistancesI16AVX2, RGBMeansAVX2, SubtractMeansAVX2, BlocksToRGB8AVX2};
+    static const Kernels avx512 = {ISA::AVX512,
+        SquaredDistancesAVX512, SquaredDistancesI16AVX2, RGBMeansAVX2, SubtractMeansAVX512, BlocksToRGB8AVX2};
+    switch (isa) {
+    case ISA::SSE2: return sse2;
+    case ISA::AVX2: return avx2;
+    case ISA::AVX512: return avx512;
+    default: break;
+    }
+#endif
+    return scalar;
+}
+
+inline const Kernels*& KernelSelection() {
+    static const Kernels* selected = &KernelsFor(DetectISA());
+    return selected;
+}
+
+// The kernels in use. Chosen once at startup; not meant to change while
+//  other threads are running them.
+inline const Kernels& ActiveKernels() {
+    return *KernelSelection();
+}
+
+// Forces an instruction set by name ("scalar", "sse2", "avx2", "avx512",
+//  or "auto" for the detected one). Returns false for unknown names and
+//  for instruction sets this CPU lacks.
+inline bool SetISA(const char* name) {
+    const ISA detected = DetectISA();
+    if (strcmp(name, "auto") == 0) {
+        KernelSelection() = &KernelsFor(detected);
+        return true;
+    }
+    for (const ISA isa : {ISA::Scalar, ISA::SSE2, ISA::AVX2, ISA::AVX512}) {
+        if (strcmp(name, ISAName(isa)) == 0) {
+            if (isa > detected) {
+                return false;
+            }
+            KernelSelection() = &KernelsFor(isa);
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace IV1
@@ -0,0 +1,391 @@
+// libiv1: the C++ interface of IV1Library.h over the codec's headers, and
+//  the C interface of libiv1.h over that.
+
+#include "IV1Library.h"
+
+#include "IV1BlockImage.h"
+#include "IV1Encode.h"
+#include "IV1FastDecode.h"
+#include "IV1File.h"
+#include "IV1Stats.h"
+#include "IV1ThreadPool.h"
+#include "IV1Tiled.h"
+
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace IV1 {
+
+static bool IsTiledIV1(const uint8_t* data, size_t size) {
+    return size >= sizeof(IV1TiledMagic) && memcmp(data, IV1TiledMagic, sizeof(IV1TiledMagic)) == 0;
+}
+
+struct Encoder::State {
+    explicit State(const iv1_encode_options& options)
+    : tileSize(options.tile_size),
+      nThreads(options.threads != 0 ? options.threads : std::thread::hardware_concurrency()),
+      pool(nThreads) {
+        this->options.maxIterations = options.max_iterations;
+        this->options.minRelativeImprovement = options.min_relative_improvement;
+        this->options.timeBudgetSeconds = options.time_budget_seconds;
+        this->options.residualTrainingBlocks = options.residual_training_blocks;
+        this->options.compactTraining = options.compact_training != 0;
+        this->options.histogramPalette = options.histogram_palette != 0;
+        this->options.seeding = options.seeding >= IV1_SEEDING_SPREAD && options.seeding <= IV1_SEEDING_PCA ?
+            VQSeeding(options.seeding) : VQSeeding::Spread;
+        this->options.codedIndices = options.coded_indices != 0;
+        encoded.codedIndices = this->options.codedIndices;
+    }
+
+    EncodeOptions options;
+    size_t tileSize;
+    size_t nThreads;
+    ThreadPool pool;
+    EncodeScratch scratch;
+    EncodedImage encoded;
+    std::unique_ptr<SharedDictionaries> shared;
+    // Compact training needs the image whole; everything else, tiles
+    //  included, reads the caller's pixels in place.
+    VQLib::Support::RGB8Image image;
+    // Coded index planes are serialized here first, as only then is their
+    //  size known.
+    std::vector<uint8_t> bytes;
+    const char* error = nullptr;
+};
+
+static iv1_encode_options DefaultEncodeOptions() {
+    iv1_encode_options options;
+    iv1_encode_options_preset(&options, "default");
+    return options;
+}
+
+Encoder::Encoder(const iv1_encode_options* options)
+: state(std::make_unique<State>(options ? *options : DefaultEncodeOptions())) {}
+
+Encoder::~Encoder() = default;
+
+iv1_status Encoder::setPack(const uint8_t* pack, size_t size) {
+    state->error = nullptr;
+    if (!pack) {
+        state->shared.reset();
+        return IV1_OK;
+    }
+    IV1DictionaryPack dictionaries;
+    if ((state->error = ParseIV1Pack(pack, size, dictionaries))) {
+        return IV1_ERROR_INVALID_ARGUMENT;
+    }
+    state->shared = std::make_unique<SharedDictionaries>(dictionaries);
+    return IV1_OK;
+}
+
+size_t Encoder::encodedSize(size_t width, size_t height) const {
+    // Stream sizes for pack streams don't depend on which pack it is.
+    const IV1ExtendedHeader header = {
+        (state->shared ? IV1FlagExternalDictionaries : 0) |
+        (state->options.codedIndices ? IV1FlagCodedIndices : 0), 0};
+    const auto* extended = header.flags != 0 ? &header : nullptr;
+    if (state->tileSize != 0) {
+        return IV1TiledStreamSize(MakeIV1TiledHeader(width, height, state->tileSize), extended);
+    }
+    return IV1StreamSize((width + 3) / 4, (height + 3) / 4, extended);
+}
+
+iv1_status Encoder::encode(const uint8_t* pixels, size_t width, size_t height, size_t stride,
+                           uint8_t* out, size_t capacity, size_t& written, Stats* stats) {
+    constexpr size_t blockW = 4;
+    constexpr size_t blockH = 4;
+    auto& s = *state;
+    Stats localStats;
+    auto& timings = stats ? *stats : localStats;
+    s.error = nullptr;
+
+    if (!pixels || width == 0 || height == 0 || stride < width * 3) {
+        s.error = "no pixels, or a stride shorter than a row";
+        return IV1_ERROR_INVALID_ARGUMENT;
+    }
+    if (s.tileSize == 0 && (width > IV1MaxTileSize || height > IV1MaxTileSize)) {
+        s.error = "image too large for a single stream; set tile_size";
+        return IV1_ERROR_INVALID_ARGUMENT;
+    }
+    written = encodedSize(width, height);
+    if (capacity < written || !out) {
+        s.error = "output buffer too small";
+        return IV1_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    if (s.tileSize != 0) {
+        // Only as large as the stream, and not kept past this call, so a
+        //  large image isn't held a second time.
+        std::vector<uint8_t> bytes;
+        EncodeTiledImage(pixels, width, height, stride, s.tileSize, s.nThreads, s.options,
+            s.shared.get(), bytes, &timings);
+        memcpy(out, bytes.data(), bytes.size());
+        written = bytes.size();
+        return IV1_OK;
+    }
+    if (s.options.compactTraining && !s.shared) {
+        s.image.width = width;
+        s.image.height = height;
+        s.image.pixels.resize(width * height * 3);
+        for (size_t y = 0; y != height; ++y) {
+            memcpy(&s.image.pixels[y * width * 3], pixels + y * stride, width * 3);
+        }
+        EncodeImage(s.image, s.encoded, s.scratch, s.pool, s.options, &timings);
+    }
+    else {
+        const auto trainOptions = MakeTrainOptions(s.options);
+        SetEncodedSize(s.encoded, width, height);
+        timings.time("blocking", [&] {
+            FillBlocksAndMeans<blockW, blockH>(pixels, width, height, stride,
+                s.scratch.blocks, s.scratch.blockMeans);
+        });
+        if (s.shared) {
+            EncodeBlockedImageWithPack(s.encoded, s.scratch, s.pool, *s.shared, timings);
+        }
+        else {
+            EncodeBlockedImage(nullptr, s.encoded, s.scratch, s.pool, s.options,
+                trainOptions, timings);
+        }
+    }
+
+    if (s.encoded.codedIndices) {
+        s.bytes.clear();
+        s.encoded.serialize(s.bytes);
+        memcpy(out, s.bytes.data(), s.bytes.size());
+        written = s.bytes.size();
+    }
+    else {
+        s.encoded.serialize(out);
+    }
+    return IV1_OK;
+}
+
+const char* Encoder::errorMessage() const {
+    return state->error;
+}
+
+struct Decoder::State {
+    explicit State(size_t threads)
+    : pool(threads != 0 ? threads : std::thread::hardware_concurrency()) {}
+
+    ThreadPool pool;
+    std::unique_ptr<IV1DictionaryPack> pack;
+    const char* error = nullptr;
+};
+
+Decoder::Decoder(const iv1_decode_options* options)
+: state(std::make_unique<State>(options ? options->threads : 0)) {}
+
+Decoder::~Decoder() = default;
+
+iv1_status Decoder::setPack(const uint8_t* pack, size_t size) {
+    state->error = nullptr;
+    if (!pack) {
+        state->pack.reset();
+        return IV1_OK;
+    }
+    auto dictionaries = std::make_unique<IV1DictionaryPack>();
+    if ((state->error = ParseIV1Pack(pack, size, *dictionaries))) {
+        return IV1_ERROR_INVALID_ARGUMENT;
+    }
+    state->pack = std::move(dictionaries);
+    return IV1_OK;
+}
+
+iv1_status Decoder::info(const uint8_t* data, size_t size, size_t& width, size_t& height) {
+    state->error = nullptr;
+    if (!data) {
+        state->error = "no stream";
+        return IV1_ERROR_INVALID_ARGUMENT;
+    }
+    if (IsTiledIV1(data, size) && size >= sizeof(IV1TiledHeader)) {
+        IV1TiledHeader header;
+        memcpy(&header, data, sizeof(header));
+        width = header.width;
+        height = header.height;
+        return IV1_OK;
+    }
+
+    IV1FileHeader header;
+    if (size < sizeof(header)) {
+        state->error = "truncated stream";
+        return IV1_ERROR_INVALID_STREAM;
+    }
+    memcpy(&header, data, sizeof(header));
+    if (!IsExtendedIV1(header) && memcmp(header.magic, IV1FileHeader().magic, sizeof(header.magic)) != 0) {
+        state->error = "not an IV1 stream (bad magic)";
+        return IV1_ERROR_INVALID_STREAM;
+    }
+    width = header.actualW;
+    height = header.actualH;
+    return IV1_OK;
+}
+
+iv1_status Decoder::decode(const uint8_t* data, size_t size, uint8_t* pixels, size_t stride) {
+    auto& s = *state;
+    size_t width, height;
+    if (const auto status = info(data, size, width, height)) {
+        return status;
+    }
+    if (!pixels || stride < width * 3) {
+        s.error = "no pixels, or a stride shorter than a row";
+        return IV1_ERROR_INVALID_ARGUMENT;
+    }
+
+    if (IsTiledIV1(data, size)) {
+        const IV1TiledView view(data, size, s.pack.get());
+        s.error = view.errorMessage();
+        if (!s.error) {
+            s.error = DecodeTiledRGB8(view, s.pool, pixels, stride);
+        }
+        return s.error ? IV1_ERROR_INVALID_STREAM : IV1_OK;
+    }
+
+    IV1Planes planes;
+    if ((s.error = ParseIV1Stream(data, size, planes, s.pack.get()))) {
+        return IV1_ERROR_INVALID_STREAM;
+    }
+    DecodeRGB8(planes, pixels, stride, s.pool);
+    return IV1_OK;
+}
+
+const char* Decoder::errorMessage() const {
+    return state->error;
+}
+
+} // namespace IV1
+
+// The C interface: opaque handles around the C++ contexts. Nothing is
+//  thrown past it; running out of memory (or threads) is a status.
+
+struct iv1_encoder {
+    explicit iv1_encoder(const iv1_encode_options* options) : encoder(options) {}
+    IV1::Encoder encoder;
+};
+
+struct iv1_decoder {
+    explicit iv1_decoder(const iv1_decode_options* options) : decoder(options) {}
+    IV1::Decoder decoder;
+};
+
+int iv1_encode_options_preset(iv1_encode_options* options, const char* preset) {
+    IV1::EncodeOptions encodeOptions;
+    if (!options || !IV1::EncodePreset(preset ? preset : "default", encodeOptions)) {
+        return 0;
+    }
+    *options = IV1::LibraryEncodeOptions(encodeOptions);
+    return 1;
+}
+
+iv1_encoder* iv1_encoder_create(const iv1_encode_options* options) {
+    try {
+        return new iv1_encoder(options);
+    }
+    catch (const std::exception&) {
+        return nullptr;
+    }
+}
+
+void iv1_encoder_destroy(iv1_encoder* encoder) {
+    delete encoder;
+}
+
+iv1_status iv1_encoder_set_pack(iv1_encoder* encoder, const uint8_t* pack, size_t size) {
+    if (!encoder) {
+        return IV1_ERROR_INVALID_ARGUMENT;
+    }
+    try {
+        return encoder->encoder.setPack(pack, size);
+    }
+    catch (const std::exception&) {
+        return IV1_ERROR_OUT_OF_MEMORY;
+    }
+}
+
+size_t iv1_encoded_size(const iv1_encoder* encoder, size_t width, size_t height) {
+    return encoder ? encoder->encoder.encodedSize(width, height) : 0;
+}
+
+iv1_status iv1_encode(iv1_encoder* encoder, const uint8_t* pixels,
+                      size_t width, size_t height, size_t stride,
+                      uint8_t* out, size_t capacity, size_t* written) {
+    if (!encoder) {
+        return IV1_ERROR_INVALID_ARGUMENT;
+    }
+    try {
+        size_t size = 0;
+        const auto status = encoder->encoder.encode(pixels, width, height, stride, out, capacity, size);
+        if (written) {
+            *written = size;
+        }
+        return status;
+    }
+    catch (const std::exception&) {
+        return IV1_ERROR_OUT_OF_MEMORY;
+    }
+}
+
+const char* iv1_encoder_error(const iv1_encoder* encoder) {
+    return encoder ? encoder->encoder.errorMessage() : "no encoder";
+}
+
+iv1_decoder* iv1_decoder_create(const iv1_decode_options* options) {
+    try {
+        return new iv1_decoder(options);
+    }
+    catch (const std::exception&) {
+        return nullptr;
+    }
+}
+
+void iv1_decoder_destroy(iv1_decoder* decoder) {
+    delete decoder;
+}
+
+iv1_status iv1_decoder_set_pack(iv1_decoder* decoder, const uint8_t* pack, size_t size) {
+    if (!decoder) {
+        return IV1_ERROR_INVALID_ARGUMENT;
+    }
+    try {
+        return decoder->decoder.setPack(pack, size);
+    }
+    catch (const std::exception&) {
+        return IV1_ERROR_OUT_OF_MEMORY;
+    }
+}
+
+iv1_status iv1_decode_info(iv1_decoder* decoder, const uint8_t* data, size_t size,
+                           size_t* width, size_t* height) {
+    size_t w = 0, h = 0;
+    if (!decoder) {
+        return IV1_ERROR_INVALID_ARGUMENT;
+    }
+    const auto status = decoder->decoder.info(data, size, w, h);
+    if (width) {
+        *width = w;
+    }
+    if (height) {
+        *height = h;
+    }
+    return status;
+}
+
+iv1_status iv1_decode(iv1_decoder* decoder, const uint8_t* data, size_t size,
+                      uint8_t* pixels, size_t stride) {
+    if (!decoder) {
+        return IV1_ERROR_INVALID_ARGUMENT;
+    }
+    try {
+        return decoder->decoder.decode(data, size, pixels, stride);
+    }
+    catch (const std::exception&) {
+        return IV1_ERROR_OUT_OF_MEMORY;
+    }
+}
+
+const char* iv1_decoder_error(const iv1_decoder* decoder) {
+    return decoder ? decoder->decoder.errorMessage() : "no decoder";
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "libiv1.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace IV1 {
+
+class Stats;
+
+// C++ interface to libiv1, over the same contexts as the C one in
+//  libiv1.h; see there for what the arguments mean. Only this header and
+//  libiv1.h are needed to use the library, not the codec's own headers.
+class IV1_API Encoder {
+public:
+    // Default preset without `options`.
+    explicit Encoder(const iv1_encode_options* options = nullptr);
+    ~Encoder();
+
+    Encoder(const Encoder&) = delete;
+    Encoder& operator=(const Encoder&) = delete;
+
+    iv1_status setPack(const uint8_t* pack, size_t size);
+    size_t encodedSize(size_t width, size_t height) const;
+    // With `stats` (see IV1Stats.h; C++ only), the stage times and the
+    //  iterations and final distortion of both trainings are added to it,
+    //  as EncodeImage reports them.
+    iv1_status encode(const uint8_t* pixels, size_t width, size_t height, size_t stride,
+                      uint8_t* out, size_t capacity, size_t& written, Stats* stats = nullptr);
+    const char* errorMessage() const;
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+class IV1_API Decoder {
+public:
+    // Every core without `options`.
+    explicit Decoder(const iv1_decode_options* options = nullptr);
+    ~Decoder();
+
+    Decoder(const Decoder&) = delete;
+    Decoder& operator=(const Decoder&) = delete;
+
+    iv1_status setPack(const uint8_t* pack, size_t size);
+    iv1_status info(const uint8_t* data, size_t size, size_t& width, size_t& height);
+    iv1_status decode(const uint8_t* data, size_t size, uint8_t* pixels, size_t stride);
+    const char* errorMessage() const;
+
+private:
+    struct State;
+    std::unique_ptr<State> state;
+};
+
+} // namespace IV1
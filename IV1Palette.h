@@ -0,0 +1,395 @@
+#pragma once
+
+#include "VQLib/C++/VQDataTypes.h"
+
+#include "IV1VQ.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace IV1 {
+
+// Nearest-entry search for 3-wide dictionaries: the entries are kept in
+//  order along the axis they spread the most over, and a search walks
+//  outward from where the point falls along it, stopping on each side once
+//  that axis alone puts every entry further out beyond the best distance
+//  found. Starting from a good guess, a search looks at a handful of
+//  entries instead of all of them. Ties go to the lowest index, as in
+//  NearestCodeword.
+class SortedPalette {
+public:
+    void build(const FlexMatrix<float, 3>& dict) {
+        double sum[3] = {0.0, 0.0, 0.0}, squares[3] = {0.0, 0.0, 0.0};
+        for (const auto& entry : dict) {
+            for (size_t ch = 0; ch != 3; ++ch) {
+                sum[ch] += entry[ch];
+                squares[ch] += double(entry[ch]) * entry[ch];
+            }
+        }
+        axis = 0;
+        for (size_t ch = 1; ch != 3; ++ch) {
+            if (squares[ch] - sum[ch] * sum[ch] / dict.size() >
+                squares[axis] - sum[axis] * sum[axis] / dict.size()) {
+                axis = ch;
+            }
+        }
+        entries.resize(dict.size());
+        for (size_t entry = 0; entry != dict.size(); ++entry) {
+            entries[entry] = {dict[entry][axis], uint16_t(entry)};
+        }
+        std::sort(entries.begin(), entries.end());
+    }
+
+    // Nearest entry of `dict` (the one last built from) to `point`, with
+    //  its squared distance in `bestDistance`. `guess` only bounds the
+    //  search.
+    uint16_t nearest(const float* point, const FlexMatrix<float, 3>& dict, uint16_t guess,
+                     float& bestDistance) const {
+        uint16_t best = guess;
+        bestDistance = distance(point, dict[guess]);
+        const auto start = std::lower_bound(entries.begin(), entries.end(),
+            std::make_pair(point[axis], uint16_t(0)));
+        auto consider = [&](const std::pair<float, uint16_t>& entry) {
+            const float gap = entry.first - point[axis];
+            if (gap * gap > bestDistance) {
+                return false;
+            }
+            const float d = distance(point, dict[entry.second]);
+            if (d < bestDistance || (d == bestDistance && entry.second < best)) {
+                bestDistance = d;
+                best = entry.second;
+            }
+            return true;
+        };
+        for (auto it = start; it != entries.end() && consider(*it); ++it) {}
+        for (auto it = start; it != entries.begin() && consider(*(it - 1)); --it) {}
+        return best;
+    }
+
+private:
+    static float distance(const float* point, const MatrixRow<float, 3>& entry) {
+        float acc = 0.0f;
+        for (size_t ch = 0; ch != 3; ++ch) {
+            const float diff = point[ch] - entry[ch];
+            acc += diff * diff;
+        }
+        return acc;
+    }
+
+    size_t axis = 0;
+    std::vector<std::pair<float, uint16_t>> entries;
+};
+
+// Intermediate buffers of HistogramPalette, reusable between calls.
+struct PaletteScratch {
+    // An occupied cell of the color histogram: how many samples fell in
+    //  it and their sum, so its centroid is exact rather than the cell's
+    //  center.
+    struct Bin {
+        double sum[3];
+        uint32_t count;
+    };
+
+    std::vector<uint32_t> slots;        // histogram cell -> bin + 1, 0 if empty
+    std::vector<uint32_t> sampleBins;   // sample -> bin
+    std::vector<Bin> bins;
+    std::vector<uint32_t> order;        // bins, sorted box by box by the median cut
+    std::vector<uint16_t> binEntries;   // bin -> nearest dictionary entry
+    SortedPalette sorted;
+};
+
+// Width of a histogram cell, in the units of the (weighted) block means.
+//  Narrower cells barely change the palette but make for many more bins
+//  to refine; the final assignment is exact whatever the width.
+constexpr float PaletteHistogramStep = 4.0f;
+
+// Same contract as VQGenerateDictParallel for the 3-wide block means, at a
+//  fraction of the cost. The samples are binned into a 3-D histogram in a
+//  single pass, and everything after that only looks at the occupied
+//  bins, of which there are at most a few hundred thousand whatever the
+//  image size:
+//   - the bins are split into `dictSize` boxes by variance-based median
+//     cut: the box with the largest squared error is cut, across its
+//     widest axis, where the two halves come out with the least error
+//     (Wu's criterion);
+//   - k-means then refines the box centroids over the bins, each weighted
+//     by its sample count, for as long as `options` allows;
+//   - every sample then takes its nearest entry, with its bin's entry (a
+//     table lookup) as the starting guess of a SortedPalette search.
+//
+// Training starts from `seed` if given (it must hold `dictSize` entries)
+//  instead of from the median cut. Empty cells are re-seeded from the bins
+//  that contribute the most error. With fewer distinct bins than entries,
+//  the leftover entries repeat the first one and go unused.
+template <typename Index>
+std::pair<FlexMatrix<float, 3>, std::vector<Index>> HistogramPalette(
+    const FlexMatrix<float, 3>& data, size_t dictSize, const VQTrainOptions& options,
+    PaletteScratch* scratch = nullptr, VQStats* stats = nullptr,
+    const FlexMatrix<float, 3>* seed = nullptr) {
+    using Bin = PaletteScratch::Bin;
+
+    const size_t dataSize = data.size();
+    FlexMatrix<float, 3> dict(dictSize);
+    std::vector<Index> indices(dataSize);
+    if (dataSize == 0 || dictSize == 0) {
+        return {dict, indices};
+    }
+
+    PaletteScratch localScratch;
+    auto& buffers = scratch ? *scratch : localScratch;
+
+    // Cells span the range of the samples, coarser if that would make for
+    //  an unreasonably large table.
+    float lower[3], upper[3];
+    for (size_t ch = 0; ch != 3; ++ch) {
+        lower[ch] = upper[ch] = data[0][ch];
+    }
+    for (const auto& sample : data) {
+        for (size_t ch = 0; ch != 3; ++ch) {
+            lower[ch] = std::min(lower[ch], sample[ch]);
+            upper[ch] = std::max(upper[ch], sample[ch]);
+        }
+    }
+    float step = PaletteHistogramStep;
+    size_t cells[3];
+    for (;; step *= 2.0f) {
+        for (size_t ch = 0; ch != 3; ++ch) {
+            cells[ch] = size_t((upper[ch] - lower[ch]) / step) + 1;
+        }
+        if (cells[0] * cells[1] * cells[2] <= (size_t(1) << 21)) {
+            break;
+        }
+    }
+
+    auto& slots = buffers.slots;
+    auto& sampleBins = buffers.sampleBins;
+    auto& bins = buffers.bins;
+    slots.assign(cells[0] * cells[1] * cells[2], 0);
+    sampleBins.resize(dataSize);
+    bins.clear();
+    const float invStep = 1.0f / step;
+    for (size_t idx = 0; idx != dataSize; ++idx) {
+        const auto& sample = data[idx];
+        size_t key = 0;
+        for (size_t ch = 0; ch != 3; ++ch) {
+            const size_t cell = std::min(cells[ch] - 1, size_t((sample[ch] - lower[ch]) * invStep));
+            key = key * cells[ch] + cell;
+        }
+        if (slots[key] == 0) {
+            bins.push_back({{0.0, 0.0, 0.0}, 0});
+            slots[key] = uint32_t(bins.size());
+        }
+        auto& bin = bins[slots[key] - 1];
+        for (size_t ch = 0; ch != 3; ++ch) {
+            bin.sum[ch] += sample[ch];
+        }
+        ++bin.count;
+        sampleBins[idx] = slots[key] - 1;
+    }
+    const size_t nBins = bins.size();
+
+    auto centroid = [](const Bin& bin, size_t ch) { return bin.sum[ch] / bin.count; };
+
+    if (seed && seed->size() == dictSize) {
+        std::copy(seed->begin(), seed->end(), dict.begin());
+    }
+    else {
+        // A box is a run of `order`; its error is that of its bins'
+        //  centroids around its own, which is all a cut can do anything
+        //  about.
+        struct Box {
+            size_t begin, end;
+            double error;
+        };
+        auto& order = buffers.order;
+        order.resize(nBins);
+        for (size_t idx = 0; idx != nBins; ++idx) {
+            order[idx] = uint32_t(idx);
+        }
+        auto boxError = [&](size_t begin, size_t end) {
+            double sum[3] = {0.0, 0.0, 0.0}, squares = 0.0;
+            size_t count = 0;
+            for (size_t idx = begin; idx != end; ++idx) {
+                const auto& bin = bins[order[idx]];
+                for (size_t ch = 0; ch != 3; ++ch) {
+                    sum[ch] += bin.sum[ch];
+                    squares += bin.sum[ch] * bin.sum[ch] / bin.count;
+                }
+                count += bin.count;
+            }
+            return squares - (sum[0] * sum[0] + sum[1] * sum[1] + sum[2] * sum[2]) / count;
+        };
+
+        std::vector<Box> boxes = {{0, nBins, boxError(0, nBins)}};
+        while (boxes.size() < dictSize) {
+            auto worst = std::max_element(boxes.begin(), boxes.end(),
+                [](const Box& a, const Box& b) { return a.error < b.error; });
+            if (worst->end - worst->begin < 2 || worst->error <= 0.0) {
+                break;
+            }
+
+            // Cut across the axis along which the box varies the most.
+            double sum[3] = {0.0, 0.0, 0.0}, squares[3] = {0.0, 0.0, 0.0};
+            size_t count = 0;
+            for (size_t idx = worst->begin; idx != worst->end; ++idx) {
+                const auto& bin = bins[order[idx]];
+                for (size_t ch = 0; ch != 3; ++ch) {
+                    sum[ch] += bin.sum[ch];
+                    squares[ch] += bin.sum[ch] * bin.sum[ch] / bin.count;
+                }
+                count += bin.count;
+            }
+            size_t axis = 0;
+            double widest = -1.0;
+            for (size_t ch = 0; ch != 3; ++ch) {
+                const double variance = squares[ch] - sum[ch] * sum[ch] / count;
+                if (variance > widest) {
+                    widest = variance;
+                    axis = ch;
+                }
+            }
+            std::sort(order.begin() + worst->begin, order.begin() + worst->end,
+                [&](uint32_t a, uint32_t b) {
+                    const double ca = centroid(bins[a], axis), cb = centroid(bins[b], axis);
+                    return ca < cb || (ca == cb && a < b);
+                });
+
+            // Cutting after `cut` leaves the least error where the halves'
+            //  squared sums over their counts add up to the most.
+            size_t cut = worst->begin + 1;
+            double best = -1.0;
+            double leftSum[3] = {0.0, 0.0, 0.0};
+            size_t leftCount = 0;
+            for (size_t idx = worst->begin; idx + 1 != worst->end; ++idx) {
+                const auto& bin = bins[order[idx]];
+                double score = 0.0, right = 0.0;
+                for (size_t ch = 0; ch != 3; ++ch) {
+                    leftSum[ch] += bin.sum[ch];
+                    score += leftSum[ch] * leftSum[ch];
+                    right += (sum[ch] - leftSum[ch]) * (sum[ch] - leftSum[ch]);
+                }
+                leftCount += bin.count;
+                score = score / leftCount + right / (count - leftCount);
+                if (score > best) {
+                    best = score;
+                    cut = idx + 1;
+                }
+            }
+
+            const Box right = {cut, worst->end, boxError(cut, worst->end)};
+            *worst = {worst->begin, cut, boxError(worst->begin, cut)};
+            boxes.push_back(right);
+        }
+
+        for (size_t entry = 0; entry != dictSize; ++entry) {
+            const auto& box = boxes[entry < boxes.size() ? entry : 0];
+            double sum[3] = {0.0, 0.0, 0.0};
+            size_t count = 0;
+            for (size_t idx = box.begin; idx != box.end; ++idx) {
+                for (size_t ch = 0; ch != 3; ++ch) {
+                    sum[ch] += bins[order[idx]].sum[ch];
+                }
+                count += bins[order[idx]].count;
+            }
+            for (size_t ch = 0; ch != 3; ++ch) {
+                dict[entry][ch] = float(sum[ch] / count);
+            }
+        }
+    }
+
+    // k-means over the bin centroids, weighted by their counts.
+    auto& sorted = buffers.sorted;
+    auto& binEntries = buffers.binEntries;
+    binEntries.assign(nBins, 0);
+    std::vector<double> sums(dictSize * 3);
+    std::vector<size_t> counts(dictSize);
+    std::vector<std::pair<double, size_t>> worstBins;
+    double previousDistortion = 0.0;
+    for (size_t iteration = 0; ; ++iteration) {
+        const bool firstPass = iteration == 0;
+
+        std::fill(sums.begin(), sums.end(), 0.0);
+        std::fill(counts.begin(), counts.end(), 0);
+        worstBins.clear();
+        double distortion = 0.0;
+        size_t changed = 0;
+        sorted.build(dict);
+        for (size_t idx = 0; idx != nBins; ++idx) {
+            const auto& bin = bins[idx];
+            float point[3];
+            for (size_t ch = 0; ch != 3; ++ch) {
+                point[ch] = float(centroid(bin, ch));
+            }
+            float distance;
+            const auto nearest = sorted.nearest(point, dict, binEntries[idx], distance);
+            if (firstPass || nearest != binEntries[idx]) {
+                binEntries[idx] = nearest;
+                ++changed;
+            }
+            for (size_t ch = 0; ch != 3; ++ch) {
+                sums[nearest * 3 + ch] += bin.sum[ch];
+            }
+            counts[nearest] += bin.count;
+            distortion += double(distance) * bin.count;
+            worstBins.emplace_back(double(distance) * bin.count, idx);
+        }
+
+        const bool converged = changed == 0 && !firstPass;
+        const bool plateaued = !firstPass && options.minRelativeImprovement > 0.0 &&
+            previousDistortion - distortion < options.minRelativeImprovement * previousDistortion;
+        const bool outOfTime = std::chrono::steady_clock::now() >= options.deadline;
+        previousDistortion = distortion;
+        if (converged || plateaued || outOfTime || iteration + 1 >= options.maxIterations) {
+            if (stats) {
+                stats->iterations = iteration + 1;
+            }
+            break;
+        }
+
+        // Empty cells get re-seeded from the bins that contribute the most
+        //  error, one bin each.
+        const size_t nEmpty = size_t(std::count(counts.begin(), counts.end(), 0));
+        const size_t nWorst = std::min(nEmpty, worstBins.size());
+        std::partial_sort(worstBins.begin(), worstBins.begin() + nWorst, worstBins.end(),
+            [](const auto& a, const auto& b) {
+                return a.first > b.first || (a.first == b.first && a.second < b.second);
+            });
+        auto nextWorst = worstBins.begin();
+
+        for (size_t entry = 0; entry != dictSize; ++entry) {
+            if (counts[entry] != 0) {
+                for (size_t ch = 0; ch != 3; ++ch) {
+                    dict[entry][ch] = float(sums[entry * 3 + ch] / counts[entry]);
+                }
+            }
+            else if (nextWorst != worstBins.begin() + nWorst && nextWorst->first > 0.0) {
+                for (size_t ch = 0; ch != 3; ++ch) {
+                    dict[entry][ch] = float(centroid(bins[nextWorst->second], ch));
+                }
+                ++nextWorst;
+            }
+        }
+    }
+
+    // The dictionary is left as it was for the last assignment. A sample's
+    //  nearest entry is almost always that of its bin, which makes for a
+    //  search that rarely looks any further.
+    double distortion = 0.0;
+    for (size_t idx = 0; idx != dataSize; ++idx) {
+        float distance;
+        indices[idx] = Index(sorted.nearest(data[idx].data(), dict,
+            binEntries[sampleBins[idx]], distance));
+        distortion += distance;
+    }
+    if (stats) {
+        stats->distortion = distortion / dataSize;
+    }
+    return {dict, indices};
+}
+
+} // namespace IV1
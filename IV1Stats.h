@@ -0,0 +1,208 @@
+#pragma once
+
+#include "Support/RGB8Image.h"
+
+#include "IV1CommandLine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace IV1 {
+
+// Peak resident set size of the process so far, in bytes.
+inline uint64_t PeakMemoryBytes() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#if defined(__APPLE__)
+    return uint64_t(usage.ru_maxrss);
+#else
+    return uint64_t(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// Wall time per pipeline stage plus named values, printed at the end of a
+//  run either as text or as a flat JSON object.
+class Stats {
+public:
+    template <typename Fn>
+    void time(const char* stage, Fn&& fn) {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        addTime(stage, std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+
+    // Adds to a stage's time, for stages that run in several pieces.
+    void addTime(const char* stage, double seconds) {
+        for (auto& entry : stages) {
+            if (entry.first == stage) {
+                entry.second += seconds;
+                return;
+            }
+        }
+        stages.emplace_back(stage, seconds);
+    }
+
+    void set(const char* name, double value) {
+        values.emplace_back(name, value);
+    }
+
+    double get(const char* name, double fallback = 0.0) const {
+        for (const auto& [entryName, value] : values) {
+            if (entryName == name) {
+                return value;
+            }
+        }
+        return fallback;
+    }
+
+    void print(FILE* out) const {
+        for (const auto& [stage, seconds] : stages) {
+            fprintf(out, "%-24s %10.4f s\n", stage.c_str(), seconds);
+        }
+        for (const auto& [name, value] : values) {
+            fprintf(out, "%-24s %10.4f\n", name.c_str(), value);
+        }
+        fprintf(out, "%-24s %10.1f MiB\n", "peak_memory", PeakMemoryBytes() / 1048576.0);
+    }
+
+    void printJSON(FILE* out) const {
+        fprintf(out, "{\"stages\": {");
+        for (size_t idx = 0; idx != stages.size(); ++idx) {
+            fprintf(out, "%s\"%s\": %.6f", idx ? ", " : "",
+                stages[idx].first.c_str(), stages[idx].second);
+        }
+        fprintf(out, "}");
+        for (const auto& [name, value] : values) {
+            fprintf(out, ", \"%s\": %.6f", name.c_str(), value);
+        }
+        fprintf(out, ", \"peak_memory_bytes\": %llu}\n", (unsigned long long) PeakMemoryBytes());
+    }
+
+private:
+    std::vector<std::pair<std::string, double>> stages;
+    std::vector<std::pair<std::string, double>> values;
+};
+
+// Progress messages go to stderr whenever stdout carries data: the output
+//  itself, for an `outputPath` of "-", or the JSON of --stats-json -.
+inline FILE* ProgressStream(const CommandLine& cmdLine, const char* outputPath) {
+    const bool jsonOnStdout = cmdLine.has("--stats-json") &&
+        strcmp(cmdLine.get("--stats-json", "-"), "-") == 0;
+    return jsonOnStdout || strncmp("-", outputPath, 1) == 0 ? stderr : stdout;
+}
+
+// Honors --stats (text on stderr) and --stats-json path ("-" for stdout,
+//  unless the output at `outputPath` went there, in which case stderr).
+inline void ReportStats(const CommandLine& cmdLine, const Stats& stats,
+                        const char* outputPath = "") {
+    if (cmdLine.has("--stats")) {
+        stats.print(stderr);
+    }
+    if (cmdLine.has("--stats-json")) {
+        const char* path = cmdLine.get("--stats-json", "-");
+        FILE* out = std::string(path) != "-" ? fopen(path, "w") :
+            strncmp("-", outputPath, 1) == 0 ? stderr : stdout;
+        if (out) {
+            stats.printJSON(out);
+            if (out != stdout && out != stderr) {
+                fclose(out);
+            }
+        }
+    }
+}
+
+// PSNR over all RGB samples, in dB, capped at 100 dB for identical images;
+//  images must be the same size.
+inline double PSNR(const VQLib::Support::RGB8Image& a, const VQLib::Support::RGB8Image& b) {
+    double squaredError = 0.0;
+    for (size_t idx = 0; idx != a.pixels.size(); ++idx) {
+        const double diff = double(a.pixels[idx]) - b.pixels[idx];
+        squaredError += diff * diff;
+    }
+    const double mse = squaredError / std::max<size_t>(a.pixels.size(), 1);
+    return mse < 1e-10 ? 100.0 : 10.0 * std::log10(255.0 * 255.0 / mse);
+}
+
+// Mean SSIM of the Rec.709 luma of two same-sized images, over 8x8 windows
+//  placed every 4 pixels.
+inline double SSIM(const VQLib::Support::RGB8Image& a, const VQLib::Support::RGB8Image& b) {
+    constexpr size_t window = 8;
+    constexpr size_t step = 4;
+    constexpr double c1 = (0.01 * 255) * (0.01 * 255);
+    constexpr double c2 = (0.03 * 255) * (0.03 * 255);
+
+    const size_t width = a.width, height = a.height;
+    if (width < window || height < window) {
+        return a.pixels == b.pixels ? 1.0 : 0.0;
+    }
+
+    auto luma = [](const VQLib::Support::RGB8Image& image) {
+        std::vector<float> out(image.width * image.height);
+        for (size_t idx = 0; idx != out.size(); ++idx) {
+            out[idx] = 0.2125f * image.pixels[3 * idx]
+                     + 0.7154f * image.pixels[3 * idx + 1]
+                     + 0.0721f * image.pixels[3 * idx + 2];
+        }
+        return out;
+    };
+    const auto lumaA = luma(a);
+    const auto lumaB = luma(b);
+
+    double total = 0.0;
+    size_t nWindows = 0;
+    for (size_t y = 0; y + window <= height; y += step) {
+        for (size_t x = 0; x + window <= width; x += step) {
+            double sumA = 0, sumB = 0, sumAA = 0, sumBB = 0, sumAB = 0;
+            for (size_t wy = 0; wy != window; ++wy) {
+                for (size_t wx = 0; wx != window; ++wx) {
+                    const double va = lumaA[(y + wy) * width + x + wx];
+                    const double vb = lumaB[(y + wy) * width + x + wx];
+                    sumA += va;
+                    sumB += vb;
+                    sumAA += va * va;
+                    sumBB += vb * vb;
+                    sumAB += va * vb;
+                }
+            }
+
+            constexpr double n = window * window;
+            const double meanA = sumA / n, meanB = sumB / n;
+            const double varA = sumAA / n - meanA * meanA;
+            const double varB = sumBB / n - meanB * meanB;
+            const double covar = sumAB / n - meanA * meanB;
+            total += ((2 * meanA * meanB + c1) * (2 * covar + c2)) /
+                     ((meanA * meanA + meanB * meanB + c1) * (varA + varB + c2));
+            ++nWindows;
+        }
+    }
+    return total / nWindows;
+}
+
+} // namespace IV1
@@ -0,0 +1,248 @@
+#pragma once
+
+#include "IV1FastDecode.h"
+#include "IV1File.h"
+#include "IV1ThreadPool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace IV1 {
+
+// Decodes an IV1 file one 4-pixel-high strip at a time, top to bottom,
+//  holding only the decode tables, one row of indices from each plane
+//  and one strip of RGB8 pixels. Peak memory is O(width).
+//
+// With a thread pool, each strip is a band of a few block rows per thread
+//  instead, decoded concurrently; peak memory is then O(width * threads).
+//
+// Regular files are read with seeks between the two index planes. A pipe
+//  ("-" for stdin) can't seek, so the first index plane is buffered whole
+//  (one byte per 4x4 tile) before the second one is streamed. Headers are
+//  checked with ValidateIV1Header before anything is decoded. Streams that
+//  reference a dictionary pack take their dictionaries from `pack`.
+//
+// Coded index planes (IV1FlagCodedIndices) can't be decoded a row at a
+//  time, so both are read and decoded whole up front, from files and pipes
+//  alike; peak memory is then O(width * height / 16).
+class StripDecoder {
+public:
+    static constexpr size_t blockH = FastDecodeTables::blockH;
+
+    explicit StripDecoder(const char* path, const IV1DictionaryPack* pack = nullptr)
+    : isStdin(strncmp("-", path, 1) == 0) {
+        file = isStdin ? stdin : fopen(path, "rb");
+        if (!file || fread(&header, 1, sizeof(header), file) != sizeof(header)) {
+            return;
+        }
+
+        IV1ExtendedHeader extended = {0, 0};
+        const bool isExtended = IsExtendedIV1(header);
+        if (isExtended && fread(&extended, sizeof(extended), 1, file) != 1) {
+            return;
+        }
+        const auto* extendedHeader = isExtended ? &extended : nullptr;
+        layout = GetIV1Layout(header.nBlocksX, header.nBlocksY, extendedHeader);
+
+        // Pipes are checked against the size the header calls for; there's
+        //  no way to know theirs without reading them to the end.
+        uint64_t fileSize = layout.size;
+        if (!isStdin && (!seekEnd(fileSize) || !seek(layout.headerSize))) {
+            return;
+        }
+        if (ValidateIV1Header(header, fileSize, extendedHeader)) {
+            return;
+        }
+        nBlocksX = header.nBlocksX;
+        nBlocksY = header.nBlocksY;
+        const size_t numBlocks = nBlocksX * nBlocksY;
+
+        const bool external = (extended.flags & IV1FlagExternalDictionaries) != 0;
+        coded = (extended.flags & IV1FlagCodedIndices) != 0;
+        if (external && (!pack || pack->id != extended.packId)) {
+            return;
+        }
+
+        uint8_t dict0[256 * 3];
+        uint8_t dict1[256 * 48];
+        if (!external && fread(dict0, sizeof(dict0), 1, file) != 1) {
+            return;
+        }
+
+        if (isStdin && !coded) {
+            indices0.resize(numBlocks);
+            if (numBlocks != 0 && fread(indices0.data(), numBlocks, 1, file) != 1) {
+                return;
+            }
+        }
+        else if (!isStdin && !external && !seek(layout.dict1)) {
+            return;
+        }
+        if (!external && fread(dict1, sizeof(dict1), 1, file) != 1) {
+            return;
+        }
+        if (coded && !readCodedIndices(isStdin ? 0 : fileSize)) {
+            return;
+        }
+
+        tables = external ? std::make_unique<FastDecodeTables>(pack->dict0, pack->dict1)
+                          : std::make_unique<FastDecodeTables>(dict0, dict1);
+    }
+
+    ~StripDecoder() {
+        if (file) {
+            fclose(file);
+        }
+    }
+
+    StripDecoder(const StripDecoder&) = delete;
+    StripDecoder& operator=(const StripDecoder&) = delete;
+
+    bool valid() const { return tables != nullptr; }
+    const IV1FileHeader& fileHeader() const { return header; }
+    size_t stride() const { return size_t(header.actualW) * FastDecodeTables::channels; }
+
+    // Calls fn(pixels, stride, nRows) once per strip, where `pixels` holds
+    //  `nRows` rows of RGB8 pixels: 4 (or fewer for the last strip), or
+    //  with a `pool`, up to 4 block rows per thread. Returns false if the
+    //  file ended early.
+    template <typename StripFn>
+    bool decode(StripFn&& fn, ThreadPool* pool = nullptr) {
+        if (!valid()) {
+            return false;
+        }
+
+        // Handing out a band costs next to nothing against decoding a whole
+        //  block row, so a few per thread is plenty to even out the load.
+        constexpr size_t bandsPerThread = 4;
+        const size_t bandRows = pool && pool->size() > 1 ? pool->size() * bandsPerThread : 1;
+        if (!isStdin && !coded) {
+            indices0.resize(bandRows * nBlocksX);
+        }
+        if (!coded) {
+            indices1.resize(bandRows * nBlocksX);
+        }
+        strip.resize(stride() * blockH * bandRows);
+
+        const size_t actualH = header.actualH;
+        const size_t nRowsUsed = std::min(nBlocksY, (actualH + blockH - 1) / blockH);
+        for (size_t blockY = 0; blockY < nRowsUsed; blockY += bandRows) {
+            const size_t nBand = std::min(bandRows, nRowsUsed - blockY);
+            const size_t bandSize = nBand * nBlocksX;
+
+            const uint8_t* bandIndices0;
+            if (isStdin || coded) {
+                bandIndices0 = &indices0[blockY * nBlocksX];
+            }
+            else {
+                if (!seek(layout.indices0 + blockY * nBlocksX) ||
+                    fread(indices0.data(), bandSize, 1, file) != 1) {
+                    return false;
+                }
+                bandIndices0 = indices0.data();
+            }
+
+            const uint8_t* bandIndices1;
+            if (coded) {
+                bandIndices1 = &indices1[blockY * nBlocksX];
+            }
+            else {
+                if (!isStdin && !seek(layout.indices1 + blockY * nBlocksX)) {
+                    return false;
+                }
+                if (fread(indices1.data(), bandSize, 1, file) != 1) {
+                    return false;
+                }
+                bandIndices1 = indices1.data();
+            }
+
+            // Every block row writes its own rows of the strip.
+            auto decodeRow = [&](size_t row) {
+                const size_t imageY = (blockY + row) * blockH;
+                tables->decodeBlockRow(bandIndices0 + row * nBlocksX,
+                    bandIndices1 + row * nBlocksX, nBlocksX, header.actualW,
+                    std::min(blockH, actualH - imageY),
+                    strip.data() + row * blockH * stride(), stride());
+            };
+            if (nBand > 1) {
+                pool->parallelFor(nBand, decodeRow);
+            }
+            else {
+                decodeRow(0);
+            }
+
+            const size_t nRows = std::min(nBand * blockH, actualH - blockY * blockH);
+            fn(static_cast<const uint8_t*>(strip.data()), stride(), nRows);
+        }
+
+        return true;
+    }
+
+private:
+    // Reads the sizes of both coded planes, from where the file is at, then
+    //  decodes both planes. With a `fileSize`, the sizes must add up to it.
+    bool readCodedIndices(uint64_t fileSize) {
+        uint32_t codedSizes[2];
+        if (fread(codedSizes, sizeof(codedSizes), 1, file) != 1) {
+            return false;
+        }
+        if (fileSize != 0 && layout.size + uint64_t(codedSizes[0]) + codedSizes[1] != fileSize) {
+            return false;
+        }
+
+        const size_t numBlocks = nBlocksX * nBlocksY;
+        std::vector<uint8_t> bytes;
+        for (size_t plane = 0; plane != 2; ++plane) {
+            auto& indices = plane == 0 ? indices0 : indices1;
+            if (codedSizes[plane] == 0 || codedSizes[plane] > MaxCodedIndexPlaneSize(numBlocks)) {
+                return false;
+            }
+            bytes.resize(codedSizes[plane]);
+            indices.resize(numBlocks);
+            if (fread(bytes.data(), bytes.size(), 1, file) != 1 ||
+                DecodeIndexPlane(bytes.data(), bytes.size(), nBlocksX, nBlocksY, indices.data())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool seek(uint64_t offset) {
+#if defined(_MSC_VER)
+        return _fseeki64(file, int64_t(offset), SEEK_SET) == 0;
+#else
+        return fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+    }
+
+    bool seekEnd(uint64_t& size) {
+#if defined(_MSC_VER)
+        if (_fseeki64(file, 0, SEEK_END) != 0) {
+            return false;
+        }
+        size = uint64_t(_ftelli64(file));
+#else
+        if (fseeko(file, 0, SEEK_END) != 0) {
+            return false;
+        }
+        size = uint64_t(ftello(file));
+#endif
+        return true;
+    }
+
+    const bool isStdin;
+    bool coded = false;
+    FILE* file = nullptr;
+    IV1FileHeader header;
+    IV1Layout layout = {};
+    size_t nBlocksX = 0, nBlocksY = 0;
+    std::unique_ptr<FastDecodeTables> tables;
+    std::vector<uint8_t> indices0, indices1;
+    std::vector<uint8_t> strip;
+};
+
+} // namespace IV1
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace IV1 {
+
+// A fixed set of worker threads that execute index-parallel loops.
+//  The calling thread takes part in every loop as well, so a pool of
+//  N threads only spawns N - 1 workers, and a pool of 1 runs inline.
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t nThreads = std::thread::hardware_concurrency())
+    : nThreads(std::max<size_t>(nThreads, 1)) {
+        for (size_t idx = 1; idx < this->nThreads; ++idx) {
+            workers.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return nThreads; }
+
+    // Calls fn(idx) once for every idx in [0, count), spread over all
+    //  threads in the pool, and returns once every call has finished.
+    //  Which thread runs which index is unspecified, so callers that
+    //  need reproducible results must only write to per-index state.
+    void parallelFor(size_t count, const std::function<void(size_t)>& fn) {
+        if (count == 0) {
+            return;
+        }
+        if (workers.empty() || count == 1) {
+            for (size_t idx = 0; idx != count; ++idx) {
+                fn(idx);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &fn;
+            jobCount = count;
+            nextIndex = 0;
+            pending = count;
+            ++generation;
+        }
+        wake.notify_all();
+
+        runJob(fn, count);
+
+        // Workers that picked up this job must let go of it before the
+        //  next one can reset the shared index counter.
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return pending == 0 && activeWorkers == 0; });
+        job = nullptr;
+    }
+
+private:
+    void runJob(const std::function<void(size_t)>& fn, size_t count) {
+        size_t finished = 0;
+        for (size_t idx = nextIndex++; idx < count; idx = nextIndex++) {
+            fn(idx);
+            ++finished;
+        }
+
+        if (finished != 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending -= finished;
+        }
+    }
+
+    void workerLoop() {
+        size_t seenGeneration = 0;
+        for (;;) {
+            const std::function<void(size_t)>* fn;
+            size_t count;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return quit || generation != seenGeneration; });
+                if (quit) {
+                    return;
+                }
+                seenGeneration = generation;
+                fn = job;
+                count = jobCount;
+                if (!fn) {
+                    continue;
+                }
+                ++activeWorkers;
+            }
+
+            runJob(*fn, count);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            --activeWorkers;
+            done.notify_all();
+        }
+    }
+
+    const size_t nThreads;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const std::function<void(size_t)>* job = nullptr;
+    size_t jobCount = 0;
+    size_t pending = 0;
+    size_t activeWorkers = 0;
+    size_t generation = 0;
+    std::atomic<size_t> nextIndex{0};
+    bool quit = false;
+};
+
+} // namespace IV1
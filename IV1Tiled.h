@@ -0,0 +1,254 @@
+#pragma once
+
+#include "Support/RGB8Image.h"
+
+#include "IV1FastDecode.h"
+#include "IV1File.h"
+#include "IV1ThreadPool.h"
+#include "IV1View.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+namespace IV1 {
+
+// Tiled IV1 container, for images too large for the 16-bit block counts
+//  of a single stream or for one 256-entry dictionary pair to do them
+//  justice. The image is cut into `tileSize` x `tileSize` tiles (smaller
+//  along the right and bottom edges), each one a complete IV1 stream with
+//  its own dictionaries, or a reference to a dictionary pack.
+//
+// After the header comes a table of nTilesX * nTilesY + 1 byte offsets
+//  from the start of the file, in row-major tile order; tile i spans
+//  [offsets[i], offsets[i + 1]) and the last offset is the file size.
+//  Tiles can then be found, and decoded, independently of each other.
+struct IV1TiledHeader {
+    uint8_t magic[4];
+    uint32_t width, height;
+    uint32_t tileSize;      // pixels per side, a multiple of 4
+    uint32_t nTilesX, nTilesY;
+};
+
+constexpr uint8_t IV1TiledMagic[4] = {'I', 'V', 'Y', 'T'};
+
+// Largest tile side whose block counts fit in an IV1FileHeader.
+constexpr size_t IV1MaxTileSize = 4 * 65535;
+
+struct TileRect {
+    size_t x, y, width, height;
+};
+
+inline TileRect GetTileRect(const IV1TiledHeader& header, size_t tileX, size_t tileY) {
+    const size_t x = tileX * header.tileSize;
+    const size_t y = tileY * header.tileSize;
+    return {x, y, std::min<size_t>(header.tileSize, header.width - x),
+                  std::min<size_t>(header.tileSize, header.height - y)};
+}
+
+// Builds the header of a `width` x `height` image cut into tiles of
+//  `tileSize`, which is rounded down to a multiple of 4 and clamped to
+//  [4, IV1MaxTileSize].
+inline IV1TiledHeader MakeIV1TiledHeader(size_t width, size_t height, size_t tileSize) {
+    tileSize = std::clamp<size_t>(tileSize / 4 * 4, 4, IV1MaxTileSize);
+
+    IV1TiledHeader header;
+    memcpy(header.magic, IV1TiledMagic, sizeof(IV1TiledMagic));
+    header.width = uint32_t(width);
+    header.height = uint32_t(height);
+    header.tileSize = uint32_t(tileSize);
+    header.nTilesX = uint32_t((width + tileSize - 1) / tileSize);
+    header.nTilesY = uint32_t((height + tileSize - 1) / tileSize);
+    return header;
+}
+
+// Size of the whole container for `header`, with every tile a single
+//  stream; `extended` as for IV1StreamSize.
+inline size_t IV1TiledStreamSize(const IV1TiledHeader& header,
+                                 const IV1ExtendedHeader* extended = nullptr) {
+    const size_t nTiles = size_t(header.nTilesX) * header.nTilesY;
+    size_t size = sizeof(header) + (nTiles + 1) * sizeof(uint64_t);
+    for (size_t tileY = 0; tileY != header.nTilesY; ++tileY) {
+        for (size_t tileX = 0; tileX != header.nTilesX; ++tileX) {
+            const auto rect = GetTileRect(header, tileX, tileY);
+            size += IV1StreamSize((rect.width + 3) / 4, (rect.height + 3) / 4, extended);
+        }
+    }
+    return size;
+}
+
+// Writes the header, the offset table and the tile streams (in row-major
+//  order) of a tiled container into `bytes`.
+inline void SerializeIV1Tiled(const IV1TiledHeader& header,
+                              const std::vector<std::vector<uint8_t>>& tiles,
+                              std::vector<uint8_t>& bytes) {
+    std::vector<uint64_t> offsets(tiles.size() + 1);
+    offsets[0] = sizeof(header) + offsets.size() * sizeof(uint64_t);
+    for (size_t tile = 0; tile != tiles.size(); ++tile) {
+        offsets[tile + 1] = offsets[tile] + tiles[tile].size();
+    }
+
+    bytes.resize(offsets.back());
+    memcpy(bytes.data(), &header, sizeof(header));
+    memcpy(bytes.data() + sizeof(header), offsets.data(), offsets.size() * sizeof(uint64_t));
+    for (size_t tile = 0; tile != tiles.size(); ++tile) {
+        std::copy(tiles[tile].begin(), tiles[tile].end(), bytes.begin() + offsets[tile]);
+    }
+}
+
+// Whether the file at `path` starts with the tiled magic. stdin can't be
+//  peeked at without consuming it, so this is always false for "-".
+inline bool IsTiledIV1File(const char* path) {
+    if (strncmp("-", path, 1) == 0) {
+        return false;
+    }
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    uint8_t magic[4];
+    const bool tiled = fread(magic, sizeof(magic), 1, file) == 1 &&
+        memcmp(magic, IV1TiledMagic, sizeof(magic)) == 0;
+    fclose(file);
+    return tiled;
+}
+
+// Read-only view of a tiled container, mapped like IV1View or over bytes
+//  already in memory, which must outlive it. The header and offset table
+//  are checked up front; each tile's stream is only parsed (and checked
+//  against the size its rectangle calls for) when asked for.
+class IV1TiledView {
+public:
+    explicit IV1TiledView(const char* path, const IV1DictionaryPack* pack = nullptr)
+    : file(std::make_unique<MappedFile>(path)), pack(pack) {
+        error = file->errorMessage();
+        if (!error) {
+            bytes = file->data();
+            byteCount = file->size();
+            error = parse();
+        }
+    }
+
+    IV1TiledView(const uint8_t* bytes, size_t size, const IV1DictionaryPack* pack = nullptr)
+    : pack(pack), bytes(bytes), byteCount(size) {
+        error = parse();
+    }
+
+    IV1TiledView(const IV1TiledView&) = delete;
+    IV1TiledView& operator=(const IV1TiledView&) = delete;
+
+    const char* errorMessage() const { return error; }
+    bool valid() const { return error == nullptr; }
+
+    const IV1TiledHeader& header() const { return tiledHeader; }
+    size_t tileCount() const { return size_t(tiledHeader.nTilesX) * tiledHeader.nTilesY; }
+    TileRect tileRect(size_t tileX, size_t tileY) const {
+        return GetTileRect(tiledHeader, tileX, tileY);
+    }
+
+    // Points `planes` at tile (tileX, tileY). Returns nullptr on success,
+    //  or what's wrong with the tile.
+    const char* tile(size_t tileX, size_t tileY, IV1Planes& planes) const {
+        if (tileX >= tiledHeader.nTilesX || tileY >= tiledHeader.nTilesY) {
+            return "no such tile";
+        }
+        const size_t idx = tileY * tiledHeader.nTilesX + tileX;
+        const uint64_t begin = offset(idx);
+        if (const char* tileError = ParseIV1Stream(bytes + begin,
+                size_t(offset(idx + 1) - begin), planes, pack)) {
+            return tileError;
+        }
+        const auto rect = tileRect(tileX, tileY);
+        if (planes.header.actualW != rect.width || planes.header.actualH != rect.height) {
+            return "tile dimensions don't match the container";
+        }
+        return nullptr;
+    }
+
+private:
+    uint64_t offset(size_t idx) const {
+        uint64_t value;
+        memcpy(&value, bytes + sizeof(IV1TiledHeader) + idx * sizeof(uint64_t),
+            sizeof(value));
+        return value;
+    }
+
+    const char* parse() {
+        if (byteCount < sizeof(IV1TiledHeader)) {
+            return "truncated stream";
+        }
+        memcpy(&tiledHeader, bytes, sizeof(tiledHeader));
+        if (memcmp(tiledHeader.magic, IV1TiledMagic, sizeof(IV1TiledMagic)) != 0) {
+            return "not a tiled IV1 stream (bad magic)";
+        }
+        const uint64_t tileSize = tiledHeader.tileSize;
+        if (tileSize == 0 || tileSize % 4 != 0 || tileSize > IV1MaxTileSize ||
+            tiledHeader.nTilesX != (uint64_t(tiledHeader.width) + tileSize - 1) / tileSize ||
+            tiledHeader.nTilesY != (uint64_t(tiledHeader.height) + tileSize - 1) / tileSize) {
+            return "tile counts don't match the image dimensions";
+        }
+
+        const uint64_t tableEnd = sizeof(IV1TiledHeader) + (uint64_t(tileCount()) + 1) * sizeof(uint64_t);
+        if (byteCount < tableEnd) {
+            return "truncated stream";
+        }
+        if (offset(0) != tableEnd || offset(tileCount()) != byteCount) {
+            return byteCount < offset(tileCount()) ? "truncated stream" : "bad tile offsets";
+        }
+        for (size_t idx = 0; idx != tileCount(); ++idx) {
+            if (offset(idx + 1) < offset(idx)) {
+                return "bad tile offsets";
+            }
+        }
+        return nullptr;
+    }
+
+    std::unique_ptr<MappedFile> file;   // null for views over memory
+    const IV1DictionaryPack* pack;
+    const uint8_t* bytes = nullptr;
+    size_t byteCount = 0;
+    const char* error = nullptr;
+    IV1TiledHeader tiledHeader = {};
+};
+
+// Decodes every tile of `view` into `pixels` (`stride` bytes per row),
+//  with the tiles spread over `pool`. Returns nullptr on success, or the
+//  problem with the first broken tile found.
+inline const char* DecodeTiledRGB8(const IV1TiledView& view, ThreadPool& pool,
+                                   uint8_t* pixels, size_t stride) {
+    std::atomic<const char*> error{nullptr};
+    const size_t nTilesX = view.header().nTilesX;
+
+    pool.parallelFor(view.tileCount(), [&](size_t idx) {
+        IV1Planes planes;
+        const size_t tileX = idx % nTilesX;
+        const size_t tileY = idx / nTilesX;
+        if (const char* tileError = view.tile(tileX, tileY, planes)) {
+            const char* expected = nullptr;
+            error.compare_exchange_strong(expected, tileError);
+            return;
+        }
+        const auto rect = view.tileRect(tileX, tileY);
+        DecodeRGB8(planes, pixels + rect.y * stride + rect.x * 3, stride);
+    });
+
+    return error;
+}
+
+inline VQLib::Support::RGB8Image DecodeTiledRGB8Image(const IV1TiledView& view,
+                                                      ThreadPool& pool, const char** error = nullptr) {
+    VQLib::Support::RGB8Image image;
+    image.width = view.header().width;
+    image.height = view.header().height;
+    image.pixels.resize(image.width * image.height * 3);
+    const char* decodeError = DecodeTiledRGB8(view, pool, image.pixels.data(), image.width * 3);
+    if (error) {
+        *error = decodeError;
+    }
+    return image;
+}
+
+} // namespace IV1
@@ -0,0 +1,888 @@
+#pragma once
+
+#include "VQLib/C++/VQDataTypes.h"
+
+#include "IV1Kernels.h"
+#include "IV1ThreadPool.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace IV1 {
+
+// Type of a squared distance between samples of type T: T itself for
+//  floating point, 32 bits for 16-bit fixed-point samples (which must stay
+//  within about +-3300 for 48-wide samples not to overflow it).
+template <typename T>
+using VQDistance = std::conditional_t<std::is_floating_point_v<T>, T, int32_t>;
+
+// Type of the (unsquared) distances the pruning bounds work with.
+template <typename T>
+using VQBound = std::conditional_t<std::is_floating_point_v<T>, T, float>;
+
+template <typename T, size_t width>
+VQDistance<T> SquaredDistance(const MatrixRow<T, width>& a, const MatrixRow<T, width>& b) {
+    VQDistance<T> acc(0);
+    for (size_t elem = 0; elem != width; ++elem) {
+        const VQDistance<T> diff = VQDistance<T>(a[elem]) - VQDistance<T>(b[elem]);
+        acc += diff * diff;
+    }
+    return acc;
+}
+
+// Squared distances from `sample` to `count` consecutive codewords. The
+//  48-wide blocks IV1 trains on (float, or int16 in compact training) go
+//  through the SIMD kernels, so every distance a training run looks at
+//  comes from the same code.
+template <typename T, size_t width>
+void SquaredDistances(const MatrixRow<T, width>& sample, const MatrixRow<T, width>* entries,
+                      size_t count, VQDistance<T>* out) {
+    if constexpr (std::is_same_v<T, float> && width == 48) {
+        ActiveKernels().squaredDistances(sample.data(), entries->data(), count, out);
+    }
+    else if constexpr (std::is_same_v<T, int16_t> && width == 48) {
+        ActiveKernels().squaredDistancesI16(sample.data(), entries->data(), count, out);
+    }
+    else {
+        for (size_t entry = 0; entry != count; ++entry) {
+            out[entry] = SquaredDistance<T, width>(sample, entries[entry]);
+        }
+    }
+}
+
+// NearestCodeword that also finds the squared distance to the runner-up.
+template <typename T, size_t width, typename Index>
+Index NearestTwoCodewords(const MatrixRow<T, width>& sample, const FlexMatrix<T, width>& dict,
+                          VQDistance<T>& bestDistance, VQDistance<T>& secondDistance) {
+    Index best = 0;
+    bestDistance = std::numeric_limits<VQDistance<T>>::max();
+    secondDistance = std::numeric_limits<VQDistance<T>>::max();
+    auto consider = [&](size_t entry, VQDistance<T> distance) {
+        if (distance < bestDistance) {
+            secondDistance = bestDistance;
+            bestDistance = distance;
+            best = Index(entry);
+        }
+        else if (distance < secondDistance) {
+            secondDistance = distance;
+        }
+    };
+
+    const auto dictSize = dict.size();
+    if constexpr ((std::is_same_v<T, float> || std::is_same_v<T, int16_t>) && width == 48) {
+        constexpr size_t batch = 256;
+        VQDistance<T> distances[batch];
+        for (size_t first = 0; first < dictSize; first += batch) {
+            const size_t count = std::min(batch, dictSize - first);
+            SquaredDistances<T, width>(sample, &dict[first], count, distances);
+            for (size_t entry = 0; entry != count; ++entry) {
+                consider(first + entry, distances[entry]);
+            }
+        }
+    }
+    else {
+        for (size_t entry = 0; entry != dictSize; ++entry) {
+            consider(entry, SquaredDistance<T, width>(sample, dict[entry]));
+        }
+    }
+    return best;
+}
+
+// Nearest codeword by squared euclidean distance; ties go to the lowest index.
+template <typename T, size_t width, typename Index>
+Index NearestCodeword(const MatrixRow<T, width>& sample,
+                      const FlexMatrix<T, width>& dict, VQDistance<T>& bestDistance) {
+    VQDistance<T> secondDistance;
+    return NearestTwoCodewords<T, width, Index>(sample, dict, bestDistance, secondDistance);
+}
+
+// Per-chunk accumulators of VQGenerateDictParallel. Passing the same
+//  scratch to consecutive calls lets them reuse its allocations.
+template <typename T>
+struct VQScratch {
+    struct Partial {
+        std::vector<double> sums;
+        std::vector<size_t> counts;
+        double distortion;
+        size_t changed;
+        size_t worstSample;
+        VQDistance<T> worstDistance;
+
+        // Per codeword, with a seeding strategy other than Spread.
+        std::vector<double> entryDistortions;
+        std::vector<size_t> entryWorstSamples;
+        std::vector<VQDistance<T>> entryWorstDistances;
+    };
+
+    std::vector<Partial> partials;
+    std::vector<double> sums;
+    std::vector<size_t> counts;
+    std::vector<double> entryDistortions;
+    std::vector<size_t> entryWorstSamples;
+    std::vector<VQDistance<T>> entryWorstDistances;
+
+    // Pruning state: a lower bound on each sample's distance to its
+    //  second-nearest codeword, and half the distance from each codeword
+    //  to its nearest neighbor.
+    std::vector<VQBound<T>> lowerBounds;
+    std::vector<VQBound<T>> halfGap;
+};
+
+// How a training run picks its starting dictionary when it isn't given
+//  one:
+//   - Spread takes samples evenly spread over the input;
+//   - KMeansPlusPlus picks samples of a StratifiedSubset one at a time,
+//     each with a probability proportional to its squared distance to the
+//     nearest one picked so far (k-means++);
+//   - Splitting starts from the centroid of the subset and splits every
+//     codeword in two, with a few k-means passes at each size until there
+//     are enough (LBG);
+//   - PrincipalAxis cuts the cluster with the largest error in two across
+//     its principal axis, through its centroid, until there are enough.
+// With any but Spread, the trainer also re-seeds empty cells from the
+//  clusters with the largest error, each giving up its worst sample,
+//  instead of from the worst samples overall.
+enum class VQSeeding { Spread, KMeansPlusPlus, Splitting, PrincipalAxis };
+
+// "spread", "kmeans++", "split" or "pca". Returns false for anything else.
+inline bool VQSeedingFromName(const char* name, VQSeeding& seeding) {
+    if (strcmp(name, "spread") == 0) {
+        seeding = VQSeeding::Spread;
+    }
+    else if (strcmp(name, "kmeans++") == 0) {
+        seeding = VQSeeding::KMeansPlusPlus;
+    }
+    else if (strcmp(name, "split") == 0) {
+        seeding = VQSeeding::Splitting;
+    }
+    else if (strcmp(name, "pca") == 0) {
+        seeding = VQSeeding::PrincipalAxis;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// When a training run stops. It always stops once no sample changes
+//  codeword; the fields below can cut it short before that.
+struct VQTrainOptions {
+    // Most assignment passes to make; it always makes at least one.
+    size_t maxIterations = 1000;
+    // Stop as soon as an iteration lowers the distortion by less than this
+    //  fraction of its previous value.
+    double minRelativeImprovement = 0.0;
+    // Stop at the first iteration that ends after this point in time.
+    std::chrono::steady_clock::time_point deadline =
+        std::chrono::steady_clock::time_point::max();
+    VQSeeding seeding = VQSeeding::Spread;
+};
+
+// What a training run did: the number of assignment passes it made and the
+//  mean squared distance of each sample to its codeword after the last one.
+struct VQStats {
+    size_t iterations = 0;
+    double distortion = 0.0;
+};
+
+template <typename T, size_t width>
+void VQSeedDictionary(const FlexMatrix<T, width>& data, VQSeeding seeding, ThreadPool& pool,
+                      FlexMatrix<T, width>& dict);
+
+// Same contract as VQLib's VQGenerateDictFast (a k-means/LBG trainer that
+//  returns the dictionary and the index of every sample), but the
+//  assignment step and the centroid accumulation of every iteration are
+//  split across a thread pool.
+//
+// Work is cut into chunks of a fixed number of samples regardless of how
+//  many threads there are, and each chunk accumulates its own partial
+//  sums that are then reduced in chunk order. That makes the result
+//  bit-identical for every thread count.
+//
+// The assignment step skips the full search wherever Hamerly's bounds
+//  prove a sample's codeword can't have changed: its distance to that
+//  codeword is below either half the gap to the nearest other codeword or
+//  a lower bound on its distance to every other codeword, which is
+//  carried over between iterations by subtracting how far the codewords
+//  moved. The bounds get a small safety margin for rounding, so the
+//  indices are exactly those of a brute-force search. Once few samples
+//  move, an iteration costs little more than one distance per sample.
+//
+// Training starts from `seed` if given (it must hold `dictSize` entries),
+//  typically the dictionary of an earlier, similar image; on similar
+//  content that converges in a handful of iterations. Otherwise it starts
+//  from VQSeedDictionary with `options.seeding`.
+template <typename T, size_t width, typename Index>
+std::pair<FlexMatrix<T, width>, std::vector<Index>> VQGenerateDictParallel(
+    const FlexMatrix<T, width>& data, size_t dictSize, const VQTrainOptions& options,
+    ThreadPool& pool, VQScratch<T>* scratch = nullptr, VQStats* stats = nullptr,
+    const FlexMatrix<T, width>* seed = nullptr) {
+
+    constexpr size_t chunkSize = 8192;
+
+    const auto dataSize = data.size();
+    FlexMatrix<T, width> dict(dictSize);
+    std::vector<Index> indices(dataSize);
+    if (dataSize == 0) {
+        return {dict, indices};
+    }
+
+    if (seed && seed->size() == dictSize) {
+        std::copy(seed->begin(), seed->end(), dict.begin());
+    }
+    else {
+        VQSeedDictionary(data, options.seeding, pool, dict);
+    }
+    const bool splitWorst = options.seeding != VQSeeding::Spread;
+
+    VQScratch<T> localScratch;
+    auto& buffers = scratch ? *scratch : localScratch;
+
+    const size_t nChunks = (dataSize + chunkSize - 1) / chunkSize;
+    auto& partials = buffers.partials;
+    partials.resize(nChunks);
+    for (auto& partial : partials) {
+        partial.sums.resize(dictSize * width);
+        partial.counts.resize(dictSize);
+        if (splitWorst) {
+            partial.entryDistortions.resize(dictSize);
+            partial.entryWorstSamples.resize(dictSize);
+            partial.entryWorstDistances.resize(dictSize);
+        }
+    }
+
+    auto& sums = buffers.sums;
+    auto& counts = buffers.counts;
+    sums.resize(dictSize * width);
+    counts.resize(dictSize);
+    auto& entryDistortions = buffers.entryDistortions;
+    auto& entryWorstSamples = buffers.entryWorstSamples;
+    auto& entryWorstDistances = buffers.entryWorstDistances;
+
+    // Relative margin on every bound, well above the rounding error of a
+    //  sum of `width` squares.
+    using Distance = VQDistance<T>;
+    using Bound = VQBound<T>;
+    const Bound slack = Bound(1e-4);
+    auto& lowerBounds = buffers.lowerBounds;
+    auto& halfGap = buffers.halfGap;
+    lowerBounds.resize(dataSize);
+    halfGap.assign(dictSize, Bound(0));
+    size_t farthestEntry = 0;
+    Bound maxDrift(0), secondMaxDrift(0);
+    FlexMatrix<T, width> previousDict;
+
+    double previousDistortion = 0.0;
+    for (size_t iteration = 0; ; ++iteration) {
+        const bool firstPass = iteration == 0;
+
+        pool.parallelFor(nChunks, [&](size_t chunk) {
+            auto& partial = partials[chunk];
+            std::fill(partial.sums.begin(), partial.sums.end(), 0.0);
+            std::fill(partial.counts.begin(), partial.counts.end(), 0);
+            partial.distortion = 0.0;
+            partial.changed = 0;
+            partial.worstSample = chunk * chunkSize;
+            partial.worstDistance = Distance(-1);
+            if (splitWorst) {
+                std::fill(partial.entryDistortions.begin(), partial.entryDistortions.end(), 0.0);
+                std::fill(partial.entryWorstDistances.begin(), partial.entryWorstDistances.end(),
+                    Distance(-1));
+            }
+
+            const size_t end = std::min(dataSize, (chunk + 1) * chunkSize);
+            for (size_t idx = chunk * chunkSize; idx != end; ++idx) {
+                Distance distance, secondDistance;
+                Index nearest;
+                if (firstPass) {
+                    nearest = NearestTwoCodewords<T, width, Index>(
+                        data[idx], dict, distance, secondDistance);
+                    indices[idx] = nearest;
+                    lowerBounds[idx] = std::sqrt(Bound(secondDistance)) * (1 - slack);
+                    ++partial.changed;
+                }
+                else {
+                    nearest = indices[idx];
+                    SquaredDistances<T, width>(data[idx], &dict[nearest], 1, &distance);
+                    const Bound lower = lowerBounds[idx] -
+                        (nearest == farthestEntry ? secondMaxDrift : maxDrift);
+                    const Bound bound = std::max(halfGap[nearest], lower);
+                    if (std::sqrt(Bound(distance)) * (1 + slack) < bound) {
+                        lowerBounds[idx] = lower;
+                    }
+                    else {
+                        nearest = NearestTwoCodewords<T, width, Index>(
+                            data[idx], dict, distance, secondDistance);
+                        lowerBounds[idx] = std::sqrt(Bound(secondDistance)) * (1 - slack);
+                        if (nearest != indices[idx]) {
+                            indices[idx] = nearest;
+                            ++partial.changed;
+                        }
+                    }
+                }
+
+                auto* sum = &partial.sums[size_t(nearest) * width];
+                for (size_t elem = 0; elem != width; ++elem) {
+                    sum[elem] += data[idx][elem];
+                }
+                ++partial.counts[nearest];
+
+                partial.distortion += distance;
+                if (distance > partial.worstDistance) {
+                    partial.worstDistance = distance;
+                    partial.worstSample = idx;
+                }
+                if (splitWorst) {
+                    partial.entryDistortions[nearest] += distance;
+                    if (distance > partial.entryWorstDistances[nearest]) {
+                        partial.entryWorstDistances[nearest] = distance;
+                        partial.entryWorstSamples[nearest] = idx;
+                    }
+                }
+            }
+        });
+
+        std::fill(sums.begin(), sums.end(), 0.0);
+        std::fill(counts.begin(), counts.end(), 0);
+        double distortion = 0.0;
+        size_t changed = 0;
+        for (const auto& partial : partials) {
+            for (size_t elem = 0; elem != sums.size(); ++elem) {
+                sums[elem] += partial.sums[elem];
+            }
+            for (size_t entry = 0; entry != dictSize; ++entry) {
+                counts[entry] += partial.counts[entry];
+            }
+            distortion += partial.distortion;
+            changed += partial.changed;
+        }
+        if (splitWorst) {
+            entryDistortions.assign(dictSize, 0.0);
+            entryWorstSamples.assign(dictSize, 0);
+            entryWorstDistances.assign(dictSize, Distance(-1));
+            for (const auto& partial : partials) {
+                for (size_t entry = 0; entry != dictSize; ++entry) {
+                    entryDistortions[entry] += partial.entryDistortions[entry];
+                    if (partial.entryWorstDistances[entry] > entryWorstDistances[entry]) {
+                        entryWorstDistances[entry] = partial.entryWorstDistances[entry];
+                        entryWorstSamples[entry] = partial.entryWorstSamples[entry];
+                    }
+                }
+            }
+        }
+
+#if defined(VQLIB_VERBOSE_OUTPUT) && VQLIB_VERBOSE_OUTPUT
+        fprintf(stderr, "Iteration %zu: distortion %f, %zu reassigned\n",
+            iteration, distortion / dataSize, changed);
+#endif
+
+        const bool converged = changed == 0 && !firstPass;
+        const bool plateaued = !firstPass && options.minRelativeImprovement > 0.0 &&
+            previousDistortion - distortion < options.minRelativeImprovement * previousDistortion;
+        const bool outOfTime = std::chrono::steady_clock::now() >= options.deadline;
+        previousDistortion = distortion;
+
+        if (converged || plateaued || outOfTime || iteration + 1 >= options.maxIterations) {
+            if (stats) {
+                stats->iterations = iteration + 1;
+                stats->distortion = distortion / dataSize;
+            }
+            break;
+        }
+
+        // Empty cells get re-seeded from the worst-represented samples,
+        //  taking at most one sample from each chunk so that they differ.
+        std::vector<size_t> worstChunks(nChunks);
+        for (size_t chunk = 0; chunk != nChunks; ++chunk) {
+            worstChunks[chunk] = chunk;
+        }
+        std::stable_sort(worstChunks.begin(), worstChunks.end(),
+            [&](size_t a, size_t b) {
+                return partials[a].worstDistance > partials[b].worstDistance;
+            });
+        auto nextWorst = worstChunks.begin();
+
+        previousDict = dict;
+        for (size_t entry = 0; entry != dictSize; ++entry) {
+            if (counts[entry] != 0) {
+                const double invCount = 1.0 / counts[entry];
+                for (size_t elem = 0; elem != width; ++elem) {
+                    const double centroid = sums[entry * width + elem] * invCount;
+                    if constexpr (std::is_floating_point_v<T>) {
+                        dict[entry][elem] = T(centroid);
+                    }
+                    else {
+                        dict[entry][elem] = T(std::lround(centroid));
+                    }
+                }
+            }
+            else if (splitWorst) {
+                // The worst sample of the cluster with the largest error
+                //  that hasn't given one up yet.
+                size_t worst = dictSize;
+                for (size_t other = 0; other != dictSize; ++other) {
+                    if (counts[other] > 1 && entryDistortions[other] > 0.0 &&
+                        (worst == dictSize || entryDistortions[other] > entryDistortions[worst])) {
+                        worst = other;
+                    }
+                }
+                if (worst != dictSize) {
+                    dict[entry] = data[entryWorstSamples[worst]];
+                    entryDistortions[worst] = 0.0;
+                }
+            }
+            else if (nextWorst != worstChunks.end()) {
+                dict[entry] = data[partials[*nextWorst++].worstSample];
+            }
+        }
+
+        // How far each codeword moved, and half the distance from each to
+        //  its nearest neighbor, for the next iteration's bounds.
+        maxDrift = secondMaxDrift = Bound(0);
+        for (size_t entry = 0; entry != dictSize; ++entry) {
+            const Bound moved = std::sqrt(Bound(
+                SquaredDistance<T, width>(dict[entry], previousDict[entry]))) * (1 + slack);
+            if (moved > maxDrift) {
+                secondMaxDrift = maxDrift;
+                maxDrift = moved;
+                farthestEntry = entry;
+            }
+            else if (moved > secondMaxDrift) {
+                secondMaxDrift = moved;
+            }
+        }
+        std::fill(halfGap.begin(), halfGap.end(), std::numeric_limits<Bound>::max());
+        for (size_t a = 0; a != dictSize; ++a) {
+            for (size_t b = a + 1; b != dictSize; ++b) {
+                const Bound gap = Bound(SquaredDistance<T, width>(dict[a], dict[b]));
+                halfGap[a] = std::min(halfGap[a], gap);
+                halfGap[b] = std::min(halfGap[b], gap);
+            }
+        }
+        for (auto& gap : halfGap) {
+            gap = gap == std::numeric_limits<Bound>::max() ? gap :
+                std::sqrt(gap) * Bound(0.5) * (1 - slack);
+        }
+    }
+
+    return {dict, indices};
+}
+
+// Assigns every sample to its nearest codeword of a fixed dictionary, in
+//  the same chunks as VQGenerateDictParallel. Returns the mean squared
+//  distance of the samples to their codewords.
+template <typename T, size_t width, typename Index>
+double VQAssignParallel(const FlexMatrix<T, width>& data, const FlexMatrix<T, width>& dict,
+                        std::vector<Index>& indices, ThreadPool& pool) {
+    constexpr size_t chunkSize = 8192;
+
+    const auto dataSize = data.size();
+    indices.resize(dataSize);
+    if (dataSize == 0) {
+        return 0.0;
+    }
+
+    const size_t nChunks = (dataSize + chunkSize - 1) / chunkSize;
+    std::vector<double> distortions(nChunks);
+    pool.parallelFor(nChunks, [&](size_t chunk) {
+        double distortion = 0.0;
+        const size_t end = std::min(dataSize, (chunk + 1) * chunkSize);
+        for (size_t idx = chunk * chunkSize; idx != end; ++idx) {
+            VQDistance<T> distance;
+            indices[idx] = NearestCodeword<T, width, Index>(data[idx], dict, distance);
+            distortion += distance;
+        }
+        distortions[chunk] = distortion;
+    });
+
+    double distortion = 0.0;
+    for (const double partial : distortions) {
+        distortion += partial;
+    }
+    return distortion / dataSize;
+}
+
+// Picks `count` samples out of `data` into `subset`, one from each of
+//  `count` equal runs of consecutive samples. For blocks in scan order
+//  that spreads the picks evenly over the image. The position within each
+//  run comes from a fixed hash, so the same input always gives the same
+//  subset.
+template <typename T, size_t width>
+void StratifiedSubset(const FlexMatrix<T, width>& data, size_t count,
+                      FlexMatrix<T, width>& subset) {
+    const auto dataSize = data.size();
+    count = std::min(count, dataSize);
+    subset.resize(count);
+    for (size_t idx = 0; idx != count; ++idx) {
+        const size_t begin = idx * dataSize / count;
+        const size_t end = (idx + 1) * dataSize / count;
+        uint32_t hash = uint32_t(idx) * 2654435761u;
+        hash ^= hash >> 16;
+        subset[idx] = data[begin + hash % (end - begin)];
+    }
+}
+
+// Most samples the seeding strategies look at; larger inputs are seeded
+//  from a StratifiedSubset of this many.
+constexpr size_t VQSeedSamples = 16384;
+
+// Uniform doubles in [0, 1) from a fixed sequence (splitmix64), so that
+//  seeding gives the same dictionary on every platform.
+class VQSeedRandom {
+public:
+    double next() {
+        uint64_t value = (state += 0x9E3779B97F4A7C15ull);
+        value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+        value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+        value ^= value >> 31;
+        return double(value >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+private:
+    uint64_t state = 0;
+};
+
+// Sets `entry` to the mean of `count` samples that sum to `sum`, rounded
+//  for fixed-point samples as in VQGenerateDictParallel.
+template <typename T, size_t width>
+void SetVQCentroid(MatrixRow<T, width>& entry, const double* sum, size_t count) {
+    const double invCount = 1.0 / count;
+    for (size_t elem = 0; elem != width; ++elem) {
+        const double centroid = sum[elem] * invCount;
+        if constexpr (std::is_floating_point_v<T>) {
+            entry[elem] = T(centroid);
+        }
+        else {
+            entry[elem] = T(std::lround(centroid));
+        }
+    }
+}
+
+// k-means++: every pick after a uniform first one is drawn with a
+//  probability proportional to the squared distance to the nearest pick.
+//  Once every sample coincides with a pick, the rest repeat picks and are
+//  left for the trainer to re-seed.
+template <typename T, size_t width>
+void SeedKMeansPlusPlus(const FlexMatrix<T, width>& sample, ThreadPool& pool,
+                        FlexMatrix<T, width>& dict) {
+    constexpr size_t chunkSize = 1024;
+
+    const size_t nSamples = sample.size();
+    const size_t nChunks = (nSamples + chunkSize - 1) / chunkSize;
+    std::vector<double> nearest(nSamples, std::numeric_limits<double>::max());
+    std::vector<double> chunkTotals(nChunks);
+    VQSeedRandom random;
+
+    size_t pick = std::min(nSamples - 1, size_t(random.next() * nSamples));
+    for (size_t entry = 0; entry != dict.size(); ++entry) {
+        dict[entry] = sample[pick];
+        if (entry + 1 == dict.size()) {
+            break;
+        }
+
+        pool.parallelFor(nChunks, [&](size_t chunk) {
+            double total = 0.0;
+            const size_t end = std::min(nSamples, (chunk + 1) * chunkSize);
+            for (size_t idx = chunk * chunkSize; idx != end; ++idx) {
+                VQDistance<T> distance;
+                SquaredDistances<T, width>(sample[idx], &dict[entry], 1, &distance);
+                nearest[idx] = std::min(nearest[idx], double(distance));
+                total += nearest[idx];
+            }
+            chunkTotals[chunk] = total;
+        });
+
+        double total = 0.0;
+        for (const double chunkTotal : chunkTotals) {
+            total += chunkTotal;
+        }
+        if (total <= 0.0) {
+            continue;
+        }
+
+        double target = random.next() * total;
+        size_t chunk = 0;
+        while (chunk + 1 < nChunks && target >= chunkTotals[chunk]) {
+            target -= chunkTotals[chunk++];
+        }
+        const size_t end = std::min(nSamples, (chunk + 1) * chunkSize);
+        pick = chunk * chunkSize;
+        while (pick + 1 < end && (target >= nearest[pick] || nearest[pick] == 0.0)) {
+            target -= nearest[pick++];
+        }
+    }
+}
+
+// One k-means pass over `sample` for the splitting seeding: assigns every
+//  sample, moves every codeword to its centroid and re-seeds empty cells
+//  from the clusters with the largest error. Leaves the error of each
+//  cluster and the variance of each of its elements, as they were before
+//  the codewords moved, in `errors` and `variances`.
+template <typename T, size_t width>
+void SplittingPass(const FlexMatrix<T, width>& sample, ThreadPool& pool,
+                   FlexMatrix<T, width>& dict, std::vector<uint32_t>& indices,
+                   std::vector<VQDistance<T>>& distances, std::vector<double>& errors,
+                   std::vector<double>& variances) {
+    constexpr size_t chunkSize = 1024;
+
+    const size_t nSamples = sample.size();
+    const size_t dictSize = dict.size();
+    pool.parallelFor((nSamples + chunkSize - 1) / chunkSize, [&](size_t chunk) {
+        const size_t end = std::min(nSamples, (chunk + 1) * chunkSize);
+        for (size_t idx = chunk * chunkSize; idx != end; ++idx) {
+            indices[idx] = NearestCodeword<T, width, uint32_t>(sample[idx], dict, distances[idx]);
+        }
+    });
+
+    std::vector<double> sums(dictSize * width, 0.0);
+    std::vector<size_t> counts(dictSize, 0);
+    std::vector<size_t> worstSamples(dictSize, 0);
+    errors.assign(dictSize, 0.0);
+    variances.assign(dictSize * width, 0.0);
+    for (size_t idx = 0; idx != nSamples; ++idx) {
+        const size_t entry = indices[idx];
+        for (size_t elem = 0; elem != width; ++elem) {
+            const double value = sample[idx][elem];
+            sums[entry * width + elem] += value;
+            variances[entry * width + elem] += value * value;
+        }
+        if (counts[entry]++ == 0 || distances[idx] > distances[worstSamples[entry]]) {
+            worstSamples[entry] = idx;
+        }
+        errors[entry] += distances[idx];
+    }
+
+    std::vector<double> remaining = errors;
+    for (size_t entry = 0; entry != dictSize; ++entry) {
+        if (counts[entry] != 0) {
+            for (size_t elem = 0; elem != width; ++elem) {
+                const double mean = sums[entry * width + elem] / counts[entry];
+                auto& variance = variances[entry * width + elem];
+                variance = std::max(0.0, variance / counts[entry] - mean * mean);
+            }
+            SetVQCentroid<T, width>(dict[entry], &sums[entry * width], counts[entry]);
+            continue;
+        }
+        const auto worst = std::max_element(remaining.begin(), remaining.end()) - remaining.begin();
+        if (remaining[worst] > 0.0) {
+            dict[entry] = sample[worstSamples[worst]];
+            remaining[worst] = 0.0;
+        }
+    }
+}
+
+// LBG splitting: every codeword (or, on the last round, those of the
+//  clusters with the largest error) is split in two, half a standard
+//  deviation of its cluster either way element by element, and a few
+//  k-means passes settle the result before the next round; fewer passes
+//  leave the trainer a worse start than they save.
+template <typename T, size_t width>
+void SeedSplitting(const FlexMatrix<T, width>& sample, ThreadPool& pool,
+                   FlexMatrix<T, width>& dict) {
+    constexpr size_t passesPerRound = 4;
+    constexpr double spread = 0.5;
+
+    const size_t nSamples = sample.size();
+    const size_t dictSize = dict.size();
+    std::vector<uint32_t> indices(nSamples);
+    std::vector<VQDistance<T>> distances(nSamples);
+    std::vector<double> errors, variances;
+    std::vector<size_t> order;
+
+    FlexMatrix<T, width> current(1, sample[0]);
+    SplittingPass(sample, pool, current, indices, distances, errors, variances);
+    while (current.size() < dictSize) {
+        const size_t size = current.size();
+        const size_t nSplit = std::min(size, dictSize - size);
+        order.resize(size);
+        std::iota(order.begin(), order.end(), size_t(0));
+        std::stable_sort(order.begin(), order.end(),
+            [&](size_t a, size_t b) { return errors[a] > errors[b]; });
+
+        for (size_t split = 0; split != nSplit; ++split) {
+            const size_t entry = order[split];
+            auto upper = current[entry];
+            auto& lower = current[entry];
+            for (size_t elem = 0; elem != width; ++elem) {
+                const double deviation = spread * std::sqrt(variances[entry * width + elem]);
+                if constexpr (std::is_floating_point_v<T>) {
+                    upper[elem] = T(upper[elem] + deviation);
+                    lower[elem] = T(lower[elem] - deviation);
+                }
+                else {
+                    const long step = std::max(1l, std::lround(deviation));
+                    upper[elem] = T(std::min<long>(upper[elem] + step, std::numeric_limits<T>::max()));
+                    lower[elem] = T(std::max<long>(lower[elem] - step, std::numeric_limits<T>::min()));
+                }
+            }
+            current.push_back(upper);
+        }
+        for (size_t pass = 0; pass != passesPerRound; ++pass) {
+            SplittingPass(sample, pool, current, indices, distances, errors, variances);
+        }
+    }
+    std::copy(current.begin(), current.end(), dict.begin());
+}
+
+// Principal-axis splitting: the cluster with the largest error is cut in
+//  two across the principal axis of its covariance (by power iteration),
+//  through its centroid. Clusters whose samples all coincide are never
+//  cut; if that leaves fewer clusters than codewords, the rest repeat the
+//  first and are left for the trainer to re-seed.
+template <typename T, size_t width>
+void SeedPrincipalAxis(const FlexMatrix<T, width>& sample, FlexMatrix<T, width>& dict) {
+    constexpr size_t powerIterations = 16;
+
+    struct Cluster {
+        size_t begin, end;
+        double error;
+        std::array<double, width> mean;
+    };
+
+    std::vector<uint32_t> order(sample.size());
+    std::iota(order.begin(), order.end(), uint32_t(0));
+    auto describe = [&](size_t begin, size_t end) {
+        Cluster cluster{begin, end, 0.0, {}};
+        for (size_t pos = begin; pos != end; ++pos) {
+            for (size_t elem = 0; elem != width; ++elem) {
+                cluster.mean[elem] += sample[order[pos]][elem];
+            }
+        }
+        for (auto& value : cluster.mean) {
+            value /= double(end - begin);
+        }
+        for (size_t pos = begin; pos != end; ++pos) {
+            for (size_t elem = 0; elem != width; ++elem) {
+                const double diff = sample[order[pos]][elem] - cluster.mean[elem];
+                cluster.error += diff * diff;
+            }
+        }
+        return cluster;
+    };
+
+    std::vector<Cluster> clusters{describe(0, order.size())};
+    std::vector<double> covariance(width * width);
+    std::vector<double> projections(order.size());
+    while (clusters.size() < dict.size()) {
+        const auto worst = std::max_element(clusters.begin(), clusters.end(),
+            [](const Cluster& a, const Cluster& b) { return a.error < b.error; });
+        if (worst->error <= 0.0) {
+            break;
+        }
+
+        std::fill(covariance.begin(), covariance.end(), 0.0);
+        double diff[width];
+        for (size_t pos = worst->begin; pos != worst->end; ++pos) {
+            for (size_t elem = 0; elem != width; ++elem) {
+                diff[elem] = sample[order[pos]][elem] - worst->mean[elem];
+            }
+            for (size_t row = 0; row != width; ++row) {
+                for (size_t col = row; col != width; ++col) {
+                    covariance[row * width + col] += diff[row] * diff[col];
+                }
+            }
+        }
+        size_t widest = 0;
+        for (size_t row = 0; row != width; ++row) {
+            for (size_t col = 0; col != row; ++col) {
+                covariance[row * width + col] = covariance[col * width + row];
+            }
+            if (covariance[row * width + row] > covariance[widest * width + widest]) {
+                widest = row;
+            }
+        }
+
+        // Power iteration, from the element that varies the most.
+        double axis[width] = {}, next[width];
+        axis[widest] = 1.0;
+        for (size_t iteration = 0; iteration != powerIterations; ++iteration) {
+            double norm = 0.0;
+            for (size_t row = 0; row != width; ++row) {
+                next[row] = 0.0;
+                for (size_t col = 0; col != width; ++col) {
+                    next[row] += covariance[row * width + col] * axis[col];
+                }
+                norm += next[row] * next[row];
+            }
+            if (norm <= 0.0) {
+                break;
+            }
+            norm = 1.0 / std::sqrt(norm);
+            for (size_t row = 0; row != width; ++row) {
+                axis[row] = next[row] * norm;
+            }
+        }
+
+        for (size_t pos = worst->begin; pos != worst->end; ++pos) {
+            double projection = 0.0;
+            for (size_t elem = 0; elem != width; ++elem) {
+                projection += (sample[order[pos]][elem] - worst->mean[elem]) * axis[elem];
+            }
+            projections[order[pos]] = projection;
+        }
+        const auto middle = std::stable_partition(order.begin() + worst->begin,
+            order.begin() + worst->end, [&](uint32_t idx) { return projections[idx] < 0.0; });
+        const size_t cut = size_t(middle - order.begin());
+        if (cut == worst->begin || cut == worst->end) {
+            worst->error = 0.0;
+            continue;
+        }
+        const size_t end = worst->end;
+        *worst = describe(worst->begin, cut);
+        clusters.push_back(describe(cut, end));
+    }
+
+    for (size_t entry = 0; entry != dict.size(); ++entry) {
+        const auto& cluster = clusters[entry < clusters.size() ? entry : 0];
+        for (size_t elem = 0; elem != width; ++elem) {
+            if constexpr (std::is_floating_point_v<T>) {
+                dict[entry][elem] = T(cluster.mean[elem]);
+            }
+            else {
+                dict[entry][elem] = T(std::lround(cluster.mean[elem]));
+            }
+        }
+    }
+}
+
+// Fills `dict` (already sized) with the starting dictionary `seeding`
+//  picks for `data`; see VQSeeding. Every strategy but Spread looks at a
+//  StratifiedSubset of at most VQSeedSamples samples.
+template <typename T, size_t width>
+void VQSeedDictionary(const FlexMatrix<T, width>& data, VQSeeding seeding, ThreadPool& pool,
+                      FlexMatrix<T, width>& dict) {
+    const size_t dataSize = data.size();
+    const size_t dictSize = dict.size();
+    if (seeding == VQSeeding::Spread || dataSize == 0 || dictSize == 0) {
+        for (size_t entry = 0; entry != dictSize; ++entry) {
+            dict[entry] = data[entry * dataSize / dictSize];
+        }
+        return;
+    }
+
+    FlexMatrix<T, width> subset;
+    StratifiedSubset(data, VQSeedSamples, subset);
+    switch (seeding) {
+    case VQSeeding::KMeansPlusPlus:
+        SeedKMeansPlusPlus(subset, pool, dict);
+        break;
+    case VQSeeding::Splitting:
+        SeedSplitting(subset, pool, dict);
+        break;
+    default:
+        SeedPrincipalAxis(subset, dict);
+        break;
+    }
+}
+
+} // namespace IV1
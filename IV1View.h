@@ -0,0 +1,172 @@
+#pragma once
+
+#include "IV1File.h"
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace IV1 {
+
+struct ByteSpan {
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+
+    const uint8_t* begin() const { return data; }
+    const uint8_t* end() const { return data + size; }
+    uint8_t operator[](size_t idx) const { return data[idx]; }
+};
+
+// A whole file mapped read-only into memory. stdin ("-") can't be mapped,
+//  so it's read into an owned buffer instead.
+class MappedFile {
+public:
+    explicit MappedFile(const char* path) {
+        if (strncmp("-", path, 1) == 0) {
+            owned = ReadIV1Bytes(path);
+            bytes = owned.data();
+            byteCount = owned.size();
+            return;
+        }
+
+#if defined(_WIN32)
+        fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr,
+            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (fileHandle == INVALID_HANDLE_VALUE) {
+            error = "could not open file";
+            return;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+            error = "could not map file";
+            return;
+        }
+        mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mappingHandle) {
+            error = "could not map file";
+            return;
+        }
+        mapping = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+        mappingSize = size_t(fileSize.QuadPart);
+#else
+        const int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            error = "could not open file";
+            return;
+        }
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0) {
+            mappingSize = size_t(fileStat.st_size);
+            mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                mapping = nullptr;
+            }
+        }
+        close(fd);
+#endif
+        if (!mapping) {
+            error = "could not map file";
+            return;
+        }
+        bytes = static_cast<const uint8_t*>(mapping);
+        byteCount = mappingSize;
+    }
+
+    ~MappedFile() {
+#if defined(_WIN32)
+        if (mapping) {
+            UnmapViewOfFile(mapping);
+        }
+        if (mappingHandle) {
+            CloseHandle(mappingHandle);
+        }
+        if (fileHandle != INVALID_HANDLE_VALUE) {
+            CloseHandle(fileHandle);
+        }
+#else
+        if (mapping) {
+            munmap(mapping, mappingSize);
+        }
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // nullptr if the file could be opened and mapped (or read).
+    const char* errorMessage() const { return error; }
+    const uint8_t* data() const { return bytes; }
+    size_t size() const { return byteCount; }
+
+private:
+    const char* error = nullptr;
+    const uint8_t* bytes = nullptr;
+    size_t byteCount = 0;
+    std::vector<uint8_t> owned;
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+#if defined(_WIN32)
+    HANDLE fileHandle = INVALID_HANDLE_VALUE;
+    HANDLE mappingHandle = nullptr;
+#endif
+};
+
+// Read-only, zero-copy view of an IV1 file. The file is memory-mapped and
+//  its header validated (magic, dimensions and exact file size) up front;
+//  after that the dictionaries and index planes are handed out as spans
+//  pointing straight into the mapping, with no reads or allocations.
+//
+// Streams that reference a dictionary pack need `pack`, which must then
+//  outlive the view; their dictionary spans point into it. Coded index
+//  planes are the exception to zero-copy: they're decoded once, up front,
+//  and the index spans point at the decoded planes. A view opened with
+//  `paletteOnly` skips decoding a coded indices1, whose span is then empty.
+class IV1View {
+public:
+    explicit IV1View(const char* path, const IV1DictionaryPack* pack = nullptr,
+                     bool paletteOnly = false)
+    : file(path) {
+        error = file.errorMessage();
+        if (!error) {
+            error = ParseIV1Stream(file.data(), file.size(), filePlanes, pack, paletteOnly);
+        }
+    }
+
+    IV1View(const IV1View&) = delete;
+    IV1View& operator=(const IV1View&) = delete;
+
+    // nullptr if the file was mapped and is a well-formed IV1 stream.
+    const char* errorMessage() const { return error; }
+    bool valid() const { return error == nullptr; }
+
+    const IV1FileHeader& header() const { return filePlanes.header; }
+    ByteSpan dict0() const { return {filePlanes.dict0, 256 * 3}; }
+    ByteSpan indices0() const { return {filePlanes.indices0, numBlocks()}; }
+    ByteSpan dict1() const { return {filePlanes.dict1, 256 * 48}; }
+    ByteSpan indices1() const {
+        return {filePlanes.indices1, filePlanes.indices1 ? numBlocks() : 0};
+    }
+    const IV1Planes& planes() const { return filePlanes; }
+
+private:
+    size_t numBlocks() const {
+        return size_t(filePlanes.header.nBlocksX) * filePlanes.header.nBlocksY;
+    }
+
+    MappedFile file;
+    const char* error = nullptr;
+    IV1Planes filePlanes = {};
+};
+
+} // namespace IV1
@@ -0,0 +1,323 @@
+// Stage-by-stage benchmark of the IV1 encoder and decoder over synthetic images.
+
+#include "VQLib/C++/VQAlgorithm.h"
+
+#include "IV1BlockImage.h"
+#include "IV1CommandLine.h"
+#include "IV1FastDecode.h"
+#include "IV1File.h"
+#include "IV1Kernels.h"
+#include "IV1Palette.h"
+#include "IV1StripDecode.h"
+#include "IV1ThreadPool.h"
+#include "IV1View.h"
+#include "IV1VQ.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+using namespace VQLib;
+using namespace IV1;
+
+// Every allocation in the process is counted, so each stage can report how
+//  many bytes it asked for.
+static std::atomic<uint64_t> allocatedBytes{0};
+static std::atomic<uint64_t> allocationCount{0};
+
+static void* CountedAlloc(size_t size, size_t alignment) {
+    allocatedBytes += size;
+    ++allocationCount;
+    void* ptr = nullptr;
+    if (alignment <= alignof(std::max_align_t)) {
+        ptr = malloc(size ? size : 1);
+    }
+    else {
+#if defined(_MSC_VER)
+        ptr = _aligned_malloc(size ? size : 1, alignment);
+#else
+        ptr = aligned_alloc(alignment, (std::max<size_t>(size, 1) + alignment - 1) / alignment * alignment);
+#endif
+    }
+    if (!ptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void* operator new(size_t size) { return CountedAlloc(size, 0); }
+void* operator new[](size_t size) { return CountedAlloc(size, 0); }
+void* operator new(size_t size, std::align_val_t al) { return CountedAlloc(size, size_t(al)); }
+void* operator new[](size_t size, std::align_val_t al) { return CountedAlloc(size, size_t(al)); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { free(ptr); }
+#if defined(_MSC_VER)
+void operator delete(void* ptr, std::align_val_t) noexcept { _aligned_free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { _aligned_free(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { _aligned_free(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { _aligned_free(ptr); }
+#else
+void operator delete(void* ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void* ptr, size_t, std::align_val_t) noexcept { free(ptr); }
+#endif
+
+struct StageResult {
+    std::string size;
+    size_t width, height;
+    std::string stage;
+    double seconds;
+    uint64_t bytes, allocations;
+};
+
+// Runs `fn` `repeat` times and keeps the fastest run.
+template <typename Fn>
+StageResult TimeStage(const char* stage, size_t width, size_t height, size_t repeat, Fn&& fn) {
+    StageResult result = {std::to_string(width) + "x" + std::to_string(height),
+        width, height, stage, 0.0, 0, 0};
+
+    for (size_t run = 0; run != std::max<size_t>(repeat, 1); ++run) {
+        const uint64_t bytesBefore = allocatedBytes;
+        const uint64_t countBefore = allocationCount;
+        const auto start = std::chrono::steady_clock::now();
+
+        fn();
+
+        const double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        if (run == 0 || seconds < result.seconds) {
+            result.seconds = seconds;
+        }
+        result.bytes = allocatedBytes - bytesBefore;
+        result.allocations = allocationCount - countBefore;
+    }
+    return result;
+}
+
+// Smooth gradients with some texture and noise, so VQ training has
+//  something realistic to chew on. Deterministic for a given size.
+static Support::RGB8Image SyntheticImage(size_t width, size_t height) {
+    Support::RGB8Image image = {width, height, {}};
+    image.pixels.resize(width * height * 3);
+
+    uint32_t state = 0x12345678u;
+    auto noise = [&state] {
+        state = state * 1664525u + 1013904223u;
+        return int(state >> 28) - 8;
+    };
+
+    for (size_t y = 0; y != height; ++y) {
+        for (size_t x = 0; x != width; ++x) {
+            const float u = float(x) / width, v = float(y) / height;
+            const int values[3] = {
+                int(128 + 100 * std::sin(x / 17.0f) * std::cos(y / 23.0f)) + noise(),
+                int(255 * u) + noise(),
+                int(255 * v) ^ int((x / 8) & 32),
+            };
+            for (size_t ch = 0; ch != 3; ++ch) {
+                image.pixels[(y * width + x) * 3 + ch] = uint8_t(std::clamp(values[ch], 0, 255));
+            }
+        }
+    }
+    return image;
+}
+
+int main(int argc, char **args) {
+    constexpr size_t blockW = 4;
+    constexpr size_t blockH = 4;
+    constexpr size_t sizes[][2] = {
+        {320, 240}, {640, 480}, {960, 640}, {1280, 960},
+        {1920, 1080}, {2560, 1920}, {3840, 2160}, {5120, 3840},
+    };
+
+    const CommandLine cmdLine(argc, args);
+    if (cmdLine.has("--help")) {
+        printf("Usage: IV1bench(.exe) [--format csv|json] [--iterations N] [--repeat N]\n"
+               "                      [--max-pixels N] [--threads N] [--isa name]\n");
+        return 0;
+    }
+    if (cmdLine.has("--isa") && !SetISA(cmdLine.get("--isa", "auto"))) {
+        printf("Unsupported instruction set %s; use scalar, sse2, avx2, avx512 or auto.\n",
+            cmdLine.get("--isa", ""));
+        return 1;
+    }
+    fprintf(stderr, "Using %s kernels\n", ISAName(ActiveKernels().isa));
+
+    const bool json = strcmp(cmdLine.get("--format", "csv"), "json") == 0;
+    // Training is capped well below the encoder's 1000 iterations, or the
+    //  large sizes would take hours; per-iteration cost is what matters.
+    const size_t iterations = cmdLine.getSize("--iterations", 10);
+    const size_t repeat = cmdLine.getSize("--repeat", 1);
+    const size_t maxPixels = cmdLine.getSize("--max-pixels", SIZE_MAX);
+    ThreadPool pool(cmdLine.getSize("--threads", std::thread::hardware_concurrency()));
+    VQTrainOptions trainOptions;
+    trainOptions.maxIterations = iterations;
+
+    const auto tempPath = (std::filesystem::temp_directory_path() / "IV1bench.iv1").string();
+
+    std::vector<StageResult> results;
+    for (const auto& size : sizes) {
+        const size_t width = size[0], height = size[1];
+        if (width * height > maxPixels) {
+            continue;
+        }
+        const auto image = SyntheticImage(width, height);
+        auto stage = [&](const char* name, auto&& fn) {
+            results.push_back(TimeStage(name, width, height, repeat, fn));
+            fprintf(stderr, "%zux%zu %-22s %9.4fs\n", width, height, name, results.back().seconds);
+        };
+
+        // Baseline encoder, as IV1enc used to run it.
+        std::unique_ptr<BlockImage<blockW, blockH>> imageBlocks;
+        stage("block_image", [&] {
+            imageBlocks = std::make_unique<BlockImage<blockW, blockH>>(image);
+        });
+
+        FlexMatrix<float, 3> blocksPalette;
+        stage("block_rgb_mean", [&] {
+            blocksPalette = BlockRGBMean<float, 3 * blockW * blockH>(imageBlocks->data);
+        });
+
+        // What EncodeImage runs instead of the two stages above.
+        FlexMatrix<float, 48> fusedBlocks;
+        FlexMatrix<float, 3> fusedMeans;
+        stage("fused_blocking", [&] {
+            FillBlocksAndMeans<blockW, blockH>(image, fusedBlocks, fusedMeans);
+        });
+
+        FlexMatrix<float, 3> dictPalette;
+        std::vector<uint16_t> idxPalette;
+        stage("vq_palette", [&] {
+            std::tie(dictPalette, idxPalette) = VQGenerateDictFast<float, 3, uint16_t>
+                (blocksPalette, 256, iterations);
+        });
+        stage("vq_palette_parallel", [&] {
+            VQGenerateDictParallel<float, 3, uint16_t>(blocksPalette, 256, trainOptions, pool);
+        });
+        stage("histogram_palette", [&] {
+            HistogramPalette<uint16_t>(blocksPalette, 256, trainOptions);
+        });
+
+        FlexMatrix<float, 48> blocksDiff;
+        stage("block_rgb_subtract_mean", [&] {
+            const auto imgPalette = BlockImage<1, 1>(dictPalette, idxPalette,
+                imageBlocks->nBlocksX, imageBlocks->nBlocksY);
+            blocksDiff = BlockRGBSubtractMean<float, 3 * blockW * blockH>(
+                imageBlocks->data, imgPalette.data);
+        });
+
+        FlexMatrix<float, 48> dictDiff;
+        std::vector<uint16_t> idxDiff;
+        stage("vq_residual", [&] {
+            std::tie(dictDiff, idxDiff) = VQGenerateDictFast<float, 3 * blockW * blockH, uint16_t>
+                (blocksDiff, 256, iterations);
+        });
+        stage("vq_residual_parallel", [&] {
+            VQGenerateDictParallel<float, 3 * blockW * blockH, uint16_t>(
+                blocksDiff, 256, trainOptions, pool);
+        });
+
+        bool saved;
+        stage("save", [&] {
+            saved = save(tempPath.c_str(), dictPalette, idxPalette, dictDiff, idxDiff,
+                imageBlocks->nBlocksX, imageBlocks->nBlocksY, width, height);
+        });
+        if (!saved) {
+            printf("Could not write %s.\n", tempPath.c_str());
+            return 1;
+        }
+
+        // Baseline float decoder.
+        std::unique_ptr<IV1File> inputImage;
+        stage("iv1file_load", [&] {
+            inputImage = std::make_unique<IV1File>(tempPath.c_str());
+        });
+
+        std::unique_ptr<BlockImage<blockW, blockH>> imgDiff;
+        stage("block_image_from_dict", [&] {
+            imgDiff = std::make_unique<BlockImage<blockW, blockH>>(inputImage->dict1,
+                inputImage->indices1, inputImage->header.nBlocksX, inputImage->header.nBlocksY);
+        });
+
+        // Every run has to start from the residuals, so the sum goes
+        //  elsewhere until the stage is done.
+        FlexMatrix<float, 3 * blockW * blockH> imgSum;
+        stage("block_rgb_add_mean", [&] {
+            const auto imgBase = VQDecode(inputImage->dict0, inputImage->indices0);
+            imgSum = BlockRGBAddMean<float, 3 * blockW * blockH>(imgDiff->data, imgBase);
+        });
+        imgDiff->data = std::move(imgSum);
+
+        Support::RGB8Image decodedImage;
+        stage("to_rgb8_image", [&] {
+            decodedImage = imgDiff->toRGB8Image();
+        });
+
+        // Integer decoders.
+        std::vector<uint8_t> pixels(width * height * 3);
+        stage("fast_decode", [&] {
+            const IV1View view(tempPath.c_str());
+            DecodeRGB8(view.planes(), pixels.data(), width * 3);
+        });
+
+        stage("strip_decode", [&] {
+            StripDecoder decoder(tempPath.c_str());
+            decoder.decode([](const uint8_t*, size_t, size_t) {});
+        });
+
+        // Entropy-coded index planes: coding both, then parsing the stream,
+        //  which decodes them.
+        std::vector<uint8_t> codedStream;
+        stage("coded_indices_encode", [&] {
+            codedStream.clear();
+            SerializeIV1Coded(codedStream, dictPalette, idxPalette, dictDiff, idxDiff,
+                imageBlocks->nBlocksX, imageBlocks->nBlocksY, width, height);
+        });
+        stage("coded_indices_decode", [&] {
+            IV1Planes planes;
+            ParseIV1Stream(codedStream.data(), codedStream.size(), planes);
+        });
+    }
+
+    std::filesystem::remove(tempPath);
+
+    if (json) {
+        printf("[\n");
+        for (size_t idx = 0; idx != results.size(); ++idx) {
+            const auto& result = results[idx];
+            printf("  {\"size\": \"%s\", \"width\": %zu, \"height\": %zu, \"stage\": \"%s\", "
+                   "\"seconds\": %.6f, \"mp_per_s\": %.3f, \"bytes_allocated\": %llu, "
+                   "\"allocations\": %llu}%s\n",
+                result.size.c_str(), result.width, result.height, result.stage.c_str(),
+                result.seconds, result.width * result.height / 1e6 / result.seconds,
+                (unsigned long long) result.bytes, (unsigned long long) result.allocations,
+                idx + 1 == results.size() ? "" : ",");
+        }
+        printf("]\n");
+    }
+    else {
+        printf("size,width,height,stage,seconds,mp_per_s,bytes_allocated,allocations\n");
+        for (const auto& result : results) {
+            printf("%s,%zu,%zu,%s,%.6f,%.3f,%llu,%llu\n",
+                result.size.c_str(), result.width, result.height, result.stage.c_str(),
+                result.seconds, result.width * result.height / 1e6 / result.seconds,
+                (unsigned long long) result.bytes, (unsigned long long) result.allocations);
+        }
+    }
+
+    return 0;
+}
@@ -3,39 +3,285 @@
 #define VQLIB_VERBOSE_OUTPUT 1
 
 #include "VQLib/C++/VQAlgorithm.h"
+#include "Support/ImageIO.h"
 #include "Support/PNGLoader.h"
 
 #include "IV1BlockImage.h"
+#include "IV1CommandLine.h"
+#include "IV1FastDecode.h"
 #include "IV1File.h"
+#include "IV1Kernels.h"
+#include "IV1Library.h"
+#include "IV1Stats.h"
+#include "IV1StripDecode.h"
+#include "IV1Tiled.h"
+#include "IV1View.h"
 
 #include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
 using namespace VQLib;
 using namespace IV1;
 
+// Writes `image` out to `outputPath`, then reports `stats`. Returns the
+//  exit code for main.
+static int WriteDecodedImage(const CommandLine& cmdLine, const char* outputPath,
+                             const Support::RGB8Image& image,
+                             const Support::PNGWriteOptions& pngOptions, Stats& stats) {
+    fprintf(ProgressStream(cmdLine, outputPath), "Writing to image %s...\n", outputPath);
+    bool written;
+    stats.time("write_png", [&] { written = Support::SaveImage(outputPath, image, pngOptions); });
+    if (!written) {
+        printf("Could not write %s.\n", outputPath);
+        return 1;
+    }
+    ReportStats(cmdLine, stats, outputPath);
+    return 0;
+}
 
 int main(int argc, char **args) {
     constexpr size_t blockW = 4;
     constexpr size_t blockH = 4;
-    if (argc < 2) {
-        printf("Usage: IV1dec(.exe) image_input.iv1 image_output.png");
+    const CommandLine cmdLine(argc, args, {"--reference", "--stats"});
+    if (cmdLine.positional.size() < 2) {
+        printf("Usage: IV1dec(.exe) [--reference [--isa name]] [--crop x,y,width,height] "
+               "[--scale 1/2|1/4]\n"
+               "       [--tile x,y] [--threads N] [--dict pack.iv1p] [--png-level N|fast|store]\n"
+               "       [--png-filter name] [--stats] [--stats-json path] "
+               "image_input.iv1 image_output.png|.ppm|.pam|-\n");
+        return 1;
+    }
+    const auto inputPath = cmdLine.positional[0];
+    const auto outputPath = cmdLine.positional[1];
+    if (cmdLine.has("--isa") && !SetISA(cmdLine.get("--isa", "auto"))) {
+        printf("Unsupported instruction set %s; use scalar, sse2, avx2, avx512 or auto.\n",
+            cmdLine.get("--isa", ""));
+        return 1;
+    }
+
+    Support::PNGWriteOptions pngOptions;
+    if (!PNGWriteOptionsFromCommandLine(cmdLine, pngOptions)) {
+        printf("--png-level expects 0-9, fast or store; --png-filter expects default, none, "
+               "sub, up, average, paeth or all.\n");
+        return 1;
+    }
+
+    // Only needed for files encoded against a pack; it must be the same one.
+    std::unique_ptr<IV1DictionaryPack> pack;
+    if (cmdLine.has("--dict")) {
+        pack = std::make_unique<IV1DictionaryPack>();
+        if (const char* error = LoadIV1Pack(cmdLine.get("--dict", ""), *pack)) {
+            printf("%s: %s\n", cmdLine.get("--dict", ""), error);
+            return 1;
+        }
+    }
+
+    Stats stats;
+
+    // Tiled containers decode whole through libiv1 below, or one tile on
+    //  its own here.
+    const bool tiled = IsTiledIV1File(inputPath);
+    if (tiled && (cmdLine.has("--reference") || cmdLine.has("--crop") || cmdLine.has("--scale"))) {
+        printf("Tiled files only support --tile.\n");
+        return 1;
+    }
+    if (tiled && cmdLine.has("--tile")) {
+        size_t tileX, tileY;
+        if (sscanf(cmdLine.get("--tile", ""), "%zu,%zu", &tileX, &tileY) != 2) {
+            printf("--tile expects x,y.\n");
+            return 1;
+        }
+
+        std::unique_ptr<IV1TiledView> inputImage;
+        stats.time("open", [&] { inputImage = std::make_unique<IV1TiledView>(inputPath, pack.get()); });
+        if (!inputImage->valid()) {
+            printf("%s: %s\n", inputPath, inputImage->errorMessage());
+            return 1;
+        }
+
+        IV1Planes planes;
+        if (const char* error = inputImage->tile(tileX, tileY, planes)) {
+            printf("%s: %s\n", inputPath, error);
+            return 1;
+        }
+        Support::RGB8Image decodedImage;
+        stats.time("decode", [&] { decodedImage = DecodeRGB8Image(planes); });
+
+        return WriteDecodedImage(cmdLine, outputPath, decodedImage, pngOptions, stats);
+    }
+
+    if (cmdLine.has("--reference")) {
+        // Float pipeline, kept around to validate the integer decoder against.
+        //  Parsing through a view covers pack references and coded planes.
+        std::unique_ptr<IV1File> inputImage;
+        const IV1View view(inputPath, pack.get());
+        if (!view.valid()) {
+            printf("%s: %s\n", inputPath, view.errorMessage());
+            return 1;
+        }
+        stats.time("read", [&] { inputImage = std::make_unique<IV1File>(view.planes()); });
+
+        Support::RGB8Image decodedImage;
+        stats.time("decode", [&] {
+            BlockImage<blockW, blockH> imgDiff(inputImage->dict1, inputImage->indices1,
+                           inputImage->header.nBlocksX, inputImage->header.nBlocksY);
+            auto imgBase = VQDecode(inputImage->dict0, inputImage->indices0);
+            imgDiff.data = BlockRGBAddMean<float, 3 * blockW * blockH>(imgDiff.data, imgBase);
+
+            decodedImage = imgDiff.toRGB8Image();
+        });
+
+        return WriteDecodedImage(cmdLine, outputPath, decodedImage, pngOptions, stats);
+    }
+
+    if (cmdLine.has("--scale")) {
+        const std::string scaleName = cmdLine.get("--scale", "");
+        const size_t scale = scaleName == "1/4" ? 4 : scaleName == "1/2" ? 2 : 0;
+        if (scale == 0 || cmdLine.has("--crop")) {
+            printf("--scale expects 1/2 or 1/4, and doesn't combine with --crop.\n");
+            return 1;
+        }
+
+        // At 1/4 only the header, dict0 and indices0 get paged in from the
+        //  mapping (or decoded, from coded planes); dict1 and indices1 are
+        //  never read.
+        std::unique_ptr<IV1View> inputImage;
+        stats.time("open", [&] {
+            inputImage = std::make_unique<IV1View>(inputPath, pack.get(), scale == 4);
+        });
+        if (!inputImage->valid()) {
+            printf("%s: %s\n", inputPath, inputImage->errorMessage());
+            return 1;
+        }
+
+        Support::RGB8Image decodedImage;
+        stats.time("decode", [&] {
+            decodedImage = DecodeScaledRGB8Image(inputImage->planes(), scale);
+        });
+
+        return WriteDecodedImage(cmdLine, outputPath, decodedImage, pngOptions, stats);
     }
 
-    IV1File inputImage(args[1]);
+    if (cmdLine.has("--crop")) {
+        size_t x, y, width, height;
+        if (sscanf(cmdLine.get("--crop", ""), "%zu,%zu,%zu,%zu", &x, &y, &width, &height) != 4) {
+            printf("--crop expects x,y,width,height.\n");
+            return 1;
+        }
+
+        // Only the dictionaries and the index rows under the rectangle
+        //  get paged in from the mapping.
+        std::unique_ptr<IV1View> inputImage;
+        stats.time("open", [&] { inputImage = std::make_unique<IV1View>(inputPath, pack.get()); });
+        if (!inputImage->valid()) {
+            printf("%s: %s\n", inputPath, inputImage->errorMessage());
+            return 1;
+        }
+
+        Support::RGB8Image decodedImage;
+        stats.time("decode", [&] {
+            decodedImage = DecodeRegionRGB8Image(inputImage->planes(), x, y, width, height);
+        });
+        if (decodedImage.pixels.empty()) {
+            printf("Crop rectangle falls outside the %ux%u image.\n",
+                inputImage->header().actualW, inputImage->header().actualH);
+            return 1;
+        }
+
+        return WriteDecodedImage(cmdLine, outputPath, decodedImage, pngOptions, stats);
+    }
 
-    BlockImage<blockW, blockH> imgDiff(inputImage.dict1, inputImage.indices1,
-                   inputImage.header.nBlocksX, inputImage.header.nBlocksY);
-    auto imgBase = VQDecode(inputImage.dict0, inputImage.indices0);
-    imgDiff.data = BlockRGBAddMean<float, 3 * blockW * blockH>(imgDiff.data, imgBase);
+    // Tiles or bands of block rows decode concurrently on every core unless
+    //  --threads says otherwise, as in IV1enc.
+    const size_t nThreads = cmdLine.getSize("--threads", std::thread::hardware_concurrency());
 
-    const auto decodedImage = imgDiff.toRGB8Image();
+    // Tiled containers decode whole through libiv1 (see libiv1.h).
+    if (tiled) {
+        const iv1_decode_options decodeOptions = {nThreads};
+        Decoder decoder(&decodeOptions);
+        if (cmdLine.has("--dict")) {
+            const auto packBytes = ReadIV1Bytes(cmdLine.get("--dict", ""));
+            if (decoder.setPack(packBytes.data(), packBytes.size()) != IV1_OK) {
+                printf("%s: %s\n", cmdLine.get("--dict", ""), decoder.errorMessage());
+                return 1;
+            }
+        }
 
-    printf("Writing to image %s...\n", args[2]);
-    const auto saveImagePath = args[2];
-    Support::SavePNG(saveImagePath, decodedImage);
+        std::vector<uint8_t> bytes;
+        stats.time("open", [&] { bytes = ReadIV1Bytes(inputPath); });
+        size_t width, height;
+        iv1_status status = decoder.info(bytes.data(), bytes.size(), width, height);
+        Support::RGB8Image decodedImage;
+        if (status == IV1_OK) {
+            decodedImage = {width, height, std::vector<uint8_t>(width * height * 3)};
+            stats.time("decode", [&] {
+                status = decoder.decode(bytes.data(), bytes.size(), decodedImage.pixels.data(),
+                    width * 3);
+            });
+        }
+        if (status != IV1_OK) {
+            printf("%s: %s\n", inputPath, decoder.errorMessage());
+            return 1;
+        }
+
+        return WriteDecodedImage(cmdLine, outputPath, decodedImage, pngOptions, stats);
+    }
+
+    // Strips go straight from the IV1 file to the image, so memory use only
+    //  depends on the image width (and the number of threads, which decode
+    //  a few block rows each per strip).
+    ThreadPool pool(nThreads);
+    std::unique_ptr<StripDecoder> decoder;
+    stats.time("open", [&] { decoder = std::make_unique<StripDecoder>(inputPath, pack.get()); });
+    if (!decoder->valid()) {
+        printf("%s is not a valid IV1 file%s.\n", inputPath,
+            pack ? " for this dictionary pack" : " (or needs --dict)");
+        return 1;
+    }
+
+    fprintf(ProgressStream(cmdLine, outputPath), "Writing to image %s...\n", outputPath);
+    const auto& header = decoder->fileHeader();
+    Support::ImageRowWriter writer(outputPath, header.actualW, header.actualH, pngOptions);
+    if (!writer.valid()) {
+        printf("Could not open %s for writing.\n", outputPath);
+        return 1;
+    }
+
+    // PNG writing happens inside the decode loop; its time is split out.
+    //  Rows after a failed write are still decoded, but not written.
+    double writeSeconds = 0.0;
+    bool complete, written = true;
+    stats.time("decode", [&] {
+        complete = decoder->decode(
+            [&](const uint8_t* pixels, size_t stride, size_t nRows) {
+                const auto start = std::chrono::steady_clock::now();
+                for (size_t row = 0; row != nRows && written; ++row) {
+                    written = writer.writeRow(pixels + row * stride);
+                }
+                writeSeconds += std::chrono::duration<double>(
+                    std::chrono::steady_clock::now() - start).count();
+            }, &pool);
+    });
+    stats.time("write_png", [&] { written = writer.finish() && written; });
+    stats.addTime("decode", -writeSeconds);
+    stats.addTime("write_png", writeSeconds);
+    if (!complete) {
+        printf("%s is truncated.\n", inputPath);
+        return 1;
+    }
+    if (!written) {
+        printf("Could not write %s.\n", outputPath);
+        return 1;
+    }
 
+    ReportStats(cmdLine, stats, outputPath);
     return 0;
 }
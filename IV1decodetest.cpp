@@ -0,0 +1,194 @@
+// Checks that the decoders agree on one stream: the integer decoder
+//  (DecodeRGB8Image) against the float --reference pipeline to within one
+//  level, the 16-bit fixed point's rounding; and its band, strip and region
+//  variants, plain and coded, against it exactly. 1/2-scale thumbnails are
+//  checked against 2x2 means of the reference. Prints what failed and
+//  returns 1, or returns 0.
+
+#include "VQLib/C++/VQAlgorithm.h"
+
+#include "IV1BlockImage.h"
+#include "IV1Encode.h"
+#include "IV1FastDecode.h"
+#include "IV1File.h"
+#include "IV1Kernels.h"
+#include "IV1StripDecode.h"
+#include "IV1ThreadPool.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using namespace VQLib;
+using namespace IV1;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++failures; \
+        } \
+    } while (0)
+
+// Odd-sized, so that the last blocks are partial and padded.
+static constexpr size_t Width = 157, Height = 93;
+
+static Support::RGB8Image SyntheticImage() {
+    Support::RGB8Image image = {Width, Height, std::vector<uint8_t>(Width * Height * 3)};
+    for (size_t y = 0; y != Height; ++y) {
+        for (size_t x = 0; x != Width; ++x) {
+            uint8_t* pixel = &image.pixels[(y * Width + x) * 3];
+            pixel[0] = uint8_t(x * 255 / Width);
+            pixel[1] = uint8_t(y * 255 / Height);
+            pixel[2] = uint8_t(((x / 8 + y / 8) % 2) * 128 + (x * y) % 64);
+        }
+    }
+    return image;
+}
+
+// The float pipeline behind IV1dec --reference, cropped from whole blocks
+//  to the actual image size.
+static Support::RGB8Image ReferenceDecode(const IV1Planes& planes) {
+    constexpr size_t blockW = 4;
+    constexpr size_t blockH = 4;
+    const IV1File file(planes);
+    BlockImage<blockW, blockH> imgDiff(file.dict1, file.indices1,
+        file.header.nBlocksX, file.header.nBlocksY);
+    auto imgBase = VQDecode(file.dict0, file.indices0);
+    imgDiff.data = BlockRGBAddMean<float, 3 * blockW * blockH>(imgDiff.data, imgBase);
+    const auto blocks = imgDiff.toRGB8Image();
+
+    Support::RGB8Image image = {file.header.actualW, file.header.actualH, {}};
+    for (size_t y = 0; y != image.height; ++y) {
+        const uint8_t* row = &blocks.pixels[y * blocks.width * 3];
+        image.pixels.insert(image.pixels.end(), row, row + image.width * 3);
+    }
+    return image;
+}
+
+// Decodes the stream at `path` with a StripDecoder, on `pool` if given.
+static Support::RGB8Image StripDecode(const char* path, ThreadPool* pool) {
+    StripDecoder decoder(path);
+    CHECK(decoder.valid());
+    Support::RGB8Image image = {decoder.fileHeader().actualW, decoder.fileHeader().actualH, {}};
+    const bool complete = decoder.decode([&](const uint8_t* pixels, size_t stride, size_t nRows) {
+        for (size_t row = 0; row != nRows; ++row) {
+            image.pixels.insert(image.pixels.end(), pixels + row * stride,
+                pixels + row * stride + image.width * 3);
+        }
+    }, pool);
+    CHECK(complete);
+    return image;
+}
+
+static bool SameImage(const Support::RGB8Image& a, const Support::RGB8Image& b) {
+    return a.width == b.width && a.height == b.height && a.pixels == b.pixels;
+}
+
+static int MaxDifference(const Support::RGB8Image& a, const Support::RGB8Image& b) {
+    int maxDiff = 0;
+    for (size_t idx = 0; idx != a.pixels.size(); ++idx) {
+        maxDiff = std::max(maxDiff, std::abs(int(a.pixels[idx]) - int(b.pixels[idx])));
+    }
+    return maxDiff;
+}
+
+// Checks the 1/2-scale decode against 2x2 means of `reference`, leaving out
+//  groups with a clipped sample, where the mean of the clipped pixels isn't
+//  the clipped mean. Scaled residuals are rounded once more, so two levels.
+static void CheckHalfScale(const IV1Planes& planes, const Support::RGB8Image& reference) {
+    const auto scaled = DecodeScaledRGB8Image(planes, 2);
+    CHECK(scaled.width == (Width + 1) / 2 && scaled.height == (Height + 1) / 2);
+    int maxDiff = 0;
+    for (size_t y = 0; y != Height / 2; ++y) {
+        for (size_t x = 0; x != Width / 2; ++x) {
+            for (size_t ch = 0; ch != 3; ++ch) {
+                int sum = 0;
+                bool clipped = false;
+                for (size_t dy = 0; dy != 2; ++dy) {
+                    for (size_t dx = 0; dx != 2; ++dx) {
+                        const size_t pixel = (2 * y + dy) * Width + 2 * x + dx;
+                        const int sample = reference.pixels[pixel * 3 + ch];
+                        clipped |= sample == 0 || sample == 255;
+                        sum += sample;
+                    }
+                }
+                if (!clipped) {
+                    const int scaledSample = scaled.pixels[(y * scaled.width + x) * 3 + ch];
+                    const int diff = std::abs(4 * scaledSample - sum);
+                    maxDiff = std::max(maxDiff, (diff + 2) / 4);
+                }
+            }
+        }
+    }
+    CHECK(maxDiff <= 2);
+}
+
+int main() {
+    const auto image = SyntheticImage();
+    EncodeOptions options;
+    EncodePreset("fast", options);
+    ThreadPool pool(3);
+    EncodeScratch scratch;
+    EncodedImage encoded;
+    EncodeImage(image, encoded, scratch, pool, options);
+
+    std::vector<uint8_t> bytes, codedBytes;
+    encoded.serialize(bytes);
+    encoded.codedIndices = true;
+    encoded.serialize(codedBytes);
+
+    IV1Planes planes;
+    CHECK(ParseIV1Stream(bytes.data(), bytes.size(), planes) == nullptr);
+
+    // The integer decoder rounds once, in 16-bit fixed point; the float
+    //  pipeline rounds at the end.
+    const auto reference = ReferenceDecode(planes);
+    const auto fast = DecodeRGB8Image(planes);
+    CHECK(fast.width == Width && fast.height == Height);
+    CHECK(reference.width == Width && reference.height == Height);
+    CHECK(MaxDifference(fast, reference) <= 1);
+
+    // Bands and regions decode the same tiles as the whole-image decoder.
+    CHECK(SameImage(DecodeRGB8Image(planes, pool), fast));
+    CHECK(SameImage(DecodeRegionRGB8Image(planes, 0, 0, Width, Height), fast));
+    const auto region = DecodeRegionRGB8Image(planes, 13, 7, 50, 41);
+    bool regionMatches = region.width == 50 && region.height == 41;
+    for (size_t y = 0; regionMatches && y != region.height; ++y) {
+        regionMatches = memcmp(&region.pixels[y * 50 * 3],
+            &fast.pixels[((7 + y) * Width + 13) * 3], 50 * 3) == 0;
+    }
+    CHECK(regionMatches);
+    CHECK(DecodeRegionRGB8Image(planes, 100, 0, 58, 1).pixels.empty());
+
+    // Coded index planes decode to the same pixels.
+    IV1Planes codedPlanes;
+    CHECK(ParseIV1Stream(codedBytes.data(), codedBytes.size(), codedPlanes) == nullptr);
+    CHECK(SameImage(DecodeRGB8Image(codedPlanes), fast));
+
+    CheckHalfScale(planes, reference);
+
+    // Strips, serial and in bands, from plain and coded files.
+    const auto directory = std::filesystem::temp_directory_path();
+    const std::string path = (directory / "IV1decodetest.iv1").string();
+    const std::string codedPath = (directory / "IV1decodetest_coded.iv1").string();
+    CHECK(SaveIV1Bytes(path.c_str(), bytes));
+    CHECK(SaveIV1Bytes(codedPath.c_str(), codedBytes));
+    CHECK(SameImage(StripDecode(path.c_str(), nullptr), fast));
+    CHECK(SameImage(StripDecode(path.c_str(), &pool), fast));
+    CHECK(SameImage(StripDecode(codedPath.c_str(), &pool), fast));
+    std::filesystem::remove(path);
+    std::filesystem::remove(codedPath);
+
+    if (failures != 0) {
+        printf("%d checks failed.\n", failures);
+        return 1;
+    }
+    printf("All checks passed.\n");
+    return 0;
+}
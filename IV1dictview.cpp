@@ -1,12 +1,11 @@
 // Implementation of IV1 (Image-VQ 1, or "Ivy-One") codec in C++, based off of MatLAB source.
 
-#define VQLIB_VERBOSE_OUTPUT 1
-
-#include "VQLib/C++/VQAlgorithm.h"
+#include "Support/ImageIO.h"
 #include "Support/PNGLoader.h"
 
-#include "IV1BlockImage.h"
-#include "IV1File.h"
+#include "IV1CommandLine.h"
+#include "IV1FastDecode.h"
+#include "IV1View.h"
 
 #include <algorithm>
 #include <cassert>
@@ -20,39 +19,53 @@ using namespace IV1;
 int main(int argc, char **args) {
     constexpr size_t blockW = 4;
     constexpr size_t blockH = 4;
-    if (argc < 2) {
-        printf("Usage: IV1dictview(.exe) image_input.iv1 image_output.png");
+    const CommandLine cmdLine(argc, args);
+    if (cmdLine.positional.size() < 2) {
+        printf("Usage: IV1dictview(.exe) [--dict pack.iv1p] image_input.iv1 image_output.png|.ppm|.pam\n");
+        return 1;
     }
+    const auto inputPath = cmdLine.positional[0];
+    const auto outputPath = cmdLine.positional[1];
 
-    IV1File inputImage(args[1]);
-
-    const auto idxDict0 = []{
-        constexpr size_t numBlocks = 256 * 256;
-        std::vector<uint16_t> idxDict0(numBlocks);
-        for (auto x = 0u; x != numBlocks; ++x) {
-            idxDict0[x] = x & 255;
-        }
-        return idxDict0;
-    }();
-
-    const auto idxDict1 = []{
-        constexpr size_t numBlocks = 256 * 256;
-        std::vector<uint16_t> idxDict1(numBlocks);
-        for (auto x = 0u; x != numBlocks; ++x) {
-            idxDict1[x] = x >> 8;
+    // Files encoded against a pack show the pack's dictionaries.
+    IV1DictionaryPack pack;
+    if (cmdLine.has("--dict")) {
+        if (const char* error = LoadIV1Pack(cmdLine.get("--dict", ""), pack)) {
+            printf("%s: %s\n", cmdLine.get("--dict", ""), error);
+            return 1;
         }
-        return idxDict1;
-    }();
+    }
+
+    // Only the two dictionaries are read out of the mapping.
+    const IV1View inputImage(inputPath, cmdLine.has("--dict") ? &pack : nullptr);
+    if (!inputImage.valid()) {
+        printf("%s: %s\n", inputPath, inputImage.errorMessage());
+        return 1;
+    }
+
+    // Tile (x, y) of the output shows palette entry x plus residual entry y.
+    uint8_t idxDict0[256];
+    for (auto x = 0u; x != 256; ++x) {
+        idxDict0[x] = x;
+    }
 
-    BlockImage<blockW, blockH> imgDiff(inputImage.dict1, idxDict1, 256, 256);
-    auto imgBase = VQDecode(inputImage.dict0, idxDict0);
-    imgDiff.data = BlockRGBAddMean<float, 3 * blockW * blockH>(imgDiff.data, imgBase);
+    const FastDecodeTables tables(inputImage.dict0().data, inputImage.dict1().data);
 
-    const auto decodedImage = imgDiff.toRGB8Image();
+    Support::RGB8Image decodedImage;
+    decodedImage.width = 256 * blockW;
+    decodedImage.height = 256 * blockH;
+    decodedImage.pixels.resize(decodedImage.width * decodedImage.height * 3);
+
+    const size_t stride = decodedImage.width * 3;
+    for (auto y = 0u; y != 256; ++y) {
+        uint8_t idxDict1[256];
+        std::fill_n(idxDict1, 256, uint8_t(y));
+        tables.decodeBlockRow(idxDict0, idxDict1, 256, decodedImage.width, blockH,
+            &decodedImage.pixels[y * blockH * stride], stride);
+    }
 
-    printf("Writing to image %s...\n", args[2]);
-    const auto saveImagePath = args[2];
-    Support::SavePNG(saveImagePath, decodedImage);
+    printf("Writing to image %s...\n", outputPath);
+    Support::SaveImage(outputPath, decodedImage);
 
     return 0;
 }
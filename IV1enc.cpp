@@ -6,46 +6,333 @@
 #include "Support/PNGLoader.h"
 
 #include "IV1BlockImage.h"
+#include "IV1CommandLine.h"
+#include "IV1Encode.h"
 #include "IV1File.h"
+#include "IV1Kernels.h"
+#include "IV1Library.h"
+#include "IV1Stats.h"
+#include "IV1ThreadPool.h"
+#include "IV1VQ.h"
+#include "IV1View.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
 using namespace VQLib;
 using namespace IV1;
 
+namespace fs = std::filesystem;
+
+// Encodes every image listed in `listOrDir` (a text file with one path per
+//  line, or a directory) into `outputDir`. Whole images are handed out to
+//  `nWorkers` threads, each of which keeps its own scratch buffers from one
+//  image to the next; with images at different stages on different
+//  threads, image decoding, blocking, training and writing all overlap. A
+//  time budget in `options` applies to each image separately. With
+//  `shared` dictionaries, every image is encoded against them instead.
+static int EncodeBatch(const char* listOrDir, const char* outputDir, size_t nWorkers,
+                       const EncodeOptions& options, const SharedDictionaries* shared) {
+    const auto inputs = ListInputImages(listOrDir);
+    fs::create_directories(outputDir);
+
+    std::atomic<size_t> nextImage{0};
+    std::atomic<size_t> nEncoded{0}, nFailed{0};
+    std::atomic<uint64_t> rawBytes{0}, encodedBytes{0};
+
+    const auto start = std::chrono::steady_clock::now();
+
+    auto worker = [&] {
+        ThreadPool pool(1);
+        EncodeScratch scratch;
+        EncodedImage encoded;
+        encoded.codedIndices = options.codedIndices;
+
+        for (size_t idx = nextImage++; idx < inputs.size(); idx = nextImage++) {
+            const auto& inputPath = inputs[idx];
+            if (!EncodeImageFile(inputPath.string().c_str(), encoded, scratch, pool, options, shared)) {
+                printf("Could not read %s, skipping.\n", inputPath.string().c_str());
+                ++nFailed;
+                continue;
+            }
+
+            const auto outputPath = fs::path(outputDir) / inputPath.stem().concat(".iv1");
+            const size_t written = encoded.save(outputPath.string().c_str());
+            if (written == 0) {
+                printf("Could not write %s.\n", outputPath.string().c_str());
+                ++nFailed;
+                continue;
+            }
+
+            ++nEncoded;
+            rawBytes += size_t(encoded.actualW) * encoded.actualH * 3;
+            encodedBytes += written;
+        }
+    };
+
+    std::vector<std::thread> workers;
+    for (size_t idx = 1; idx < std::max<size_t>(nWorkers, 1); ++idx) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : workers) {
+        thread.join();
+    }
+
+    const double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    const double rawMB = rawBytes / 1e6;
+    printf("Encoded %zu images (%zu failed) in %.2fs: %.2f images/s, "
+           "%.2f MB/s of RGB input, %.2f MB written.\n",
+        size_t(nEncoded), size_t(nFailed), seconds, nEncoded / seconds,
+        rawMB / seconds, encodedBytes / 1e6);
+
+    return nFailed == 0 ? 0 : 1;
+}
+
+// Encodes the PNGs listed in `listOrDir` in order, as the frames of one
+//  sequence: each frame's training starts from the dictionaries of the
+//  frame before and refines them in at most `refineIterations` assignment
+//  passes each (the iterations --stats reports). The first frame starts
+//  from the seeds in `options`, if any, with the full iteration budget.
+//  Frames depend on each other, so they're encoded one at a time, with
+//  `pool` splitting up the work within each.
+static int EncodeSequence(const char* listOrDir, const char* outputDir, ThreadPool& pool,
+                          EncodeOptions options, size_t refineIterations) {
+    const auto inputs = ListInputImages(listOrDir);
+    fs::create_directories(outputDir);
+
+    EncodeScratch scratch;
+    EncodedImage encoded;
+    encoded.codedIndices = options.codedIndices;
+    FlexMatrix<float, 3> previousPalette;
+    FlexMatrix<float, 48> previousDiff;
+    size_t nEncoded = 0, nFailed = 0;
+    size_t totalIterations = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (const auto& inputPath : inputs) {
+        Stats frameStats;
+        if (!EncodeImageFile(inputPath.string().c_str(), encoded, scratch, pool, options,
+                             nullptr, &frameStats)) {
+            printf("Could not read %s, skipping.\n", inputPath.string().c_str());
+            ++nFailed;
+            continue;
+        }
+
+        const auto outputPath = fs::path(outputDir) / inputPath.stem().concat(".iv1");
+        if (encoded.save(outputPath.string().c_str()) == 0) {
+            printf("Could not write %s.\n", outputPath.string().c_str());
+            ++nFailed;
+            continue;
+        }
+
+        const size_t paletteIterations = size_t(frameStats.get("palette_iterations"));
+        const size_t residualIterations = size_t(frameStats.get("residual_iterations"));
+        printf("%s: %zu palette + %zu residual iterations\n", outputPath.string().c_str(),
+            paletteIterations, residualIterations);
+        totalIterations += paletteIterations + residualIterations;
+        ++nEncoded;
+
+        previousPalette = encoded.dictPalette;
+        previousDiff = encoded.dictDiff;
+        options.seedPalette = &previousPalette;
+        options.seedDiff = &previousDiff;
+        options.maxIterations = std::min(options.maxIterations, refineIterations);
+    }
+
+    const double seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+    printf("Encoded %zu frames (%zu failed) in %.2fs: %.2f frames/s, "
+           "%.1f iterations per frame.\n",
+        nEncoded, nFailed, seconds, nEncoded / seconds,
+        double(totalIterations) / std::max<size_t>(nEncoded, 1));
+
+    return nFailed == 0 ? 0 : 1;
+}
+
 int main(int argc, char **args) {
-    constexpr size_t blockW = 4;
-    constexpr size_t blockH = 4;
-    if (argc < 3) {
-        printf("Usage: IV1enc(.exe) image_input.png image_output.iv1");
+    const CommandLine cmdLine(argc, args, {"--stats", "--compact", "--histogram-palette", "--coded-indices"});
+    const bool batch = cmdLine.has("--batch") || cmdLine.has("--sequence");
+    if (cmdLine.positional.size() < (batch ? 1 : 2)) {
+        printf("Usage: IV1enc(.exe) [--threads N] [--isa name] [--preset fast|default|max]\n"
+               "       [--max-iterations N] [--converge X] [--time-budget seconds] [--train-blocks N]\n"
+               "       [--compact] [--seed-from previous.iv1] [--dict pack.iv1p] [--tile-size N]\n"
+               "       [--histogram-palette] [--seeding spread|kmeans++|split|pca] [--coded-indices]\n"
+               "       [--stats] [--stats-json path] "
+               "image_input.png|.ppm|.pam|- image_output.iv1\n"
+               "       IV1enc(.exe) [--threads N] [--preset ...] [--dict pack.iv1p] [--coded-indices] "
+               "--batch list.txt|input_dir output_dir\n"
+               "       IV1enc(.exe) [--threads N] [--preset ...] [--seed-from first.iv1] "
+               "[--refine-iterations N]\n"
+               "       --sequence list.txt|input_dir output_dir\n");
+        return 1;
     }
 
-    printf("Reading image %s...", args[1]);
-    const auto imagePath = args[1];
-    const auto imageBlocks = BlockImage<blockW, blockH>(Support::LoadPNG(imagePath));
-    if (imageBlocks.nBlocksX == 0 || imageBlocks.nBlocksY == 0) {
-        return 0;
+    if (cmdLine.has("--isa") && !SetISA(cmdLine.get("--isa", "auto"))) {
+        printf("Unsupported instruction set %s; use scalar, sse2, avx2, avx512 or auto.\n",
+            cmdLine.get("--isa", ""));
+        return 1;
     }
 
-    const auto blocksPalette = BlockRGBMean<float, 3 * blockW * blockH>(imageBlocks.data);
-    const auto [dictPalette, idxPalette] = VQGenerateDictFast<float, 3, uint16_t>
-                (blocksPalette, 256, 1000);
-    const auto imgPalette = BlockImage<1, 1>(dictPalette, idxPalette, 
-                imageBlocks.nBlocksX, imageBlocks.nBlocksY);
+    // Defaults to every core; the output doesn't depend on the thread count.
+    const size_t nThreads = cmdLine.getSize("--threads", std::thread::hardware_concurrency());
+
+    EncodeOptions options;
+    if (!EncodeOptionsFromCommandLine(cmdLine, options)) {
+        printf("Unknown preset %s or seeding %s; use fast, default or max, and spread, kmeans++, "
+               "split or pca.\n", cmdLine.get("--preset", "default"), cmdLine.get("--seeding", "spread"));
+        return 1;
+    }
 
-    const auto blocksDiff = BlockRGBSubtractMean<float, 3 * blockW * blockH>(imageBlocks.data, imgPalette.data);
-    const auto [dictDiff, idxDiff] = VQGenerateDictFast<float, 3 * blockW * blockH, uint16_t>(blocksDiff, 256, 1000);
-    auto imgDiff = BlockImage<blockW, blockH>(dictDiff, idxDiff, 
-                imageBlocks.nBlocksX, imageBlocks.nBlocksY);
+    // A pack replaces training altogether; it's loaded once, however many
+    //  images are encoded against it.
+    std::unique_ptr<SharedDictionaries> shared;
+    if (cmdLine.has("--dict")) {
+        IV1DictionaryPack pack;
+        if (const char* error = LoadIV1Pack(cmdLine.get("--dict", ""), pack)) {
+            printf("%s: %s\n", cmdLine.get("--dict", ""), error);
+            return 1;
+        }
+        shared = std::make_unique<SharedDictionaries>(pack);
+    }
+
+    // Dictionaries of an earlier, similar image to start training from.
+    FlexMatrix<float, 3> seedPalette;
+    FlexMatrix<float, 48> seedDiff;
+    if (cmdLine.has("--seed-from")) {
+        const char* seedPath = cmdLine.get("--seed-from", "");
+        const IV1View seedImage(seedPath);
+        if (!seedImage.valid()) {
+            printf("%s: %s\n", seedPath, seedImage.errorMessage());
+            return 1;
+        }
+        const IV1File seed(seedImage.planes());
+        seedPalette = seed.dict0;
+        seedDiff = seed.dict1;
+        options.seedPalette = &seedPalette;
+        options.seedDiff = &seedDiff;
+    }
+
+    if (cmdLine.has("--sequence")) {
+        ThreadPool pool(nThreads);
+        return EncodeSequence(cmdLine.get("--sequence", ""), cmdLine.positional[0], pool,
+            options, cmdLine.getSize("--refine-iterations", 10));
+    }
+
+    if (batch) {
+        return EncodeBatch(cmdLine.get("--batch", ""), cmdLine.positional[0], nThreads,
+            options, shared.get());
+    }
+
+    const auto inputPath = cmdLine.positional[0];
+    const auto outputPath = cmdLine.positional[1];
+    ThreadPool pool(nThreads);
+
+    Stats stats;
+    FILE* progress = ProgressStream(cmdLine, outputPath);
+
+    // Single streams are blocked straight from the PNG's rows, unless the
+    //  PNG can't be read that way or the whole image is needed anyway.
+    fprintf(progress, "Reading image %s...", inputPath);
+    Support::PNGRowReader reader(inputPath);
+    const bool streamed = reader.valid() && !cmdLine.has("--tile-size") &&
+        (shared || !options.compactTraining);
+    Support::RGB8Image image;
+    if (!streamed) {
+        stats.time("read_png", [&] { image = Support::LoadImage(inputPath); });
+        if (image.width == 0 || image.height == 0) {
+            return 0;
+        }
+    }
+    const size_t width = streamed ? reader.width() : image.width;
+    const size_t height = streamed ? reader.height() : image.height;
 
     char savePath[1024];
-    snprintf(savePath, 1024, "%s.iv1", args[2]);
-    printf("Saving compressed outpus as %s...\n", savePath);
-    save(savePath, dictPalette, idxPalette, dictDiff, idxDiff, 
-        imgDiff.nBlocksX, imgDiff.nBlocksY, imgDiff.actualW, imgDiff.actualH);
+    snprintf(savePath, 1024, "%s.iv1", outputPath);
+
+    // Tiles get one thread each instead of sharing the pool.
+    const bool tooLarge = (width + 3) / 4 > 65535 || (height + 3) / 4 > 65535;
+    if (tooLarge && !cmdLine.has("--tile-size")) {
+        printf("Images over %zu pixels per side need --tile-size.\n", IV1MaxTileSize);
+        return 1;
+    }
+    if (cmdLine.has("--tile-size")) {
+        // Tiles go through libiv1 (see libiv1.h), which has no seeds; only
+        //  seeded ones are encoded here. A tile size of 0 would ask it for
+        //  a single stream instead.
+        const size_t tileSize = std::max<size_t>(cmdLine.getSize("--tile-size", 1024), 4);
+        std::vector<uint8_t> bytes;
+        if (options.seedPalette) {
+            EncodeTiledImage(image, tileSize, nThreads, options, shared.get(), bytes, &stats);
+        }
+        else {
+            const iv1_encode_options encodeOptions = LibraryEncodeOptions(options, tileSize, nThreads);
+            Encoder encoder(&encodeOptions);
+            if (shared) {
+                const auto pack = ReadIV1Bytes(cmdLine.get("--dict", ""));
+                if (encoder.setPack(pack.data(), pack.size()) != IV1_OK) {
+                    printf("%s: %s\n", cmdLine.get("--dict", ""), encoder.errorMessage());
+                    return 1;
+                }
+            }
+            bytes.resize(encoder.encodedSize(width, height));
+            size_t written = 0;
+            const iv1_status status = encoder.encode(image.pixels.data(), width, height,
+                width * 3, bytes.data(), bytes.size(), written, &stats);
+            if (status != IV1_OK) {
+                printf("%s: %s\n", inputPath, encoder.errorMessage());
+                return 1;
+            }
+            bytes.resize(written);
+        }
+
+        fprintf(progress, "Saving compressed outpus as %s...\n", savePath);
+        bool written;
+        stats.time("save", [&] { written = SaveIV1Bytes(savePath, bytes); });
+        if (!written) {
+            printf("Could not write %s.\n", savePath);
+            return 1;
+        }
+        ReportStats(cmdLine, stats, outputPath);
+        return 0;
+    }
+
+    EncodedImage encoded;
+    encoded.codedIndices = options.codedIndices;
+    EncodeScratch scratch;
+    if (streamed) {
+        if (!EncodePNGRows(reader, encoded, scratch, pool, options, shared.get(), &stats)) {
+            printf("%s is truncated.\n", inputPath);
+            return 1;
+        }
+    }
+    else if (shared) {
+        EncodeImageWithPack(image, encoded, scratch, pool, *shared, &stats);
+    }
+    else {
+        EncodeImage(image, encoded, scratch, pool, options, &stats);
+    }
+
+    fprintf(progress, "Saving compressed outpus as %s...\n", savePath);
+    size_t written;
+    stats.time("save", [&] { written = encoded.save(savePath); });
+    if (written == 0) {
+        printf("Could not write %s.\n", savePath);
+        return 1;
+    }
 
+    ReportStats(cmdLine, stats, outputPath);
     return 0;
 }
@@ -0,0 +1,222 @@
+// Checks the C interface of libiv1 (libiv1.h) from C: presets, encoding
+//  and decoding plain, coded, tiled and pack streams, and the errors for
+//  bad arguments and damaged streams. Prints what failed and returns 1,
+//  or returns 0.
+
+#include "libiv1.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            ++failures; \
+        } \
+    } while (0)
+
+// Odd-sized, so that the last blocks are partial, with rows padded past
+//  the pixels so that strides are exercised.
+enum { Width = 257, Height = 131, Stride = Width * 3 + 5 };
+
+static void FillImage(uint8_t* pixels) {
+    for (size_t y = 0; y != Height; ++y) {
+        for (size_t x = 0; x != Width; ++x) {
+            uint8_t* pixel = pixels + y * Stride + x * 3;
+            pixel[0] = (uint8_t) (x * 255 / Width);
+            pixel[1] = (uint8_t) (y * 255 / Height);
+            pixel[2] = (uint8_t) (((x / 8 + y / 8) % 2) * 128 + (x * y) % 64);
+        }
+    }
+}
+
+// Below 259, the PSNR is over 24 dB.
+static double MeanSquaredError(const uint8_t* a, const uint8_t* b) {
+    double squares = 0.0;
+    for (size_t y = 0; y != Height; ++y) {
+        for (size_t idx = 0; idx != Width * 3; ++idx) {
+            const double diff = (double) a[y * Stride + idx] - b[y * Stride + idx];
+            squares += diff * diff;
+        }
+    }
+    return squares / (Width * Height * 3);
+}
+
+// Encodes `pixels` with `options` (and `pack`, if any) into a new buffer,
+//  setting `*size`. Returns NULL, having reported why, on failure.
+static uint8_t* Encode(const iv1_encode_options* options, const uint8_t* pack, size_t packSize,
+                       const uint8_t* pixels, size_t* size) {
+    iv1_encoder* encoder = iv1_encoder_create(options);
+    CHECK(encoder != NULL);
+    if (!encoder) {
+        return NULL;
+    }
+    if (pack) {
+        CHECK(iv1_encoder_set_pack(encoder, pack, packSize) == IV1_OK);
+    }
+
+    // A capacity of 0 asks for the size needed.
+    const size_t capacity = iv1_encoded_size(encoder, Width, Height);
+    size_t needed = 0;
+    CHECK(iv1_encode(encoder, pixels, Width, Height, Stride, NULL, 0, &needed) ==
+        IV1_ERROR_BUFFER_TOO_SMALL);
+    CHECK(needed == capacity);
+
+    uint8_t* stream = malloc(capacity);
+    const iv1_status status = iv1_encode(encoder, pixels, Width, Height, Stride,
+        stream, capacity, size);
+    CHECK(status == IV1_OK);
+    CHECK(*size != 0 && *size <= capacity);
+    if (status != IV1_OK) {
+        printf("iv1_encode: %s\n", iv1_encoder_error(encoder));
+        free(stream);
+        stream = NULL;
+    }
+    iv1_encoder_destroy(encoder);
+    return stream;
+}
+
+// Decodes `stream` into `pixels`. Returns the status of iv1_decode.
+static iv1_status Decode(const uint8_t* pack, size_t packSize,
+                         const uint8_t* stream, size_t size, uint8_t* pixels) {
+    const iv1_decode_options options = {2};
+    iv1_decoder* decoder = iv1_decoder_create(&options);
+    CHECK(decoder != NULL);
+    if (!decoder) {
+        return IV1_ERROR_OUT_OF_MEMORY;
+    }
+    if (pack) {
+        CHECK(iv1_decoder_set_pack(decoder, pack, packSize) == IV1_OK);
+    }
+
+    size_t width = 0, height = 0;
+    CHECK(iv1_decode_info(decoder, stream, size, &width, &height) == IV1_OK);
+    CHECK(width == Width && height == Height);
+
+    const iv1_status status = iv1_decode(decoder, stream, size, pixels, Stride);
+    if (status != IV1_OK) {
+        CHECK(iv1_decoder_error(decoder) != NULL);
+    }
+    iv1_decoder_destroy(decoder);
+    return status;
+}
+
+// A pack (see IV1DictionaryPack in IV1File.h) made of the dictionaries of
+//  the plain stream `stream`: 'IVYP', the FNV-1a ID of both, then both.
+static uint8_t* PackFromStream(const uint8_t* stream, size_t* size) {
+    enum { HeaderSize = 16, Dict0Size = 256 * 3, Dict1Size = 256 * 48 };
+    const size_t nBlocks = (size_t) ((Width + 3) / 4) * ((Height + 3) / 4);
+    const uint8_t* dict0 = stream + HeaderSize;
+    const uint8_t* dict1 = dict0 + Dict0Size + nBlocks;
+
+    *size = 8 + Dict0Size + Dict1Size;
+    uint8_t* pack = malloc(*size);
+    memcpy(pack, "IVYP", 4);
+    memcpy(pack + 8, dict0, Dict0Size);
+    memcpy(pack + 8 + Dict0Size, dict1, Dict1Size);
+
+    uint32_t id = 2166136261u;
+    for (size_t idx = 8; idx != *size; ++idx) {
+        id = (id ^ pack[idx]) * 16777619u;
+    }
+    for (size_t byte = 0; byte != 4; ++byte) {
+        pack[4 + byte] = (uint8_t) (id >> (8 * byte));
+    }
+    return pack;
+}
+
+int main(void) {
+    iv1_encode_options options;
+    CHECK(iv1_encode_options_preset(&options, "no such preset") == 0);
+    CHECK(iv1_encode_options_preset(&options, NULL) == 1);
+    CHECK(iv1_encode_options_preset(&options, "fast") == 1);
+    options.threads = 2;
+
+    uint8_t* const image = calloc(Height, Stride);
+    uint8_t* const decoded = calloc(Height, Stride);
+    uint8_t* const decodedCoded = calloc(Height, Stride);
+    FillImage(image);
+
+    // Plain streams take exactly iv1_encoded_size bytes.
+    size_t size = 0;
+    uint8_t* const stream = Encode(&options, NULL, 0, image, &size);
+    if (!stream) {
+        return 1;
+    }
+    CHECK(Decode(NULL, 0, stream, size, decoded) == IV1_OK);
+    CHECK(MeanSquaredError(image, decoded) < 259.0);
+
+    // Coded index planes change how the stream is stored, not the pixels.
+    options.coded_indices = 1;
+    size_t codedSize = 0;
+    uint8_t* const coded = Encode(&options, NULL, 0, image, &codedSize);
+    if (coded) {
+        CHECK(codedSize < size);
+        CHECK(Decode(NULL, 0, coded, codedSize, decodedCoded) == IV1_OK);
+        CHECK(memcmp(decoded, decodedCoded, (size_t) Height * Stride) == 0);
+        free(coded);
+    }
+    options.coded_indices = 0;
+
+    // Tiled containers, with partial tiles along both edges.
+    options.tile_size = 32;
+    size_t tiledSize = 0;
+    uint8_t* const tiled = Encode(&options, NULL, 0, image, &tiledSize);
+    if (tiled) {
+        CHECK(Decode(NULL, 0, tiled, tiledSize, decodedCoded) == IV1_OK);
+        CHECK(MeanSquaredError(image, decodedCoded) < 259.0);
+        free(tiled);
+    }
+    options.tile_size = 0;
+
+    // Streams encoded against a pack only decode with it.
+    size_t packSize = 0;
+    uint8_t* const pack = PackFromStream(stream, &packSize);
+    size_t packedSize = 0;
+    uint8_t* const packed = Encode(&options, pack, packSize, image, &packedSize);
+    if (packed) {
+        CHECK(packedSize < size);
+        CHECK(Decode(pack, packSize, packed, packedSize, decodedCoded) == IV1_OK);
+        CHECK(MeanSquaredError(image, decodedCoded) < 259.0);
+        CHECK(Decode(NULL, 0, packed, packedSize, decodedCoded) == IV1_ERROR_INVALID_STREAM);
+        free(packed);
+    }
+    pack[8] ^= 1;
+    iv1_encoder* const encoder = iv1_encoder_create(&options);
+    CHECK(iv1_encoder_set_pack(encoder, pack, packSize) == IV1_ERROR_INVALID_ARGUMENT);
+    CHECK(iv1_encoder_error(encoder) != NULL);
+    free(pack);
+
+    // Bad arguments and damaged streams are reported, not crashed on.
+    size_t written = 0;
+    CHECK(iv1_encode(NULL, image, Width, Height, Stride, decoded, size, &written) ==
+        IV1_ERROR_INVALID_ARGUMENT);
+    CHECK(iv1_encode(encoder, image, Width, Height, Width, decoded, size, &written) ==
+        IV1_ERROR_INVALID_ARGUMENT);
+    iv1_encoder_destroy(encoder);
+
+    iv1_decoder* const decoder = iv1_decoder_create(NULL);
+    CHECK(iv1_decode(decoder, stream, 10, decoded, Stride) == IV1_ERROR_INVALID_STREAM);
+    CHECK(iv1_decode(decoder, stream, size - 1, decoded, Stride) == IV1_ERROR_INVALID_STREAM);
+    CHECK(iv1_decode(decoder, stream, size, decoded, Width) == IV1_ERROR_INVALID_ARGUMENT);
+    stream[0] = 'X';
+    CHECK(iv1_decode(decoder, stream, size, decoded, Stride) == IV1_ERROR_INVALID_STREAM);
+    CHECK(iv1_decoder_error(decoder) != NULL);
+    iv1_decoder_destroy(decoder);
+
+    free(stream);
+    free(image);
+    free(decoded);
+    free(decodedCoded);
+
+    if (failures != 0) {
+        printf("%d checks failed.\n", failures);
+        return 1;
+    }
+    printf("All checks passed.\n");
+    return 0;
+}
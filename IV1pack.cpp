@@ -0,0 +1,145 @@
+// Implementation of IV1 (Image-VQ 1, or "Ivy-One") codec in C++, based off of MatLAB source.
+
+#define VQLIB_VERBOSE_OUTPUT 1
+
+#include "VQLib/C++/VQAlgorithm.h"
+#include "Support/ImageIO.h"
+#include "Support/PNGLoader.h"
+
+#include "IV1BlockImage.h"
+#include "IV1CommandLine.h"
+#include "IV1Encode.h"
+#include "IV1File.h"
+#include "IV1Kernels.h"
+#include "IV1Stats.h"
+#include "IV1ThreadPool.h"
+#include "IV1VQ.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace VQLib;
+using namespace IV1;
+
+// Trains a dictionary pack over a corpus of images, for IV1enc --dict.
+//  Each image contributes the same share of the training blocks (a
+//  StratifiedSubset of its own), so large images don't drown out small
+//  ones. The palette is trained on their means; the residual dictionary
+//  on the blocks minus their palette color, with the palette already
+//  reduced to 8 bits as the decoder will see it.
+int main(int argc, char **args) {
+    constexpr size_t blockW = 4;
+    constexpr size_t blockH = 4;
+    const CommandLine cmdLine(argc, args, {"--stats"});
+    if (cmdLine.positional.size() < 2) {
+        printf("Usage: IV1pack(.exe) [--threads N] [--isa name] [--preset fast|default|max]\n"
+               "       [--max-iterations N] [--converge X] [--time-budget seconds] [--train-blocks N]\n"
+               "       [--seeding spread|kmeans++|split|pca] [--stats] [--stats-json path]\n"
+               "       list.txt|input_dir pack_output.iv1p\n");
+        return 1;
+    }
+
+    if (cmdLine.has("--isa") && !SetISA(cmdLine.get("--isa", "auto"))) {
+        printf("Unsupported instruction set %s; use scalar, sse2, avx2, avx512 or auto.\n",
+            cmdLine.get("--isa", ""));
+        return 1;
+    }
+
+    EncodeOptions options;
+    if (!EncodeOptionsFromCommandLine(cmdLine, options)) {
+        printf("Unknown preset %s or seeding %s; use fast, default or max, and spread, kmeans++, "
+               "split or pca.\n", cmdLine.get("--preset", "default"), cmdLine.get("--seeding", "spread"));
+        return 1;
+    }
+
+    const auto inputs = ListInputImages(cmdLine.positional[0]);
+    const auto outputPath = cmdLine.positional[1];
+    if (inputs.empty()) {
+        printf("No images found in %s.\n", cmdLine.positional[0]);
+        return 1;
+    }
+
+    ThreadPool pool(cmdLine.getSize("--threads", std::thread::hardware_concurrency()));
+    Stats stats;
+    FILE* progress = ProgressStream(cmdLine, outputPath);
+
+    const auto trainOptions = MakeTrainOptions(options);
+
+    // Subsets of the blocks and of their means are taken at the same
+    //  positions, so they stay paired.
+    const size_t perImage = options.residualTrainingBlocks == 0 ? SIZE_MAX
+        : std::max<size_t>(1, (options.residualTrainingBlocks + inputs.size() - 1) / inputs.size());
+
+    FlexMatrix<float, 48> blocks, blockSubset, trainingBlocks;
+    FlexMatrix<float, 3> blockMeans, meanSubset, trainingMeans;
+    size_t nImages = 0;
+    stats.time("gather", [&] {
+        for (const auto& inputPath : inputs) {
+            const auto image = Support::LoadImage(inputPath.string().c_str());
+            if (image.width == 0 || image.height == 0) {
+                fprintf(progress, "Could not read %s, skipping.\n", inputPath.string().c_str());
+                continue;
+            }
+            ++nImages;
+
+            FillBlocksAndMeans<blockW, blockH>(image, blocks, blockMeans);
+            StratifiedSubset(blocks, perImage, blockSubset);
+            StratifiedSubset(blockMeans, perImage, meanSubset);
+            trainingBlocks.insert(trainingBlocks.end(), blockSubset.begin(), blockSubset.end());
+            trainingMeans.insert(trainingMeans.end(), meanSubset.begin(), meanSubset.end());
+        }
+    });
+    if (trainingBlocks.size() < 256) {
+        printf("Need at least 256 blocks to train on, found %zu.\n", trainingBlocks.size());
+        return 1;
+    }
+    fprintf(progress, "Training on %zu blocks from %zu images...\n", trainingBlocks.size(), nImages);
+
+    IV1DictionaryPack pack;
+    VQScratch<float> vqScratch;
+    VQStats paletteStats, residualStats;
+
+    FlexMatrix<float, 3> dictPalette;
+    std::vector<uint16_t> idxPalette;
+    stats.time("vq_palette", [&] {
+        dictPalette = VQGenerateDictParallel<float, 3, uint16_t>(
+            trainingMeans, 256, trainOptions, pool, &vqScratch, &paletteStats).first;
+        QuantizeDict0(dictPalette, pack.dict0);
+        ExpandDict0(pack.dict0, dictPalette);
+    });
+
+    stats.time("residuals", [&] {
+        VQAssignParallel<float, 3, uint16_t>(trainingMeans, dictPalette, idxPalette, pool);
+        for (size_t idx = 0; idx != trainingMeans.size(); ++idx) {
+            trainingMeans[idx] = dictPalette[idxPalette[idx]];
+        }
+        BlockRGBSubtractMeanInto<float, 3 * blockW * blockH>(
+            trainingBlocks, trainingMeans, trainingBlocks);
+    });
+
+    stats.time("vq_residual", [&] {
+        const auto dictDiff = VQGenerateDictParallel<float, 48, uint16_t>(
+            trainingBlocks, 256, trainOptions, pool, &vqScratch, &residualStats).first;
+        QuantizeDict1(dictDiff, pack.dict1);
+    });
+
+    pack.id = IV1PackId(pack.dict0, pack.dict1);
+    fprintf(progress, "Saving dictionary pack %08x as %s...\n", pack.id, outputPath);
+    if (!SaveIV1Pack(outputPath, pack)) {
+        printf("Could not write %s.\n", outputPath);
+        return 1;
+    }
+
+    stats.set("images", double(nImages));
+    stats.set("training_blocks", double(trainingBlocks.size()));
+    stats.set("palette_iterations", double(paletteStats.iterations));
+    stats.set("palette_distortion", paletteStats.distortion);
+    stats.set("residual_iterations", double(residualStats.iterations));
+    stats.set("residual_distortion", residualStats.distortion);
+    ReportStats(cmdLine, stats, outputPath);
+    return 0;
+}
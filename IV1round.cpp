@@ -3,56 +3,135 @@
 #define VQLIB_VERBOSE_OUTPUT 1
 
 #include "VQLib/C++/VQAlgorithm.h"
+#include "Support/ImageIO.h"
 #include "Support/PNGLoader.h"
 
-#include "IV1BlockImage.h"
+#include "IV1CommandLine.h"
+#include "IV1Encode.h"
 #include "IV1File.h"
+#include "IV1Kernels.h"
+#include "IV1Library.h"
+#include "IV1Stats.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cstdio>
+#include <thread>
 #include <type_traits>
+#include <vector>
 
 using namespace VQLib;
 using namespace IV1;
 
 int main(int argc, char **args) {
-    constexpr size_t blockW = 4;
-    constexpr size_t blockH = 4;
-    if (argc < 3) {
-        printf("Usage: IV1round(.exe) image_input.png image_output.png");
+    const CommandLine cmdLine(argc, args, {"--stats", "--compact", "--histogram-palette", "--coded-indices"});
+    if (cmdLine.positional.size() < 2) {
+        printf("Usage: IV1round(.exe) [--threads N] [--isa name] [--preset fast|default|max]\n"
+               "       [--max-iterations N] [--converge X] [--time-budget seconds] [--train-blocks N]\n"
+               "       [--compact] [--histogram-palette] [--seeding spread|kmeans++|split|pca]\n"
+               "       [--dict pack.iv1p] [--coded-indices] [--png-level N|fast|store] [--png-filter name]\n"
+               "       [--stats] [--stats-json path]\n"
+               "       image_input.png|.ppm|.pam image_output.png|.ppm|.pam\n");
+        return 1;
+    }
+    const auto inputPath = cmdLine.positional[0];
+    const auto outputPath = cmdLine.positional[1];
+    if (cmdLine.has("--isa") && !SetISA(cmdLine.get("--isa", "auto"))) {
+        printf("Unsupported instruction set %s; use scalar, sse2, avx2, avx512 or auto.\n",
+            cmdLine.get("--isa", ""));
+        return 1;
     }
 
-    printf("Reading image %s...", args[1]);
-    const auto imagePath = args[1];
-    const auto imageBlocks = BlockImage<blockW, blockH>(Support::LoadPNG(imagePath));
-    if (imageBlocks.nBlocksX == 0 || imageBlocks.nBlocksY == 0) {
-        return 0;
+    // Defaults to every core; the output doesn't depend on the thread count.
+    const size_t nThreads = cmdLine.getSize("--threads", std::thread::hardware_concurrency());
+
+    Stats stats;
+
+    EncodeOptions options;
+    if (!EncodeOptionsFromCommandLine(cmdLine, options)) {
+        printf("Unknown preset %s or seeding %s; use fast, default or max, and spread, kmeans++, "
+               "split or pca.\n", cmdLine.get("--preset", "default"), cmdLine.get("--seeding", "spread"));
+        return 1;
+    }
+
+    Support::PNGWriteOptions pngOptions;
+    if (!PNGWriteOptionsFromCommandLine(cmdLine, pngOptions)) {
+        printf("--png-level expects 0-9, fast or store; --png-filter expects default, none, "
+               "sub, up, average, paeth or all.\n");
+        return 1;
+    }
+
+    // The round trip goes through libiv1, as an application embedding the
+    //  codec would, so its streams and pixels are the library's.
+    const iv1_encode_options encodeOptions = LibraryEncodeOptions(options, 0, nThreads);
+    const iv1_decode_options decodeOptions = {nThreads};
+    Encoder encoder(&encodeOptions);
+    Decoder decoder(&decodeOptions);
+    if (cmdLine.has("--dict")) {
+        const char* packPath = cmdLine.get("--dict", "");
+        const auto pack = ReadIV1Bytes(packPath);
+        if (encoder.setPack(pack.data(), pack.size()) != IV1_OK ||
+            decoder.setPack(pack.data(), pack.size()) != IV1_OK) {
+            printf("%s: %s\n", packPath, encoder.errorMessage());
+            return 1;
+        }
     }
 
-    const auto blocksPalette = BlockRGBMean<float, 3 * blockW * blockH>(imageBlocks.data);
-    const auto [dictPalette, idxPalette] = VQGenerateDictFast<float, 3, uint16_t>
-                (blocksPalette, 256, 1000);
-    const auto imgPalette = BlockImage<1, 1>(dictPalette, idxPalette, 
-                imageBlocks.nBlocksX, imageBlocks.nBlocksY);
+    FILE* progress = ProgressStream(cmdLine, outputPath);
+    fprintf(progress, "Reading image %s...", inputPath);
+    Support::RGB8Image image;
+    stats.time("read_png", [&] { image = Support::LoadImage(inputPath); });
+    if (image.width == 0 || image.height == 0) {
+        return 0;
+    }
 
-    const auto blocksDiff = BlockRGBSubtractMean<float, 3 * blockW * blockH>(imageBlocks.data, imgPalette.data);
-    const auto [dictDiff, idxDiff] = VQGenerateDictFast<float, 3 * blockW * blockH, uint16_t>(blocksDiff, 256, 1000);
-    auto imgDiff = BlockImage<blockW, blockH>(dictDiff, idxDiff, 
-                imageBlocks.nBlocksX, imageBlocks.nBlocksY);
+    std::vector<uint8_t> bytes(encoder.encodedSize(image.width, image.height));
+    size_t written = 0;
+    iv1_status status = encoder.encode(image.pixels.data(), image.width, image.height,
+        image.width * 3, bytes.data(), bytes.size(), written, &stats);
+    if (status != IV1_OK) {
+        printf("%s: %s\n", inputPath, encoder.errorMessage());
+        return 1;
+    }
+    bytes.resize(written);
 
     char savePath[1024];
-    snprintf(savePath, 1024, "%s.iv1", args[2]);
-    printf("Saving compressed outpus as %s...\n", savePath);
-    save(savePath, dictPalette, idxPalette, dictDiff, idxDiff, 
-        imgDiff.nBlocksX, imgDiff.nBlocksY, imgDiff.actualW, imgDiff.actualH);
+    snprintf(savePath, 1024, "%s.iv1", outputPath);
+    fprintf(progress, "Saving compressed outpus as %s...\n", savePath);
+    bool saved;
+    stats.time("save", [&] { saved = SaveIV1Bytes(savePath, bytes); });
+    if (!saved) {
+        printf("Could not write %s.\n", savePath);
+        return 1;
+    }
 
-    imgDiff.data = BlockRGBAddMean<float, 3 * blockW * blockH>(imgDiff.data, imgPalette.data);
-    const auto decodedImage = imgDiff.toRGB8Image();
+    // Decoding the saved bytes gives what IV1dec would from the file.
+    Support::RGB8Image decodedImage = {image.width, image.height, {}};
+    decodedImage.pixels.resize(image.pixels.size());
+    stats.time("decode", [&] {
+        status = decoder.decode(bytes.data(), bytes.size(), decodedImage.pixels.data(),
+            decodedImage.width * 3);
+    });
+    if (status != IV1_OK) {
+        printf("%s: %s\n", savePath, decoder.errorMessage());
+        return 1;
+    }
+
+    fprintf(progress, "Writing to image %s...\n", outputPath);
+    bool imageWritten;
+    stats.time("write_png", [&] {
+        imageWritten = Support::SaveImage(outputPath, decodedImage, pngOptions);
+    });
+    if (!imageWritten) {
+        printf("Could not write %s.\n", outputPath);
+        return 1;
+    }
 
-    printf("Writing to image %s...\n", args[2]);
-    const auto saveImagePath = args[2];
-    Support::SavePNG(saveImagePath, decodedImage);
+    if (cmdLine.has("--stats") || cmdLine.has("--stats-json")) {
+        stats.set("psnr", PSNR(image, decodedImage));
+        stats.set("ssim", SSIM(image, decodedImage));
+    }
+    ReportStats(cmdLine, stats, outputPath);
 
     return 0;
 }
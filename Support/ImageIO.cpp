@@ -0,0 +1,217 @@
+#include "ImageIO.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace VQLib::Support {
+
+static bool IsStdio(Path path) {
+    return strncmp("-", path, 1) == 0;
+}
+
+ImageFormat ImageFormatForPath(Path path) {
+    if (IsStdio(path)) {
+        return ImageFormat::PPM;
+    }
+    const char* extension = strrchr(path, '.');
+    if (extension && (strcmp(extension, ".ppm") == 0 || strcmp(extension, ".pnm") == 0)) {
+        return ImageFormat::PPM;
+    }
+    if (extension && strcmp(extension, ".pam") == 0) {
+        return ImageFormat::PAM;
+    }
+    return ImageFormat::PNG;
+}
+
+// Next whitespace-separated token of a PNM header, skipping comments. The
+//  single whitespace character after it is consumed too, which is what
+//  separates the last header field from the samples.
+static bool ReadToken(FILE* file, std::string& token) {
+    int c = getc(file);
+    while (c == '#' || isspace(c)) {
+        if (c == '#') {
+            while (c != '\n' && c != EOF) {
+                c = getc(file);
+            }
+        }
+        c = getc(file);
+    }
+
+    token.clear();
+    while (c != EOF && !isspace(c)) {
+        token.push_back(char(c));
+        c = getc(file);
+    }
+    return !token.empty();
+}
+
+static bool ReadNumber(FILE* file, size_t& value) {
+    std::string token;
+    if (!ReadToken(file, token) || token.size() > 9 ||
+        !std::all_of(token.begin(), token.end(), [](char c) { return isdigit(c); })) {
+        return false;
+    }
+    value = strtoul(token.c_str(), nullptr, 10);
+    return true;
+}
+
+RGB8Image LoadPNM(FILE* file) {
+    static const RGB8Image nullImage = {0, 0, {}};
+
+    std::string magic;
+    size_t width = 0, height = 0, depth = 0, maxVal = 0;
+    if (!ReadToken(file, magic)) {
+        return nullImage;
+    }
+    if (magic == "P5" || magic == "P6") {
+        depth = magic == "P6" ? 3 : 1;
+        if (!ReadNumber(file, width) || !ReadNumber(file, height) || !ReadNumber(file, maxVal)) {
+            return nullImage;
+        }
+    }
+    else if (magic == "P7") {
+        for (std::string key; ReadToken(file, key) && key != "ENDHDR"; ) {
+            std::string ignored;
+            const bool known =
+                key == "WIDTH" ? ReadNumber(file, width) :
+                key == "HEIGHT" ? ReadNumber(file, height) :
+                key == "DEPTH" ? ReadNumber(file, depth) :
+                key == "MAXVAL" ? ReadNumber(file, maxVal) :
+                key == "TUPLTYPE" && ReadToken(file, ignored);
+            if (!known) {
+                return nullImage;
+            }
+        }
+    }
+    else {
+        return nullImage;
+    }
+    if (width == 0 || height == 0 || depth == 0 || depth > 4 ||
+        maxVal == 0 || maxVal > 65535) {
+        return nullImage;
+    }
+
+    RGB8Image image;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize(width * height * 3);
+
+    // The common case needs no conversion at all.
+    if (depth == 3 && maxVal == 255) {
+        if (fread(image.pixels.data(), image.pixels.size(), 1, file) != 1) {
+            return nullImage;
+        }
+        return image;
+    }
+
+    // Gray (with or without alpha) is spread over RGB, alpha dropped and
+    //  wider samples (big-endian, two bytes) scaled to 8 bits.
+    const size_t sampleSize = maxVal > 255 ? 2 : 1;
+    std::vector<uint8_t> row(width * depth * sampleSize);
+    for (size_t y = 0; y != height; ++y) {
+        if (fread(row.data(), row.size(), 1, file) != 1) {
+            return nullImage;
+        }
+        uint8_t* pixel = &image.pixels[y * width * 3];
+        for (size_t x = 0; x != width; ++x) {
+            for (size_t ch = 0; ch != 3; ++ch) {
+                const size_t sample = (x * depth + (depth < 3 ? 0 : ch)) * sampleSize;
+                const size_t value = sampleSize == 2
+                    ? row[sample] << 8 | row[sample + 1] : row[sample];
+                pixel[x * 3 + ch] = uint8_t((std::min(value, maxVal) * 255 + maxVal / 2) / maxVal);
+            }
+        }
+    }
+    return image;
+}
+
+static bool WritePNMHeader(FILE* file, size_t width, size_t height, ImageFormat format) {
+    if (format == ImageFormat::PAM) {
+        return fprintf(file, "P7\nWIDTH %zu\nHEIGHT %zu\nDEPTH 3\nMAXVAL 255\n"
+                             "TUPLTYPE RGB\nENDHDR\n", width, height) > 0;
+    }
+    return fprintf(file, "P6\n%zu %zu\n255\n", width, height) > 0;
+}
+
+bool SavePNM(FILE* file, const RGB8Image& image, ImageFormat format) {
+    return WritePNMHeader(file, image.width, image.height, format) &&
+        (image.pixels.empty() || fwrite(image.pixels.data(), image.pixels.size(), 1, file) == 1);
+}
+
+RGB8Image LoadImage(Path path) {
+    FILE* file = IsStdio(path) ? stdin : fopen(path, "rb");
+    if (!file) {
+        return {0, 0, {}};
+    }
+
+    // Every PNM magic starts with a 'P', which no PNG signature does.
+    const int first = getc(file);
+    ungetc(first, file);
+    auto image = first == 'P' ? LoadPNM(file) : LoadPNG(file);
+
+    if (file != stdin) {
+        fclose(file);
+    }
+    return image;
+}
+
+bool SaveImage(Path path, const RGB8Image& image, const PNGWriteOptions& options) {
+    const auto format = ImageFormatForPath(path);
+    if (format == ImageFormat::PNG) {
+        return SavePNG(path, image, options);
+    }
+
+    FILE* file = IsStdio(path) ? stdout : fopen(path, "wb");
+    if (!file) {
+        return false;
+    }
+    const bool written = SavePNM(file, image, format);
+    return (file == stdout ? fflush(file) : fclose(file)) == 0 && written;
+}
+
+ImageRowWriter::ImageRowWriter(Path path, size_t width, size_t height,
+                               const PNGWriteOptions& options) {
+    const auto format = ImageFormatForPath(path);
+    if (format == ImageFormat::PNG) {
+        png = std::make_unique<PNGRowWriter>(path, width, height, options);
+        return;
+    }
+
+    file = IsStdio(path) ? stdout : fopen(path, "wb");
+    if (file && !WritePNMHeader(file, width, height, format)) {
+        if (file != stdout) {
+            fclose(file);
+        }
+        file = nullptr;
+    }
+    rowSize = width * 3;
+}
+
+ImageRowWriter::~ImageRowWriter() {
+    finish();
+}
+
+bool ImageRowWriter::writeRow(const uint8_t* row) {
+    if (png) {
+        return png->writeRow(row);
+    }
+    failed |= !file || fwrite(row, rowSize, 1, file) != 1;
+    return !failed;
+}
+
+bool ImageRowWriter::finish() {
+    if (png) {
+        return png->finish();
+    }
+    if (file) {
+        failed |= (file == stdout ? fflush(file) : fclose(file)) != 0;
+        file = nullptr;
+    }
+    return !failed;
+}
+
+}
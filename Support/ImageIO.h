@@ -0,0 +1,54 @@
+#pragma once
+
+#include "PNGLoader.h"
+#include "RGB8Image.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+namespace VQLib::Support {
+
+// Image files in whatever format their name asks for: binary PPM (P6) for
+//  .ppm and .pnm, PAM (P7) for .pam, and PNG for anything else. A path of
+//  "-" means stdin or stdout; stdin is told apart by its first bytes and
+//  stdout gets PPM, since nothing pipes PNG around.
+enum class ImageFormat { PNG, PPM, PAM };
+
+ImageFormat ImageFormatForPath(Path);
+
+// Loads an 8-bit RGB image; alpha is dropped, gray is promoted to RGB and
+//  PNM samples over 8 bits are scaled down. Gives an empty image on failure.
+RGB8Image LoadImage(Path);
+bool SaveImage(Path, const RGB8Image&, const PNGWriteOptions& = {});
+
+// Binary PPM, PGM (read only) and PAM. Reading the bytes straight into
+//  the image is all there is to it for 8-bit RGB, which is what makes these
+//  worth having next to PNG.
+RGB8Image LoadPNM(FILE*);
+bool SavePNM(FILE*, const RGB8Image&, ImageFormat);
+
+// Writes an image one row at a time in the format its path asks for, like
+//  PNGRowWriter. The file is finished by finish(), or when the writer is
+//  destroyed.
+class ImageRowWriter {
+public:
+    ImageRowWriter(Path, size_t width, size_t height, const PNGWriteOptions& = {});
+    ~ImageRowWriter();
+
+    ImageRowWriter(const ImageRowWriter&) = delete;
+    ImageRowWriter& operator=(const ImageRowWriter&) = delete;
+
+    bool valid() const { return png ? png->valid() : file != nullptr; }
+    // As PNGRowWriter's: false once anything could not be written.
+    bool writeRow(const uint8_t* row);
+    bool finish();
+
+private:
+    std::unique_ptr<PNGRowWriter> png;
+    FILE* file = nullptr;
+    size_t rowSize = 0;
+    bool failed = false;
+};
+
+}
@@ -9,14 +9,9 @@
 
 namespace VQLib::Support {
 
-RGB8Image LoadPNG(Path path) {
+RGB8Image LoadPNG(FILE* file) {
     static const RGB8Image nullImage = {0, 0, {}};
 
-    FILE* file = fopen(path, "rb");
-    if (!file) {
-        return nullImage;
-    }
-
     png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png) {
         return nullImage;
@@ -24,6 +19,12 @@ RGB8Image LoadPNG(Path path) {
 
     png_infop info = png_create_info_struct(png);
     if (!info) {
+        png_destroy_read_struct(&png, NULL, NULL);
+        return nullImage;
+    }
+
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_read_struct(&png, &info, NULL);
         return nullImage;
     }
 
@@ -33,7 +34,8 @@ RGB8Image LoadPNG(Path path) {
     constexpr auto png_transforms = 
           PNG_TRANSFORM_STRIP_ALPHA
         | PNG_TRANSFORM_STRIP_16 
-        | PNG_TRANSFORM_EXPAND;
+        | PNG_TRANSFORM_EXPAND
+        | PNG_TRANSFORM_GRAY_TO_RGB;
     png_read_png(png, info, png_transforms, nullptr);
     auto rows = png_get_rows(png, info);
 
@@ -49,31 +51,60 @@ RGB8Image LoadPNG(Path path) {
         std::copy(rows[y], rows[y] + row_size,
                   &image.pixels[y * row_size]);
     }
-    
-    fclose(file);
 
     png_destroy_read_struct(&png, &info, NULL);
     
     return image;
 }
 
-void SavePNG(Path path, const RGB8Image& image) {
-    FILE* file = fopen(path, "wb");
+RGB8Image LoadPNG(Path path) {
+    FILE* file = fopen(path, "rb");
     if (!file) {
-        return;
+        return {0, 0, {}};
     }
+    auto image = LoadPNG(file);
+    fclose(file);
+    return image;
+}
 
+// Applies `options` to a write struct; must come before png_write_info.
+static void SetWriteOptions(png_structp png, const PNGWriteOptions& options) {
+    if (options.compressionLevel >= 0) {
+        png_set_compression_level(png, std::min(options.compressionLevel, 9));
+    }
+
+    int filters;
+    switch (options.filter) {
+        case PNGFilter::None:    filters = PNG_FILTER_NONE;  break;
+        case PNGFilter::Sub:     filters = PNG_FILTER_SUB;   break;
+        case PNGFilter::Up:      filters = PNG_FILTER_UP;    break;
+        case PNGFilter::Average: filters = PNG_FILTER_AVG;   break;
+        case PNGFilter::Paeth:   filters = PNG_FILTER_PAETH; break;
+        case PNGFilter::All:     filters = PNG_ALL_FILTERS;  break;
+        default: return;
+    }
+    png_set_filter(png, PNG_FILTER_TYPE_BASE, filters);
+}
+
+bool SavePNG(FILE* file, const RGB8Image& image, const PNGWriteOptions& options) {
     png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png) {
-        return;
+        return false;
     }
 
     png_infop info = png_create_info_struct(png);
     if (!info) {
-        return;
+        png_destroy_write_struct(&png, NULL);
+        return false;
+    }
+
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        return false;
     }
 
     png_init_io(png, file);
+    SetWriteOptions(png, options);
 
     // Output is 8bit depth, RGB format.
     png_set_IHDR(
@@ -88,30 +119,181 @@ void SavePNG(Path path, const RGB8Image& image) {
     );
     png_write_info(png, info);
 
-    png_bytepp rows = (png_bytepp)malloc(sizeof(png_bytep) * image.height);
-
-    
+    // The image is already laid out as PNG rows; they're handed to libpng
+    //  where they are.
     for (size_t y = 0; y != image.height; ++y) {
-        rows[y] = (png_bytep)malloc(3 * image.width);
-        for (size_t x = 0; x != image.width; ++x) {
-            for (size_t ch = 0; ch != 3; ++ch) {
-                rows[y][(x * 3) + ch] =
-                    image.pixels[(y * image.width + x) * 3 + ch];
-            }
-        }
+        png_write_row(png, &image.pixels[y * image.width * 3]);
     }
 
-    png_set_rows(png, info, rows);
-    png_write_png(png, info, 0, NULL);
+    png_write_end(png, info);
+    png_destroy_write_struct(&png, &info);
+    return true;
+}
 
-    for (int y = 0; y != image.height; ++y) {
-        free(rows[y]);
+bool SavePNG(Path path, const RGB8Image& image, const PNGWriteOptions& options) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        return false;
     }
-    free(rows);
+    const bool written = SavePNG(file, image, options);
+    return fclose(file) == 0 && written;
+}
 
-    png_write_end(png, info);
-    fclose(file);
-    png_destroy_write_struct(&png, &info);
+PNGRowReader::PNGRowReader(Path path) {
+    file = fopen(path, "rb");
+    if (!file) {
+        return;
+    }
+
+    // Other formats are turned away quietly, without libpng's complaints.
+    png_byte signature[8];
+    if (fread(signature, sizeof(signature), 1, file) != 1 ||
+        png_sig_cmp(signature, 0, sizeof(signature)) != 0) {
+        return;
+    }
+
+    png_structp pngRead = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!pngRead) {
+        return;
+    }
+
+    png_infop pngInfo = png_create_info_struct(pngRead);
+    if (!pngInfo) {
+        png_destroy_read_struct(&pngRead, nullptr, nullptr);
+        return;
+    }
+
+    if (setjmp(png_jmpbuf(pngRead))) {
+        png_destroy_read_struct(&pngRead, &pngInfo, nullptr);
+        return;
+    }
+
+    png_init_io(pngRead, file);
+    png_set_sig_bytes(pngRead, sizeof(signature));
+    png_read_info(pngRead, pngInfo);
+    if (png_get_interlace_type(pngRead, pngInfo) != PNG_INTERLACE_NONE) {
+        png_destroy_read_struct(&pngRead, &pngInfo, nullptr);
+        return;
+    }
+
+    // Same as LoadPNG's transforms, with gray promoted to RGB as well.
+    png_set_strip_alpha(pngRead);
+    png_set_strip_16(pngRead);
+    png_set_expand(pngRead);
+    png_set_gray_to_rgb(pngRead);
+    png_read_update_info(pngRead, pngInfo);
+
+    imageWidth = png_get_image_width(pngRead, pngInfo);
+    imageHeight = png_get_image_height(pngRead, pngInfo);
+    png = pngRead;
+    info = pngInfo;
+}
+
+PNGRowReader::~PNGRowReader() {
+    if (png) {
+        auto pngRead = static_cast<png_structp>(png);
+        auto pngInfo = static_cast<png_infop>(info);
+        png_destroy_read_struct(&pngRead, &pngInfo, nullptr);
+    }
+    if (file) {
+        fclose(file);
+    }
+}
+
+bool PNGRowReader::readRow(uint8_t* row) {
+    if (!png || rowsRead == imageHeight) {
+        return false;
+    }
+    auto pngRead = static_cast<png_structp>(png);
+    if (setjmp(png_jmpbuf(pngRead))) {
+        return false;
+    }
+    png_read_row(pngRead, row, nullptr);
+    ++rowsRead;
+    return true;
+}
+
+PNGRowWriter::PNGRowWriter(Path path, size_t width, size_t height,
+                           const PNGWriteOptions& options) {
+    file = fopen(path, "wb");
+    if (!file) {
+        return;
+    }
+
+    png_structp pngWrite = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (!pngWrite) {
+        return;
+    }
+
+    png_infop pngInfo = png_create_info_struct(pngWrite);
+    if (!pngInfo) {
+        png_destroy_write_struct(&pngWrite, nullptr);
+        return;
+    }
+
+    if (setjmp(png_jmpbuf(pngWrite))) {
+        png_destroy_write_struct(&pngWrite, &pngInfo);
+        return;
+    }
+
+    png_init_io(pngWrite, file);
+    SetWriteOptions(pngWrite, options);
+
+    // Output is 8bit depth, RGB format.
+    png_set_IHDR(
+        pngWrite,
+        pngInfo,
+        width, height,
+        8,
+        PNG_COLOR_TYPE_RGB,
+        PNG_INTERLACE_NONE,
+        PNG_COMPRESSION_TYPE_DEFAULT,
+        PNG_FILTER_TYPE_DEFAULT
+    );
+    png_write_info(pngWrite, pngInfo);
+
+    png = pngWrite;
+    info = pngInfo;
+}
+
+PNGRowWriter::~PNGRowWriter() {
+    finish();
+}
+
+bool PNGRowWriter::writeRow(const uint8_t* row) {
+    if (!png || failed) {
+        return false;
+    }
+    auto pngWrite = static_cast<png_structp>(png);
+    if (setjmp(png_jmpbuf(pngWrite))) {
+        failed = true;
+        return false;
+    }
+    png_write_row(pngWrite, row);
+    return true;
+}
+
+bool PNGRowWriter::finish() {
+    if (png) {
+        auto pngWrite = static_cast<png_structp>(png);
+        auto pngInfo = static_cast<png_infop>(info);
+        if (!failed) {
+            if (setjmp(png_jmpbuf(pngWrite))) {
+                failed = true;
+            }
+            else {
+                png_write_end(pngWrite, pngInfo);
+            }
+        }
+        png_destroy_write_struct(&pngWrite, &pngInfo);
+        png = nullptr;
+        info = nullptr;
+    }
+    if (file) {
+        failed |= fclose(file) != 0;
+        file = nullptr;
+    }
+    return !failed;
 }
 
 }
@@ -2,11 +2,80 @@
 
 #include "RGB8Image.h"
 
+#include <cstdint>
+#include <cstdio>
+
 namespace VQLib::Support {
 
 using Path = const char *;
 
+// How hard SavePNG and PNGRowWriter work at compression. The defaults are
+//  libpng's; decoded IV1 images rarely get much out of the higher levels,
+//  and {0, PNGFilter::None} just stores the rows, for when the PNG is only
+//  a stop on the way somewhere else.
+enum class PNGFilter { Default, None, Sub, Up, Average, Paeth, All };
+
+struct PNGWriteOptions {
+    int compressionLevel = -1;              // zlib level, 0 (store) to 9; -1 for zlib's default
+    PNGFilter filter = PNGFilter::Default;  // Default lets libpng pick per row
+};
+
 RGB8Image LoadPNG(Path);
-void SavePNG(Path, const RGB8Image&);
+RGB8Image LoadPNG(FILE*);
+bool SavePNG(Path, const RGB8Image&, const PNGWriteOptions& = {});
+bool SavePNG(FILE*, const RGB8Image&, const PNGWriteOptions& = {});
+
+// Reads a PNG as 8-bit RGB one row at a time (via png_read_row), so the
+//  caller never needs to hold the whole image in memory. Interlaced PNGs
+//  can't be read that way; they come out as invalid, and LoadPNG has to
+//  be used instead.
+class PNGRowReader {
+public:
+    PNGRowReader(Path);
+    ~PNGRowReader();
+
+    PNGRowReader(const PNGRowReader&) = delete;
+    PNGRowReader& operator=(const PNGRowReader&) = delete;
+
+    bool valid() const { return png != nullptr; }
+    size_t width() const { return imageWidth; }
+    size_t height() const { return imageHeight; }
+    // Reads the next row, width() * 3 bytes, into `row`. Returns false
+    //  if the file is broken or there are no rows left.
+    bool readRow(uint8_t* row);
+
+private:
+    FILE* file = nullptr;
+    void* png = nullptr;
+    void* info = nullptr;
+    size_t imageWidth = 0, imageHeight = 0;
+    size_t rowsRead = 0;
+};
+
+// Writes an 8-bit RGB PNG one row at a time (via png_write_row), so the
+//  caller never needs to hold the whole image in memory. The file is
+//  finished by finish(), or when the writer is destroyed.
+class PNGRowWriter {
+public:
+    PNGRowWriter(Path, size_t width, size_t height, const PNGWriteOptions& = {});
+    ~PNGRowWriter();
+
+    PNGRowWriter(const PNGRowWriter&) = delete;
+    PNGRowWriter& operator=(const PNGRowWriter&) = delete;
+
+    bool valid() const { return png != nullptr; }
+    // Writes the next row, width * 3 bytes. Returns false if this or an
+    //  earlier row could not be written.
+    bool writeRow(const uint8_t* row);
+    // Ends the PNG and closes the file. Returns false if anything since
+    //  the file was opened could not be written.
+    bool finish();
+
+private:
+    FILE* file = nullptr;
+    void* png = nullptr;
+    void* info = nullptr;
+    bool failed = false;
+};
 
 }
@@ -0,0 +1,116 @@
+#pragma once
+
+// C interface to libiv1: IV1 encoding and decoding between buffers in
+//  memory, with no files involved. Encoders and decoders are contexts
+//  that keep their scratch memory (and threads) from one image to the
+//  next, so a long-lived process should hold on to them; one context may
+//  only be used by one thread at a time.
+//
+// Pixels are 8-bit RGB, `stride` bytes apart from one row to the next.
+//  Streams are exactly what IV1enc writes and IV1dec reads, including
+//  tiled containers and streams that reference a dictionary pack.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(IV1_SHARED_LIBRARY)
+#if defined(IV1_BUILDING_LIBRARY)
+#define IV1_API __declspec(dllexport)
+#else
+#define IV1_API __declspec(dllimport)
+#endif
+#elif defined(IV1_SHARED_LIBRARY)
+#define IV1_API __attribute__((visibility("default")))
+#else
+#define IV1_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum iv1_status {
+    IV1_OK = 0,
+    IV1_ERROR_INVALID_ARGUMENT,     // see the context's error message
+    IV1_ERROR_BUFFER_TOO_SMALL,     // the size needed is reported back
+    IV1_ERROR_INVALID_STREAM,       // see the context's error message
+    IV1_ERROR_OUT_OF_MEMORY         // or out of threads
+} iv1_status;
+
+// How training picks its starting dictionaries; see VQSeeding in IV1VQ.h.
+typedef enum iv1_seeding {
+    IV1_SEEDING_SPREAD = 0,         // samples spread evenly over the image
+    IV1_SEEDING_KMEANS_PLUS_PLUS,
+    IV1_SEEDING_SPLIT,              // LBG splitting
+    IV1_SEEDING_PCA                 // principal-axis splitting
+} iv1_seeding;
+
+// How hard the encoder tries; see EncodeOptions in IV1Encode.h. New fields
+//  only ever go at the end, so the ones before keep their offsets.
+typedef struct iv1_encode_options {
+    size_t max_iterations;
+    double min_relative_improvement;
+    double time_budget_seconds;         // 0 for no limit
+    size_t residual_training_blocks;    // 0 trains on every block
+    int compact_training;
+    size_t tile_size;       // 0 for a single stream, which caps images at 262140 pixels a side
+    size_t threads;         // 0 for every core
+    int coded_indices;      // entropy code the index planes: smaller streams, same pixels
+    int histogram_palette;  // build the palette from a histogram of the block means: much faster
+    int seeding;            // an iv1_seeding
+} iv1_encode_options;
+
+typedef struct iv1_decode_options {
+    size_t threads;         // 0 for every core; bands of the image are decoded concurrently
+} iv1_decode_options;
+
+typedef struct iv1_encoder iv1_encoder;
+typedef struct iv1_decoder iv1_decoder;
+
+// Fills `options` with a named preset: "fast", "default" (also for NULL)
+//  or "max". Returns 0 for unknown names, leaving `options` untouched.
+IV1_API int iv1_encode_options_preset(iv1_encode_options* options, const char* preset);
+
+// A null `options` means the default preset. Returns NULL when out of memory.
+IV1_API iv1_encoder* iv1_encoder_create(const iv1_encode_options* options);
+IV1_API void iv1_encoder_destroy(iv1_encoder* encoder);
+
+// Encodes against the dictionary pack in the `size` bytes of a .iv1p file
+//  from now on; a null `pack` goes back to training dictionaries per image.
+IV1_API iv1_status iv1_encoder_set_pack(iv1_encoder* encoder, const uint8_t* pack, size_t size);
+
+// The exact size of the stream iv1_encode writes for a width x height image,
+//  or with coded_indices, the most it can take.
+IV1_API size_t iv1_encoded_size(const iv1_encoder* encoder, size_t width, size_t height);
+
+// Encodes `pixels` into `out`, which needs iv1_encoded_size bytes. On success
+//  `*written` is set to the stream size, and with IV1_ERROR_BUFFER_TOO_SMALL
+//  to the size needed; passing a `capacity` of 0 is a way to ask for it.
+IV1_API iv1_status iv1_encode(iv1_encoder* encoder, const uint8_t* pixels,
+                              size_t width, size_t height, size_t stride,
+                              uint8_t* out, size_t capacity, size_t* written);
+
+// What went wrong with the last call, or NULL.
+IV1_API const char* iv1_encoder_error(const iv1_encoder* encoder);
+
+// A null `options` decodes on every core. Returns NULL when out of memory.
+IV1_API iv1_decoder* iv1_decoder_create(const iv1_decode_options* options);
+IV1_API void iv1_decoder_destroy(iv1_decoder* decoder);
+
+// As iv1_encoder_set_pack, for streams encoded against a pack.
+IV1_API iv1_status iv1_decoder_set_pack(iv1_decoder* decoder, const uint8_t* pack, size_t size);
+
+// Reads the image dimensions out of the first bytes of a stream.
+IV1_API iv1_status iv1_decode_info(iv1_decoder* decoder, const uint8_t* data, size_t size,
+                                   size_t* width, size_t* height);
+
+// Decodes the `size` bytes at `data` into `pixels`, which must hold
+//  `height` rows of `stride` >= width * 3 bytes.
+IV1_API iv1_status iv1_decode(iv1_decoder* decoder, const uint8_t* data, size_t size,
+                              uint8_t* pixels, size_t stride);
+
+IV1_API const char* iv1_decoder_error(const iv1_decoder* decoder);
+
+#ifdef __cplusplus
+}
+#endif